@@ -0,0 +1,147 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * bench_chan measures the throughput of a producer handing NITEMS items to
+ * a consumer. The baseline is a ring buffer guarded by a lock and two
+ * condition variables, as our pipelines used to do it. The channel is then
+ * used with batches of 1, 16 and 256 items per chan_send_n/chan_recv_n.
+ * Items per second are reported.
+ *****************************************************************************/
+
+#define NITEMS 2000000
+#define CAPACITY 256
+
+static struct chan *chan;
+static int batch;
+
+static struct lock *buflock;
+static struct cv *notfull, *notempty;
+static long ring[CAPACITY];
+static int head, count;
+
+static void
+ring_producer(void *arg)
+{
+	long i;
+
+	for (i = 0; i < NITEMS; i++) {
+		lock_acquire(buflock);
+		while (count == CAPACITY) {
+			cv_wait(notfull, buflock);
+		}
+		ring[(head + count++) % CAPACITY] = i;
+		cv_signal(notempty, buflock);
+		lock_release(buflock);
+	}
+}
+
+static void
+chan_producer(void *arg)
+{
+	long buf[256];
+	long i = 0;
+	int j;
+
+	while (i < NITEMS) {
+		for (j = 0; j < batch && i < NITEMS; j++) {
+			buf[j] = i++;
+		}
+		chan_send_n(chan, buf, j);
+	}
+	chan_close(chan);
+}
+
+static volatile long sum;
+
+static void
+report(const char *name, struct timespec *start)
+{
+	struct timespec end, diff;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	diff = timespec_sub(&end, start);
+	assert(sum == (long)NITEMS * (NITEMS - 1) / 2);
+	unintr_printf("%-16s %12.0f items/s\n", name, NITEMS /
+		      (diff.tv_sec + (double)diff.tv_nsec / NSEC_PER_SEC));
+}
+
+static void
+bench_ring(void)
+{
+	struct timespec start;
+	Tid producer;
+	long i;
+
+	buflock = lock_create();
+	notfull = cv_create();
+	notempty = cv_create();
+	sum = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	producer = thread_create(ring_producer, NULL);
+	assert(thread_ret_ok(producer));
+	for (i = 0; i < NITEMS; i++) {
+		lock_acquire(buflock);
+		while (count == 0) {
+			cv_wait(notempty, buflock);
+		}
+		sum += ring[head];
+		head = (head + 1) % CAPACITY;
+		count--;
+		cv_signal(notfull, buflock);
+		lock_release(buflock);
+	}
+	thread_wait(producer, NULL);
+	report("lock+cv ring", &start);
+
+	cv_destroy(notfull);
+	cv_destroy(notempty);
+	lock_destroy(buflock);
+}
+
+static void
+bench_chan(int n)
+{
+	char name[32];
+	struct timespec start;
+	Tid producer;
+	long buf[256];
+	int got, j;
+
+	chan = chan_create(CAPACITY, sizeof(long));
+	batch = n;
+	sum = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	producer = thread_create(chan_producer, NULL);
+	assert(thread_ret_ok(producer));
+	while ((got = chan_recv_n(chan, buf, batch)) > 0) {
+		for (j = 0; j < got; j++) {
+			sum += buf[j];
+		}
+	}
+	thread_wait(producer, NULL);
+	snprintf(name, sizeof(name), "chan, batch %d", n);
+	report(name, &start);
+
+	chan_destroy(chan);
+}
+
+int
+main(int argc, char **argv)
+{
+	install_fatal_handlers((void *)main);
+	init_csc369_malloc(false);
+	thread_init();
+	register_interrupt_handler(false);
+
+	bench_ring();
+	bench_chan(1);
+	bench_chan(16);
+	bench_chan(256);
+	return 0;
+}
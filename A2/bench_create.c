@@ -0,0 +1,82 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * bench_create measures thread_create() cost as the thread table fills up.
+ * For each occupancy level, the initial thread first creates 'occupancy'
+ * filler threads that go to sleep on a wait queue and hold on to the lowest
+ * Tids. It then repeatedly creates a thread that exits immediately and yields
+ * to it, so every create has to find the free Tid above the sleeping
+ * threads. Only the time spent inside thread_create() is reported.
+ *****************************************************************************/
+
+#define NCHURN 20000 /* create/exit cycles per occupancy level */
+
+static struct wait_queue *filler_queue;
+
+static void
+filler_thread(void *arg)
+{
+	bool enabled = interrupts_off();
+	thread_sleep(filler_queue);
+	interrupts_set(enabled);
+}
+
+static void
+churn_thread(void *arg)
+{
+	thread_exit(0);
+}
+
+static void
+bench_create(int occupancy)
+{
+	struct timespec start, end, diff;
+	long total_ns = 0;
+	int i;
+
+	for (i = 0; i < occupancy; i++) {
+		Tid ret = thread_create(filler_thread, NULL);
+		assert(thread_ret_ok(ret));
+	}
+	/* let the fillers run and go to sleep */
+	while (thread_yield(THREAD_ANY) != THREAD_NONE)
+		;
+
+	for (i = 0; i < NCHURN; i++) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		Tid ret = thread_create(churn_thread, NULL);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		assert(thread_ret_ok(ret));
+		diff = timespec_sub(&end, &start);
+		total_ns += diff.tv_sec * NSEC_PER_SEC + diff.tv_nsec;
+		thread_yield(ret);
+	}
+
+	thread_wakeup(filler_queue, 1);
+	while (thread_yield(THREAD_ANY) != THREAD_NONE)
+		;
+
+	unintr_printf("%5d threads live: %8.0f ns/create\n", occupancy + 1,
+		      (double)total_ns / NCHURN);
+}
+
+int
+main(int argc, char **argv)
+{
+	install_fatal_handlers((void *)main);
+	init_csc369_malloc(false);
+	thread_init();
+
+	filler_queue = wait_queue_create();
+	bench_create(0);
+	bench_create(THREAD_MAX_THREADS / 4);
+	bench_create(THREAD_MAX_THREADS / 2);
+	bench_create(THREAD_MAX_THREADS * 3 / 4);
+	bench_create(THREAD_MAX_THREADS - 2);
+	wait_queue_destroy(filler_queue);
+	return 0;
+}
@@ -0,0 +1,86 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * bench_cv measures cv_broadcast. NWAITERS threads wait on a condition
+ * variable for the next round, and the initial thread broadcasts once all of
+ * them are waiting, for NROUNDS rounds. The time per round and the number of
+ * times a sleeping thread was woken up (thread_wakeups) per broadcast are
+ * reported. Each waiter yields once while it holds the lock after waking up,
+ * as if it were preempted there. Each waiter has to be woken once per round;
+ * any more wakeups are waiters that ran only to find the lock held and went
+ * back to sleep.
+ *****************************************************************************/
+
+#define NWAITERS 64
+#define NROUNDS 2000
+
+static struct lock *testlock;
+static struct cv *round_cv;	/* a new round has started */
+static struct cv *waiting_cv;	/* all the waiters are waiting */
+static int nwaiting;
+static int round_nr;
+
+static void
+waiter_thread(void *arg)
+{
+	int i;
+
+	lock_acquire(testlock);
+	for (i = 0; i < NROUNDS; i++) {
+		if (++nwaiting == NWAITERS) {
+			cv_signal(waiting_cv, testlock);
+		}
+		while (round_nr == i) {
+			cv_wait(round_cv, testlock);
+		}
+		thread_yield(THREAD_ANY);
+	}
+	lock_release(testlock);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct timespec start, end, diff;
+	unsigned long wakeups;
+	int i;
+
+	install_fatal_handlers((void *)main);
+	init_csc369_malloc(false);
+	thread_init();
+	register_interrupt_handler(false);
+	testlock = lock_create();
+	round_cv = cv_create();
+	waiting_cv = cv_create();
+
+	for (i = 0; i < NWAITERS; i++) {
+		Tid tid = thread_create(waiter_thread, NULL);
+		assert(thread_ret_ok(tid));
+	}
+
+	wakeups = thread_wakeups();
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	lock_acquire(testlock);
+	for (i = 0; i < NROUNDS; i++) {
+		while (nwaiting < NWAITERS) {
+			cv_wait(waiting_cv, testlock);
+		}
+		nwaiting = 0;
+		round_nr++;
+		cv_broadcast(round_cv, testlock);
+	}
+	lock_release(testlock);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	wakeups = thread_wakeups() - wakeups;
+
+	diff = timespec_sub(&end, &start);
+	unintr_printf("%d waiters: %8.1f usecs per round, "
+		      "%6.1f wakeups per broadcast\n", NWAITERS,
+		      (diff.tv_sec * (double)NSEC_PER_SEC + diff.tv_nsec) /
+		      (1000.0 * NROUNDS), (double)wakeups / NROUNDS);
+	return 0;
+}
@@ -0,0 +1,107 @@
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * bench_lock measures a contended lock. NCONTENDERS threads, as many as in
+ * test_lock, each acquire and release one lock NACQUIRES times, yielding
+ * while they hold it so that the others pile up on its wait queue. The
+ * number of acquisitions per second and the number of times a waiting
+ * thread was woken up (thread_wakeups) per acquisition are reported. The
+ * run is repeated with 1 and with NWORKERS workers, each in its own child
+ * process, since the threads library can only be initialized once.
+ *****************************************************************************/
+
+#define NCONTENDERS 128
+#define NACQUIRES 2000 /* per thread */
+#define NWORKERS 4
+
+static struct lock *testlock;
+static struct cv *done_cv;
+static int ndone;
+
+struct result {
+	double secs;
+	unsigned long wakeups;
+};
+
+static void
+contender_thread(void *arg)
+{
+	int i;
+
+	for (i = 0; i < NACQUIRES; i++) {
+		lock_acquire(testlock);
+		thread_yield(THREAD_ANY);
+		lock_release(testlock);
+	}
+
+	lock_acquire(testlock);
+	ndone++;
+	cv_signal(done_cv, testlock);
+	lock_release(testlock);
+}
+
+static void
+bench_lock(int nworkers, struct result *res)
+{
+	struct timespec start, end, diff;
+	unsigned long wakeups;
+	int i, ret;
+
+	ret = thread_init_workers(nworkers);
+	assert(!ret);
+	register_interrupt_handler(false);
+	testlock = lock_create();
+	done_cv = cv_create();
+
+	wakeups = thread_wakeups();
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < NCONTENDERS; i++) {
+		Tid tid = thread_create(contender_thread, NULL);
+		assert(thread_ret_ok(tid));
+	}
+	lock_acquire(testlock);
+	while (ndone < NCONTENDERS) {
+		cv_wait(done_cv, testlock);
+	}
+	lock_release(testlock);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	diff = timespec_sub(&end, &start);
+	res->secs = diff.tv_sec + (double)diff.tv_nsec / NSEC_PER_SEC;
+	res->wakeups = thread_wakeups() - wakeups;
+}
+
+int
+main(int argc, char **argv)
+{
+	int nworkers, status;
+	struct result *res;
+	double nacquires = (double)NCONTENDERS * NACQUIRES;
+
+	install_fatal_handlers((void *)main);
+
+	/* shared with the children, which report their results here */
+	res = mmap(NULL, sizeof(*res), PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	assert(res != MAP_FAILED);
+
+	for (nworkers = 1; nworkers <= NWORKERS; nworkers *= NWORKERS) {
+		fflush(stdout);
+		if (fork() == 0) {
+			init_csc369_malloc(false);
+			bench_lock(nworkers, res);
+			exit(0);
+		}
+		wait(&status);
+		unintr_printf("%d workers: %10.0f acquisitions/s, "
+			      "%5.2f wakeups per acquisition\n", nworkers,
+			      nacquires / res->secs, res->wakeups / nacquires);
+	}
+	return 0;
+}
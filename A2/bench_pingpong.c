@@ -0,0 +1,66 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * bench_pingpong measures the cost of one voluntary context switch. The
+ * initial thread and a partner thread yield directly to each other, so
+ * there is no ready queue search, and the elapsed time divided by the number
+ * of switches is reported. The run is repeated with the getcontext/
+ * setcontext switch and with the thread_switch fast path.
+ *****************************************************************************/
+
+#define NROUNDS 500000 /* round trips per run, i.e. 2 switches each */
+
+static volatile int stop;
+
+static void
+partner_thread(void *arg)
+{
+	while (!stop) {
+		thread_yield(0);
+	}
+}
+
+static void
+bench_pingpong(bool ucontext)
+{
+	struct timespec start, end, diff;
+	Tid partner;
+	long i;
+
+	thread_use_ucontext(ucontext);
+	stop = 0;
+	partner = thread_create(partner_thread, NULL);
+	assert(thread_ret_ok(partner));
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < NROUNDS; i++) {
+		thread_yield(partner);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	stop = 1;
+	while (thread_yield(THREAD_ANY) != THREAD_NONE)
+		;
+
+	diff = timespec_sub(&end, &start);
+	unintr_printf("%-20s %6.1f ns/switch\n",
+		      ucontext ? "getcontext/setcontext" : "thread_switch",
+		      (diff.tv_sec * (double)NSEC_PER_SEC + diff.tv_nsec) /
+		      (2.0 * NROUNDS));
+}
+
+int
+main(int argc, char **argv)
+{
+	install_fatal_handlers((void *)main);
+	init_csc369_malloc(false);
+	thread_init();
+
+	bench_pingpong(true);
+	bench_pingpong(false);
+	return 0;
+}
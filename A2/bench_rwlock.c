@@ -0,0 +1,141 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * bench_rwlock measures the throughput of a read-mostly shared table guarded
+ * by a plain lock, and by a reader-writer lock with each preference.
+ * NCONTENDERS threads each do NOPS operations, of which READ_PERCENT are
+ * reads. Every operation sleeps for HOLD_USECS inside its critical section,
+ * as a lookup that waits for I/O would, and readers can overlap meanwhile
+ * under a reader-writer lock. Operations per second are reported.
+ *
+ * Usage: bench_rwlock [read percent]
+ *****************************************************************************/
+
+#define NCONTENDERS 64
+#define NOPS 200 /* per thread */
+#define HOLD_USECS 100
+#define TABLE_SIZE 64
+
+enum kind { PLAIN, PREFER_READERS, PREFER_WRITERS };
+
+static int read_percent = 90;
+static enum kind kind;
+static struct lock *plain;
+static struct rwlock *rwlock;
+static unsigned long table[TABLE_SIZE];
+
+static void
+read_lock(void)
+{
+	if (kind == PLAIN) {
+		lock_acquire(plain);
+	} else {
+		rwlock_read_acquire(rwlock);
+	}
+}
+
+static void
+read_unlock(void)
+{
+	if (kind == PLAIN) {
+		lock_release(plain);
+	} else {
+		rwlock_read_release(rwlock);
+	}
+}
+
+static void
+write_lock(void)
+{
+	if (kind == PLAIN) {
+		lock_acquire(plain);
+	} else {
+		rwlock_write_acquire(rwlock);
+	}
+}
+
+static void
+write_unlock(void)
+{
+	if (kind == PLAIN) {
+		lock_release(plain);
+	} else {
+		rwlock_write_release(rwlock);
+	}
+}
+
+static void
+contender_thread(void *arg)
+{
+	volatile unsigned long sum = 0;
+	int i;
+
+	for (i = 0; i < NOPS; i++) {
+		int slot = random() % TABLE_SIZE;
+
+		if (random() % 100 < read_percent) {
+			read_lock();
+			sum += table[slot];
+			thread_sleep_for(HOLD_USECS);
+			read_unlock();
+		} else {
+			write_lock();
+			table[slot]++;
+			thread_sleep_for(HOLD_USECS);
+			write_unlock();
+		}
+	}
+}
+
+static void
+bench_rwlock(enum kind k, const char *name)
+{
+	struct timespec start, end, diff;
+	Tid result[NCONTENDERS];
+	int i;
+
+	kind = k;
+	plain = lock_create();
+	rwlock = rwlock_create(k == PREFER_WRITERS);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < NCONTENDERS; i++) {
+		result[i] = thread_create(contender_thread, NULL);
+		assert(thread_ret_ok(result[i]));
+	}
+	for (i = 0; i < NCONTENDERS; i++) {
+		thread_wait(result[i], NULL);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	lock_destroy(plain);
+	rwlock_destroy(rwlock);
+	diff = timespec_sub(&end, &start);
+	unintr_printf("%-24s %10.0f ops/s\n", name,
+		      (double)NCONTENDERS * NOPS /
+		      (diff.tv_sec + (double)diff.tv_nsec / NSEC_PER_SEC));
+}
+
+int
+main(int argc, char **argv)
+{
+	if (argc > 1) {
+		read_percent = atoi(argv[1]);
+	}
+	assert(read_percent >= 0 && read_percent <= 100);
+	install_fatal_handlers((void *)main);
+	init_csc369_malloc(false);
+	thread_init();
+	register_interrupt_handler(false);
+
+	unintr_printf("%d%% reads, %d%% writes\n", read_percent,
+		      100 - read_percent);
+	bench_rwlock(PLAIN, "lock");
+	bench_rwlock(PREFER_READERS, "rwlock, prefer readers");
+	bench_rwlock(PREFER_WRITERS, "rwlock, prefer writers");
+	return 0;
+}
@@ -0,0 +1,157 @@
+#include <sys/wait.h>
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * bench_sched compares the scheduling policies on a mixed workload.
+ * NCPU CPU-bound threads busy wait for DURATION microseconds of wall clock
+ * time each and never give up the CPU. NINTERACTIVE interactive threads
+ * repeatedly do a short burst of work and then sleep for THINK usecs, as if
+ * waiting for input. The response time of an interactive thread is the time
+ * from the end of its sleep until it runs again. (Interactive threads that
+ * only yielded would starve the CPU-bound threads under priority
+ * scheduling, since they would always be ready.)
+ * Under stride scheduling the interactive threads get INTERACTIVE_TICKETS
+ * tickets, four times the default, and under priority scheduling they run
+ * at INTERACTIVE_PRIO, above the CPU-bound threads. The mean, 99th
+ * percentile and maximum response times are reported, as well as the time
+ * the process spent idle, blocked with no thread to run.
+ *
+ * Each policy is run in its own child process, since thread_init_sched can
+ * only be called once.
+ *
+ * Usage: bench_sched [policy]
+ *****************************************************************************/
+
+#define NCPU 4
+#define NINTERACTIVE 4
+#define DURATION 500000 /* usecs of work for each CPU-bound thread */
+#define BURST 20	/* usecs of work for each interactive burst */
+#define THINK 1000	/* usecs each interactive thread sleeps for */
+#define INTERACTIVE_TICKETS 400
+#define INTERACTIVE_PRIO (THREAD_PRIO_DEFAULT + 8)
+#define BUCKET_US 10	/* width of a response time histogram bucket */
+#define NBUCKETS 500000
+
+static int cpu_running;
+static long bursts;
+static double total_response_us;
+static double max_response_us;
+static unsigned int histogram[NBUCKETS];
+
+static double
+elapsed_us(const struct timespec *start, const struct timespec *end)
+{
+	struct timespec diff = timespec_sub(end, start);
+	return diff.tv_sec * 1e6 + diff.tv_nsec / 1e3;
+}
+
+static void
+cpu_thread(void *arg)
+{
+	spin(DURATION);
+	__sync_fetch_and_add(&cpu_running, -1);
+}
+
+static void
+interactive_thread(void *arg)
+{
+	struct timespec start, end;
+
+	while (__sync_fetch_and_add(&cpu_running, 0) > 0) {
+		spin(BURST);
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		thread_sleep_for(THINK);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		double us = elapsed_us(&start, &end) - THINK;
+		bool enabled = interrupts_off();
+		bursts++;
+		total_response_us += us;
+		if (us > max_response_us) max_response_us = us;
+		histogram[us / BUCKET_US < NBUCKETS ? (int)(us / BUCKET_US) : NBUCKETS - 1]++;
+		interrupts_set(enabled);
+	}
+}
+
+/* the upper end of the histogram bucket holding the 99th percentile */
+static double
+p99_us(void)
+{
+	long seen = 0;
+	int i;
+
+	for (i = 0; i < NBUCKETS - 1; i++) {
+		seen += histogram[i];
+		if (seen >= bursts * 99 / 100) {
+			break;
+		}
+	}
+	return (i + 1) * BUCKET_US;
+}
+
+static void
+bench_sched(const char *policy)
+{
+	struct timespec start, end;
+	int i, ret;
+
+	ret = thread_init_sched(policy);
+	assert(!ret);
+	register_interrupt_handler(false);
+
+	cpu_running = NCPU;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < NINTERACTIVE; i++) {
+		Tid tid = thread_create(interactive_thread, NULL);
+		assert(thread_ret_ok(tid));
+		if (strcmp(policy, "stride") == 0) {
+			thread_set_tickets(tid, INTERACTIVE_TICKETS);
+		}
+		if (strcmp(policy, "prio") == 0) {
+			thread_setprio(tid, INTERACTIVE_PRIO);
+		}
+	}
+	for (i = 0; i < NCPU; i++) {
+		Tid tid = thread_create(cpu_thread, NULL);
+		assert(thread_ret_ok(tid));
+	}
+	while (thread_yield(THREAD_ANY) != THREAD_NONE)
+		;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	unintr_printf("%-8s %8ld bursts, response mean %8.1f us, "
+		      "p99 %8.0f us, max %9.1f us, elapsed %6.0f ms, "
+		      "idle %4.0f ms\n",
+		      policy, bursts, total_response_us / (bursts ? bursts : 1),
+		      p99_us(), max_response_us,
+		      elapsed_us(&start, &end) / 1000,
+		      thread_idle_usecs() / 1000.0);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *policies[] = { "fifo", "rr", "mlfq", "stride", "prio" };
+	int i, status;
+
+	install_fatal_handlers((void *)main);
+	init_csc369_malloc(false);
+
+	if (argc > 1) {
+		bench_sched(argv[1]);
+		return 0;
+	}
+	for (i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+		fflush(stdout);
+		if (fork() == 0) {
+			bench_sched(policies[i]);
+			exit(0);
+		}
+		wait(&status);
+	}
+	return 0;
+}
@@ -0,0 +1,131 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+#include "slab.h"
+
+/******************************************************************************
+ * bench_slab measures the paths the object caches serve (see slab.h).
+ * 1. create/exit: the initial thread creates a thread that exits right
+ *    away, and yields to it, so its TCB is reaped and reused.
+ * 2. sleep/wakeup: a partner thread sleeps on a wait queue, and the initial
+ *    thread wakes it up and yields to it, taking and giving back a wait
+ *    node each time.
+ * The rate of each is reported, then the counters of every cache, and the
+ * number of mallocs the runs made, which the caches should keep at 0.
+ *****************************************************************************/
+
+#define NROUNDS 200000
+
+static struct wait_queue *queue;
+static volatile int stop;
+
+static void
+exit_thread(void *arg)
+{
+	thread_exit(0);
+}
+
+static void
+sleeper_thread(void *arg)
+{
+	bool enabled = interrupts_off();
+	while (!stop) {
+		thread_sleep(queue);
+	}
+	interrupts_set(enabled);
+}
+
+/* objects handed out by all of the caches */
+static long
+cache_allocs(void)
+{
+	static const char *names[] = { "thread", "wait_node", "wait_queue",
+				       "lock", "cv" };
+	struct slab_stats stats;
+	long n = 0;
+	unsigned i;
+
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		if (slab_get_stats(names[i], &stats) == 0) {
+			n += stats.allocs;
+		}
+	}
+	return n;
+}
+
+static void
+report(const char *what, struct timespec *start, struct timespec *end)
+{
+	struct timespec diff = timespec_sub(end, start);
+	double secs = diff.tv_sec + (double)diff.tv_nsec / NSEC_PER_SEC;
+
+	unintr_printf("%-14s %10.0f /sec %8.1f ns each\n", what,
+		      NROUNDS / secs, secs * NSEC_PER_SEC / NROUNDS);
+}
+
+static void
+bench_create_exit(void)
+{
+	struct timespec start, end;
+	Tid ret;
+	long i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < NROUNDS; i++) {
+		ret = thread_create(exit_thread, NULL);
+		assert(thread_ret_ok(ret));
+		thread_yield(ret);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	report("create/exit", &start, &end);
+}
+
+static void
+bench_sleep_wakeup(void)
+{
+	struct timespec start, end;
+	Tid sleeper;
+	long i;
+
+	queue = wait_queue_create();
+	stop = 0;
+	sleeper = thread_create(sleeper_thread, NULL);
+	assert(thread_ret_ok(sleeper));
+	thread_yield(sleeper);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < NROUNDS; i++) {
+		thread_wakeup(queue, 0);
+		thread_yield(sleeper);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	report("sleep/wakeup", &start, &end);
+
+	stop = 1;
+	thread_wakeup(queue, 0);
+	thread_wait(sleeper, NULL);
+	wait_queue_destroy(queue);
+}
+
+int
+main(int argc, char **argv)
+{
+	long mallocs, allocs;
+
+	install_fatal_handlers((void *)main);
+	init_csc369_malloc(false);
+	thread_init();
+
+	/* the objects handed out by the caches count as mallocs too */
+	mallocs = get_num_mallocs();
+	allocs = cache_allocs();
+	bench_create_exit();
+	bench_sleep_wakeup();
+	mallocs = get_num_mallocs() - mallocs - (cache_allocs() - allocs);
+	unintr_printf("\n");
+	slab_stats_dump();
+	unintr_printf("\nmallocs outside the caches: %ld\n", mallocs);
+	return 0;
+}
@@ -0,0 +1,96 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * bench_switch measures the cost of a voluntary context switch through the
+ * ready queue. For each thread count, the initial thread creates nthreads-1
+ * children and then every thread (including the initial one) calls
+ * thread_yield(THREAD_ANY) in a loop. The total number of switches divided
+ * by the elapsed wall clock time is reported as switches per second.
+ *
+ * Usage: bench_switch [preempt] [trace]
+ *   preempt - also enable timer interrupts while the benchmark runs.
+ *   trace   - record scheduler events (see thread_trace_start) meanwhile,
+ *             and save the last of them to bench_switch.trace.
+ *****************************************************************************/
+
+#define NSWITCHES 200000 /* total switches to perform for each run */
+
+static int nthreads_running;
+static long yields_per_thread;
+
+static void
+bench_switch_thread(void *arg)
+{
+	long i;
+
+	for (i = 0; i < yields_per_thread; i++) {
+		thread_yield(THREAD_ANY);
+	}
+	__sync_fetch_and_add(&nthreads_running, -1);
+}
+
+static void
+bench_switch(int nthreads)
+{
+	struct timespec start, end, diff;
+	long i;
+	double secs;
+
+	yields_per_thread = NSWITCHES / nthreads;
+	nthreads_running = nthreads - 1;
+	for (i = 0; i < nthreads - 1; i++) {
+		Tid ret = thread_create(bench_switch_thread, NULL);
+		assert(thread_ret_ok(ret));
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < yields_per_thread; i++) {
+		thread_yield(THREAD_ANY);
+	}
+	while (__sync_fetch_and_add(&nthreads_running, 0) > 0) {
+		thread_yield(THREAD_ANY);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	/* let the exited threads get cleaned up before the next run */
+	while (thread_yield(THREAD_ANY) != THREAD_NONE)
+		;
+
+	diff = timespec_sub(&end, &start);
+	secs = diff.tv_sec + (double)diff.tv_nsec / NSEC_PER_SEC;
+	unintr_printf("%5d threads: %10.0f switches/sec\n", nthreads,
+		      yields_per_thread * nthreads / secs);
+}
+
+int
+main(int argc, char **argv)
+{
+	bool tracing = false;
+	int i;
+
+	install_fatal_handlers((void *)main);
+	init_csc369_malloc(false);
+	thread_init();
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "preempt") == 0) {
+			register_interrupt_handler(false);
+		} else if (strcmp(argv[i], "trace") == 0) {
+			thread_trace_start();
+			tracing = true;
+		}
+	}
+
+	bench_switch(16);
+	bench_switch(128);
+	bench_switch(THREAD_MAX_THREADS);
+	if (tracing && thread_trace_save("bench_switch.trace") < 0) {
+		perror("bench_switch.trace");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,106 @@
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * bench_workers measures the speedup of CPU-bound threads from running them
+ * on several workers (thread_init_workers). NCOMPUTE threads each do the same
+ * fixed amount of computation, with preemption enabled, and the elapsed wall
+ * clock time is compared with the time taken by a single worker. Each worker
+ * count is run in its own child process, since the threads library can only
+ * be initialized once. The speedup cannot exceed the number of cores.
+ *
+ * Usage: bench_workers [max workers]
+ *****************************************************************************/
+
+#define NCOMPUTE 16
+#define WORK 20000000UL /* iterations per thread */
+
+static struct lock *done_lock;
+static struct cv *done_cv;
+static int ndone;
+
+static void
+compute_thread(void *arg)
+{
+	volatile unsigned long x = 1;
+	unsigned long i;
+
+	for (i = 0; i < WORK; i++) {
+		x = x * 6364136223846793005UL + 1442695040888963407UL;
+	}
+
+	lock_acquire(done_lock);
+	ndone++;
+	cv_signal(done_cv, done_lock);
+	lock_release(done_lock);
+}
+
+static double
+bench_workers(int nworkers)
+{
+	struct timespec start, end, diff;
+	int i, ret;
+
+	ret = thread_init_workers(nworkers);
+	assert(!ret);
+	register_interrupt_handler(false);
+	done_lock = lock_create();
+	done_cv = cv_create();
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < NCOMPUTE; i++) {
+		Tid tid = thread_create(compute_thread, NULL);
+		assert(thread_ret_ok(tid));
+	}
+	lock_acquire(done_lock);
+	while (ndone < NCOMPUTE) {
+		cv_wait(done_cv, done_lock);
+	}
+	lock_release(done_lock);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	diff = timespec_sub(&end, &start);
+	return diff.tv_sec + (double)diff.tv_nsec / NSEC_PER_SEC;
+}
+
+int
+main(int argc, char **argv)
+{
+	int max_workers = 8;
+	int nworkers, status;
+	double *secs;
+
+	if (argc > 1) {
+		max_workers = atoi(argv[1]);
+	}
+	assert(max_workers >= 1 && max_workers <= THREAD_MAX_WORKERS);
+	install_fatal_handlers((void *)main);
+
+	/* shared with the children, which report their time here */
+	secs = mmap(NULL, sizeof(double), PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	assert(secs != MAP_FAILED);
+
+	unintr_printf("%ld cores online\n", sysconf(_SC_NPROCESSORS_ONLN));
+	double base = 0;
+	for (nworkers = 1; nworkers <= max_workers; nworkers *= 2) {
+		fflush(stdout);
+		if (fork() == 0) {
+			init_csc369_malloc(false);
+			*secs = bench_workers(nworkers);
+			exit(0);
+		}
+		wait(&status);
+		if (nworkers == 1) {
+			base = *secs;
+		}
+		unintr_printf("%3d workers: %8.1f ms, speedup %5.2f\n",
+			      nworkers, *secs * 1000, base / *secs);
+	}
+	return 0;
+}
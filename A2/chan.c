@@ -0,0 +1,335 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "thread.h"
+#include "malloc369.h"
+#include "interrupt.h"
+
+/* Bounded channels. Elements are copied into a ring buffer of capacity
+ * elements, or straight from a sender to a receiver when one of them is
+ * already waiting: a receiver only waits while the ring is empty, and a
+ * sender only while it is full. A waiting thread is described by a
+ * chan_waiter on its own stack, and is parked on its done flag (see
+ * thread_park), so a channel needs no wait queue. A waiter that is killed
+ * is taken off its list by a cleanup handler (see thread_cleanup_push),
+ * before its stack goes away. The state is only looked at with interrupts
+ * off, as in sync.c. */
+
+struct chan_waiter {
+	struct chan_waiter* next;
+	struct chan_waiter** list;	// the senders or receivers it is on
+	Tid tid;
+	char* buf;	// where the waiter's elements are taken from or put
+	int want;	// elements it wants to send or receive
+	int count;	// elements sent or received for it so far
+	int done;	// set, and unparked, once it may return
+};
+
+struct chan {
+	size_t elem_size;
+	unsigned int capacity;
+	char* ring;
+	unsigned int head;	// index of the oldest element in ring
+	unsigned int count;	// elements in ring
+	bool closed;
+	struct chan_waiter* senders;
+	struct chan_waiter* receivers;
+};
+
+struct chan *
+chan_create(unsigned int capacity, size_t elem_size)
+{
+	bool enabled = interrupts_off();
+	struct chan *chan;
+
+	assert(elem_size > 0);
+	chan = malloc369(sizeof(struct chan));
+	assert(chan);
+
+	chan->elem_size = elem_size;
+	chan->capacity = capacity;
+	chan->ring = capacity > 0 ? malloc369(capacity * elem_size) : NULL;
+	chan->head = 0;
+	chan->count = 0;
+	chan->closed = false;
+	chan->senders = NULL;
+	chan->receivers = NULL;
+
+	interrupts_set(enabled);
+	return chan;
+}
+
+void
+chan_destroy(struct chan *chan)
+{
+	bool enabled = interrupts_off();
+
+	assert(chan != NULL);
+	assert(chan->senders == NULL && chan->receivers == NULL);
+	if (chan->ring != NULL) free369(chan->ring);
+	free369(chan);
+
+	interrupts_set(enabled);
+}
+
+/* copy n elements from src to the tail of the ring, which has room. */
+static void
+ring_put(struct chan* chan, const char* src, unsigned int n)
+{
+	size_t size = chan->elem_size;
+	unsigned int tail = (chan->head + chan->count) % chan->capacity;
+	unsigned int first = n < chan->capacity - tail ? n : chan->capacity - tail;
+
+	memcpy(chan->ring + tail * size, src, first * size);
+	memcpy(chan->ring, src + first * size, (n - first) * size);
+	chan->count += n;
+}
+
+/* copy n elements from the head of the ring to dst. */
+static void
+ring_get(struct chan* chan, char* dst, unsigned int n)
+{
+	size_t size = chan->elem_size;
+	unsigned int first = n < chan->capacity - chan->head ? n : chan->capacity - chan->head;
+
+	memcpy(dst, chan->ring + chan->head * size, first * size);
+	memcpy(dst + first * size, chan->ring, (n - first) * size);
+	chan->head = (chan->head + n) % chan->capacity;
+	chan->count -= n;
+}
+
+static int
+min(int a, int b)
+{
+	return a < b ? a : b;
+}
+
+/* take the first waiter off list, and let it return. */
+static Tid
+finish_waiter(struct chan_waiter** list)
+{
+	struct chan_waiter* w = *list;
+	*list = w->next;
+	w->done = 1;
+	thread_unpark(&w->done, 1);
+	return w->tid;
+}
+
+/* take w off its list, if it is still on it. */
+static void
+unlink_waiter(struct chan_waiter* w)
+{
+	struct chan_waiter** link = w->list;
+	while (*link != NULL && *link != w) link = &(*link)->next;
+	if (*link == w) *link = w->next;
+}
+
+/* cleanup handler of wait_on, for a waiter that is killed. */
+static void
+waiter_killed(void* arg)
+{
+	unlink_waiter(arg);
+}
+
+/* park the caller as waiter w on list until it is done. returns false if
+ * no other thread could ever finish it, in which case it is taken off. */
+static bool
+wait_on(struct chan_waiter** list, struct chan_waiter* w)
+{
+	struct thread_cleanup cleanup;
+	bool ok = true;
+
+	w->next = NULL;
+	w->list = list;
+	w->tid = thread_id();
+	w->count = 0;
+	w->done = 0;
+	while (*list != NULL) list = &(*list)->next;
+	*list = w;
+
+	thread_cleanup_push(&cleanup, waiter_killed, w);
+	// thread_yield(tid) can run a parked thread before it is done.
+	while (!w->done)
+	{
+		if (thread_park(&w->done, 0) == THREAD_NONE)
+		{
+			unlink_waiter(w);
+			ok = false;
+			break;
+		}
+	}
+	thread_cleanup_pop(&cleanup);
+	return ok;
+}
+
+/* send up to n elements from buf, sleeping while the channel is full if
+ * block is set. returns the number sent. */
+static int
+chan_send_common(struct chan* chan, const void* buf, int n, bool block)
+{
+	bool enabled = interrupts_off();
+	assert(chan != NULL);
+	const char* src = buf;
+	size_t size = chan->elem_size;
+	Tid woken = THREAD_NONE;
+	int sent = 0;
+
+	while (sent < n && !chan->closed)
+	{
+		// receivers only wait while the ring is empty, so they are
+		// handed elements directly, ahead of the ring.
+		if (chan->receivers != NULL)
+		{
+			struct chan_waiter* w = chan->receivers;
+			int k = min(n - sent, w->want);
+			memcpy(w->buf, src + sent * size, k * size);
+			w->count = k;
+			sent += k;
+			Tid tid = finish_waiter(&chan->receivers);
+			if (woken == THREAD_NONE) woken = tid;
+			continue;
+		}
+		int k = min(n - sent, chan->capacity - chan->count);
+		if (k > 0)
+		{
+			ring_put(chan, src + sent * size, k);
+			sent += k;
+			continue;
+		}
+		if (!block) break;
+
+		struct chan_waiter w;
+		w.buf = (char*) src + sent * size;
+		w.want = n - sent;
+		bool ok = wait_on(&chan->senders, &w);
+		sent += w.count;
+		if (!ok) break;
+	}
+	// on an unbuffered channel, the next send would wait for the receiver
+	// anyway, so the receiver that was handed elements runs at once. on a
+	// buffered one, the sender keeps filling the ring, so that switches
+	// are paid for by many elements rather than one.
+	if (woken != THREAD_NONE && chan->capacity == 0) thread_yield(woken);
+
+	interrupts_set(enabled);
+	return sent;
+}
+
+/* receive up to n elements into buf. once at least one has been received,
+ * it returns rather than sleep. returns the number received. */
+static int
+chan_recv_common(struct chan* chan, void* buf, int n, bool block)
+{
+	bool enabled = interrupts_off();
+	assert(chan != NULL);
+	char* dst = buf;
+	size_t size = chan->elem_size;
+	int got = 0;
+
+	while (got < n)
+	{
+		int k = min(n - got, chan->count);
+		if (k > 0)
+		{
+			ring_get(chan, dst + got * size, k);
+			got += k;
+		}
+		// senders only wait while the ring is full. with the ring
+		// drained, they are taken from directly; otherwise their
+		// elements go to the back of the ring, behind those already
+		// in it.
+		while (chan->senders != NULL && (got < n || chan->count < chan->capacity))
+		{
+			struct chan_waiter* w = chan->senders;
+			char* from = w->buf + w->count * size;
+			if (chan->count == 0 && got < n)
+			{
+				k = min(n - got, w->want - w->count);
+				memcpy(dst + got * size, from, k * size);
+				got += k;
+			}
+			else
+			{
+				k = min(w->want - w->count, chan->capacity - chan->count);
+				ring_put(chan, from, k);
+			}
+			w->count += k;
+			if (w->count == w->want) finish_waiter(&chan->senders);
+		}
+		if (got > 0 || !block || chan->closed) break;
+
+		struct chan_waiter w;
+		w.buf = dst;
+		w.want = n;
+		bool ok = wait_on(&chan->receivers, &w);
+		got = w.count;
+		if (!ok) break;
+	}
+
+	interrupts_set(enabled);
+	return got;
+}
+
+int
+chan_send(struct chan *chan, const void *elem)
+{
+	return chan_send_common(chan, elem, 1, true) == 1 ? 0 : THREAD_INVALID;
+}
+
+int
+chan_try_send(struct chan *chan, const void *elem)
+{
+	bool enabled = interrupts_off();
+	int ret = THREAD_INVALID;
+	if (!chan->closed)
+	{
+		ret = chan_send_common(chan, elem, 1, false) == 1 ? 0 : THREAD_NONE;
+	}
+	interrupts_set(enabled);
+	return ret;
+}
+
+int
+chan_send_n(struct chan *chan, const void *elems, int n)
+{
+	if (n < 0) return THREAD_INVALID;
+	return chan_send_common(chan, elems, n, true);
+}
+
+int
+chan_recv(struct chan *chan, void *elem)
+{
+	return chan_recv_common(chan, elem, 1, true) == 1 ? 0 : THREAD_INVALID;
+}
+
+int
+chan_try_recv(struct chan *chan, void *elem)
+{
+	bool enabled = interrupts_off();
+	int ret = chan_recv_common(chan, elem, 1, false) == 1 ? 0 : THREAD_NONE;
+	if (ret == THREAD_NONE && chan->closed) ret = THREAD_INVALID;
+	interrupts_set(enabled);
+	return ret;
+}
+
+int
+chan_recv_n(struct chan *chan, void *elems, int n)
+{
+	if (n < 0) return THREAD_INVALID;
+	return chan_recv_common(chan, elems, n, true);
+}
+
+void
+chan_close(struct chan *chan)
+{
+	bool enabled = interrupts_off();
+	assert(chan != NULL);
+
+	chan->closed = true;
+	// senders keep what they sent so far, and receivers are empty handed,
+	// or they would not be waiting.
+	while (chan->senders != NULL) finish_waiter(&chan->senders);
+	while (chan->receivers != NULL) finish_waiter(&chan->receivers);
+
+	interrupts_set(enabled);
+}
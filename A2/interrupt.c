@@ -1,29 +1,77 @@
 #include <assert.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <ucontext.h>
 #include <stdarg.h>
 #include <string.h>
+#include <sched.h>
+#include <pthread.h>
 #include "common.h"
 #include "interrupt.h"
+#include "thread.h"
+#include "trace.h"
 
 /* This is the function that will handle timer signals (i.e., the interrupt
  * handler). See 'man sigaction' for an explanation of the arguments.
  */
 static void interrupt_handler(int sig, siginfo_t * sip, void *contextVP);
 
-/* This function sets up a timer to deliver a signal to the process. 
- * These timer signals are the interrupts for the user-level threads.
+/* This function creates the timer of worker id, which delivers its signal
+ * to the calling kernel thread only. These timer signals are the interrupts
+ * for the user-level threads.
  */
-static void set_interrupt();
+static void create_timer(int id);
+
+/* This function starts the timer of worker id, so that it fires every
+ * quantum microseconds, or stops it if the worker's ticks are stopped.
+ */
+static void set_interrupt(int id);
+
+/* This function gives a child process, after fork, timers of its own (see
+ * create_timer).
+ */
+static void timers_atfork_child(void);
 
 /* This function initializes signal set pointed to by setp so that only the 
  * signal used for the timer is included in the set.
  */
 static void set_signal(sigset_t * setp);
+static void tick(void);
 
 static bool loud = false; /* print info from interrupt handler? */ 
 
+/* In soft mode (the default), disabling interrupts only sets soft_disabled
+ * instead of blocking SIG_TYPE with sigprocmask. An interrupt that arrives
+ * while the flag is set is recorded in preempt_pending, and the yield it
+ * would have caused runs when interrupts are enabled again. */
+static bool soft = true;
+static __thread volatile sig_atomic_t soft_disabled = 0;
+static __thread volatile sig_atomic_t preempt_pending = 0;
+
+/* With more than one worker (see thread_init_workers), each worker is a
+ * kernel thread with its own flag and its own timer, whose signal is only
+ * delivered to that worker. Disabling interrupts also takes sched_lock, so
+ * only one worker at a time is inside the threads library. The lock stays
+ * held across a context switch and is released by the thread switched to,
+ * so a thread's registers are saved before another worker can resume it.
+ */
+static bool multi = false;
+static volatile int sched_lock = 0;
+static timer_t timers[THREAD_MAX_WORKERS];
+static int nr_timers = 0;
+static __thread int my_timer = -1;
+
+/* The timers are periodic, with a period of quantum microseconds, so the
+ * handler does not re-arm them. The timer of a worker is stopped while
+ * tick_stopped is set, i.e. while there is nothing for it to preempt to
+ * (see thread_tick). */
+static long quantum = SIG_INTERVAL;
+static bool tick_stopped[THREAD_MAX_WORKERS];
+static unsigned long nr_ticks = 0;
+
+static bool handler_registered = false;
+
 /* Test programs will call this function after initializing the threads package.
  * Many of the calls won't make sense at first -- study the man pages! 
  */
@@ -32,10 +80,9 @@ register_interrupt_handler(bool verbose)
 {
 	struct sigaction action;
 	int error;
-	static bool init = false;
 
-	assert(!init);	/* should only register once */
-	init = true;
+	assert(!handler_registered);	/* should only register once */
+	handler_registered = true;
 	loud = verbose;
 	action.sa_handler = NULL;
 	action.sa_sigaction = interrupt_handler; 
@@ -58,14 +105,121 @@ register_interrupt_handler(bool verbose)
 	/* Use sa_sigaction field as handler instead of sa_handler field. */
 	action.sa_flags = SA_SIGINFO;
 
+	/* In soft mode, soft_disabled keeps the handler from recursing, so
+	 * SIG_TYPE is not blocked while it runs. It must not be: the handler
+	 * switches to other threads, and they should still be preempted 
+	 * before the interrupted thread gets to return from the handler.
+	 */
+	if (soft) {
+		action.sa_flags |= SA_NODEFER;
+	}
+
 	/* Install the signal handler. */
 	if (sigaction(SIG_TYPE, &action, NULL)) {
 		perror("Setting up signal handler");
 		assert(0);
 	}
 
-	/* Initialize the timer. */
-	set_interrupt();
+	/* Start the timer, or the timer of every worker. */
+	if (!multi) {
+		create_timer(0);
+		my_timer = 0;
+		nr_timers = 1;
+	}
+	for (int i = 0; i < nr_timers; i++) {
+		set_interrupt(i);
+	}
+}
+
+/* Sets up the calling kernel thread as worker id: gives it a timer that
+ * interrupts only this thread, and makes disabling interrupts take the
+ * scheduler lock. Called by thread_init_workers for every worker, starting
+ * with worker 0, before any other thread is created.
+ */
+void
+interrupts_init_worker(int id)
+{
+	assert(soft);
+	assert(id >= 0 && id < THREAD_MAX_WORKERS);
+	create_timer(id);
+	my_timer = id;
+	multi = true;
+	__atomic_fetch_add(&nr_timers, 1, __ATOMIC_SEQ_CST);
+	if (handler_registered) {
+		set_interrupt(id);
+	}
+}
+
+/* Sets the time between timer interrupts, in microseconds. The default is
+ * SIG_INTERVAL. May be called at any time.
+ */
+void
+interrupts_set_quantum(long usecs)
+{
+	bool enabled;
+
+	assert(usecs > 0);
+	enabled = interrupts_off();
+	quantum = usecs;
+	if (handler_registered) {
+		for (int i = 0; i < nr_timers; i++) {
+			set_interrupt(i);
+		}
+	}
+	interrupts_set(enabled);
+}
+
+/* Returns the time between timer interrupts, in microseconds. */
+long
+interrupts_get_quantum(void)
+{
+	return quantum;
+}
+
+/* Stops (stop is true) or restarts the timer interrupts of the calling
+ * worker. Called with interrupts disabled, by the threads library, which
+ * stops the ticks while there is no other thread to run and restarts them
+ * as soon as a thread becomes runnable.
+ */
+void
+interrupts_stop_ticks(bool stop)
+{
+	if (!handler_registered || my_timer < 0 || tick_stopped[my_timer] == stop) {
+		return;
+	}
+	tick_stopped[my_timer] = stop;
+	set_interrupt(my_timer);
+}
+
+/* Returns the number of times the timers have fired so far, including
+ * expirations that the kernel merged into a single signal. */
+unsigned long
+interrupts_ticks(void)
+{
+	return __atomic_load_n(&nr_ticks, __ATOMIC_RELAXED);
+}
+
+static void
+sched_lock_acquire(void)
+{
+	int spins = 0;
+
+	while (__atomic_exchange_n(&sched_lock, 1, __ATOMIC_ACQUIRE)) {
+		while (__atomic_load_n(&sched_lock, __ATOMIC_RELAXED)) {
+			/* the holder may have been descheduled by the kernel */
+			if (++spins < 100) {
+				__builtin_ia32_pause();
+			} else {
+				sched_yield();
+			}
+		}
+	}
+}
+
+static void
+sched_lock_release(void)
+{
+	__atomic_store_n(&sched_lock, 0, __ATOMIC_RELEASE);
 }
 
 /* Enables interrupts. */
@@ -82,6 +236,18 @@ interrupts_off()
 	return interrupts_set(false);
 }
 
+/* Selects whether interrupts are disabled by blocking SIG_TYPE with
+ * sigprocmask (true) or with the soft flag (false, the default). Must be
+ * called before register_interrupt_handler, with interrupts enabled.
+ */
+void
+interrupts_use_sigprocmask(bool enable)
+{
+	assert(!handler_registered);
+	assert(interrupts_enabled());
+	soft = !enable;
+}
+
 /* Enables or disables interrupts, and returns whether interrupts were enabled
  * or not previously. 
  */
@@ -91,6 +257,36 @@ interrupts_set(bool enable)
 	int ret;
 	sigset_t mask, omask;
 
+	if (soft) {
+		bool was_enabled = !soft_disabled;
+		/* keep the compiler from moving accesses out of the critical
+		 * section; only this thread's signal handler can race with us.
+		 * The flag is set before taking the scheduler lock and cleared
+		 * after dropping it, so the handler never waits for a lock its
+		 * own worker holds. */
+		__atomic_signal_fence(__ATOMIC_SEQ_CST);
+		if (!enable && was_enabled) {
+			soft_disabled = 1;
+			__atomic_signal_fence(__ATOMIC_SEQ_CST);
+			if (multi) {
+				sched_lock_acquire();
+			}
+		} else if (enable && !was_enabled) {
+			if (multi) {
+				sched_lock_release();
+			}
+			__atomic_signal_fence(__ATOMIC_SEQ_CST);
+			soft_disabled = 0;
+		}
+		__atomic_signal_fence(__ATOMIC_SEQ_CST);
+		/* run the preemption that was held off while disabled */
+		if (enable && preempt_pending) {
+			preempt_pending = 0;
+			tick();
+		}
+		return was_enabled;
+	}
+
 	set_signal(&mask);
 	
 	if (enable) {
@@ -110,6 +306,9 @@ interrupts_enabled()
 	sigset_t mask;
 	int ret;
 
+	if (soft) {
+		return !soft_disabled;
+	}
 	ret = sigprocmask(0, NULL, &mask);
 	assert(!ret);
 	return (sigismember(&mask, SIG_TYPE) ? false : true);
@@ -174,6 +373,25 @@ interrupt_handler(int sig, siginfo_t * sip, void *contextVP)
 {
 	ucontext_t *context = (ucontext_t *) contextVP;
 
+	/* expirations of a periodic timer that come while its signal is
+	 * still pending are merged into that signal, and only counted in
+	 * si_overrun */
+	__atomic_add_fetch(&nr_ticks, 1 + (sip->si_code == SI_TIMER ?
+					   sip->si_overrun : 0),
+			   __ATOMIC_RELAXED);
+	trace(TRACE_TICK, thread_id(), soft && soft_disabled);
+	if (soft) {
+		/* Defer the yield if the thread was interrupted with
+		 * interrupts disabled. */
+		if (soft_disabled) {
+			preempt_pending = 1;
+			return;
+		}
+		/* Otherwise disable them, as the kernel does with the mask
+		 * in the sigprocmask mode. */
+		interrupts_off();
+	}
+
 	/* Check that SIG_TYPE is blocked on entry. 
 	 * This signal should be blocked because of the default signal 
 	 * handling behavior. */
@@ -205,16 +423,44 @@ interrupt_handler(int sig, siginfo_t * sip, void *contextVP)
 		write(0, msgbuf, strlen(msgbuf));
 	}
 
-	/* Re-arm the timer to deliver the next interrupt */
-	set_interrupt();
-	
-	/* Implement preemptive threading by calling thread_yield. */
-	thread_yield(THREAD_ANY);
+	/* Implement preemptive threading by calling thread_yield. The
+	 * scheduling policy decides whether the running thread is preempted. */
+	tick();
+
+	/* Returning from the handler restores the signal mask in the
+	 * sigprocmask mode. Do the same for the soft flag. */
+	if (soft) {
+		interrupts_on();
+	}
+}
+
+/* errno belongs to the kernel thread, so it is shared by all the threads
+ * that run on a worker. Kept out of line, like this_worker in thread.c, so
+ * that the thread-local address is looked up again after a switch. */
+static __attribute__((noinline)) void
+set_errno(int err)
+{
+	__asm__ volatile("");
+	errno = err;
+}
+
+/* Run thread_tick for an interrupt. The interrupted thread may have just
+ * had a system call fail, and not looked at errno yet, while the tick, or
+ * the threads it switches to, make system calls of their own. So errno is
+ * kept here, on the interrupted thread's stack, until it resumes. */
+static void
+tick(void)
+{
+	int err = errno;
+
+	thread_tick();
+	set_errno(err);
 }
 
 /*
- * Use the setitimer() system call to set an alarm in the future. At that time,
- * this process will receive a SIGALRM signal.
+ * Use timer_create() to make a timer that sends SIG_TYPE to the calling
+ * kernel thread, rather than to the whole process, so that each worker gets
+ * its own interrupts.
  *
  * In interrupt.h, we #define SIG_TYPE to the signal generated by the timer. 
  * Different timers may generate different signals, so using SIG_TYPE lets us
@@ -222,20 +468,68 @@ interrupt_handler(int sig, siginfo_t * sip, void *contextVP)
  * that deals with the signal delivered for timer interrupts. 
  */
 static void
-set_interrupt()
+create_timer(int id)
 {
+	static bool atfork_registered = false;
+	struct sigevent sev;
 	int ret;
-	struct itimerval val;
 
-	/* QUESTION: Will the timer automatically fire every SIG_INTERVAL
-	 * microseconds or not? (HINT: Read the man page for setitimer.)
-	 */
-	val.it_interval.tv_sec = 0;
-	val.it_interval.tv_usec = 0;
+	if (!atfork_registered) {
+		atfork_registered = true;
+		ret = pthread_atfork(NULL, NULL, timers_atfork_child);
+		assert(!ret);
+	}
+	memset(&sev, 0, sizeof(sev));
+	sev.sigev_notify = SIGEV_THREAD_ID;
+	sev.sigev_signo = SIG_TYPE;
+	sev._sigev_un._tid = gettid();
+	ret = timer_create(CLOCK_MONOTONIC, &sev, &timers[id]);
+	assert(!ret);
+}
 
-	val.it_value.tv_sec = 0;
-	val.it_value.tv_usec = SIG_INTERVAL;
+/*
+ * Unlike a one-shot setitimer(), which must be set again after every
+ * interrupt, the it_interval of the timer makes it fire every quantum
+ * microseconds until it is stopped, which costs a system call only when the
+ * quantum changes or the ticks are stopped or restarted.
+ */
+static void
+set_interrupt(int id)
+{
+	int ret;
+	struct itimerspec val;
+
+	val.it_interval.tv_sec = quantum / USEC_PER_SEC;
+	val.it_interval.tv_nsec = (quantum % USEC_PER_SEC) * 1000;
+	val.it_value = val.it_interval;
+	if (tick_stopped[id]) {
+		/* a zero it_value disarms the timer */
+		val.it_value.tv_sec = 0;
+		val.it_value.tv_nsec = 0;
+	}
 
-	ret = setitimer(ITIMER_REAL, &val, NULL);
+	ret = timer_settime(timers[id], 0, &val, NULL);
 	assert(!ret);
 }
+
+/*
+ * Timers made by timer_create() are not inherited across fork(), so the
+ * child's timer IDs refer to nothing, and the first timer_settime() on one
+ * of them would fail. The child only has the kernel thread that called
+ * fork(), so every timer is made again for that thread. Only the caller's
+ * own timer is started, if its ticks were running: the other workers are
+ * gone, and have nothing to preempt.
+ */
+static void
+timers_atfork_child(void)
+{
+	for (int i = 0; i < nr_timers; i++) {
+		create_timer(i);
+		if (i != my_timer) {
+			tick_stopped[i] = true;
+		}
+		if (handler_registered) {
+			set_interrupt(i);
+		}
+	}
+}
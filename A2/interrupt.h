@@ -7,10 +7,16 @@
 
 /* we will use this signal type for delivering "interrupts". */
 #define SIG_TYPE SIGALRM
-/* the interrupt will be delivered every 200 usec */
+/* by default, the interrupt will be delivered every 200 usec */
 #define SIG_INTERVAL 200
 
 void register_interrupt_handler(bool verbose);
+void interrupts_use_sigprocmask(bool enable);
+void interrupts_init_worker(int id);
+void interrupts_set_quantum(long usecs);
+long interrupts_get_quantum(void);
+void interrupts_stop_ticks(bool stop);
+unsigned long interrupts_ticks(void);
 bool interrupts_on(void);
 bool interrupts_off(void);
 bool interrupts_set(bool enable);
@@ -0,0 +1,287 @@
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include "thread.h"
+#include "interrupt.h"
+#include "malloc369.h"
+#include "khash.h"
+#include "io.h"
+
+#define MAX_EVENTS 64
+
+/* the state of an fd used by the threads. a thread that waits for the fd
+ * to become readable (writable) parks on rd_seq (wr_seq), and io_poll bumps
+ * it on every event, so an event that comes between the failed call and the
+ * park is not missed. the fds are added to the epoll set edge triggered, so
+ * once, when first used. */
+struct io_fd {
+	int rd_seq;
+	int wr_seq;
+};
+
+KHASH_MAP_INIT_INT(iofds, struct io_fd *)
+static khash_t(iofds) *iofds = NULL;
+static int epfd = -1;
+/* an eventfd in the epoll set, written to by io_interrupt */
+static int wake_fd = -1;
+static int nr_waiting = 0;
+static bool polling = false;
+
+/* return the state of fd, setting it up on first use, or NULL if the fd
+ * cannot be used with epoll (e.g. a regular file) */
+static struct io_fd *
+io_fd_lookup(int fd)
+{
+	struct epoll_event ev;
+	struct io_fd *io;
+	khiter_t k;
+	int ret, flags;
+
+	if (epfd < 0) {
+		iofds = kh_init(iofds);
+		epfd = epoll_create1(EPOLL_CLOEXEC);
+		wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		assert(epfd >= 0 && wake_fd >= 0);
+		ev.events = EPOLLIN;
+		ev.data.fd = wake_fd;
+		ret = epoll_ctl(epfd, EPOLL_CTL_ADD, wake_fd, &ev);
+		assert(!ret);
+	}
+	k = kh_get(iofds, iofds, fd);
+	if (k != kh_end(iofds)) {
+		return kh_value(iofds, k);
+	}
+
+	ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	ev.data.fd = fd;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		return NULL;
+	}
+	flags = fcntl(fd, F_GETFL);
+	fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+	io = malloc369(sizeof(struct io_fd));
+	io->rd_seq = 0;
+	io->wr_seq = 0;
+	k = kh_put(iofds, iofds, fd, &ret);
+	assert(ret > 0);
+	kh_value(iofds, k) = io;
+	return io;
+}
+
+static struct io_fd *
+io_fd_get(int fd)
+{
+	bool enabled = interrupts_off();
+	struct io_fd *io = io_fd_lookup(fd);
+	interrupts_set(enabled);
+	return io;
+}
+
+bool
+io_pending(void)
+{
+	return nr_waiting > 0;
+}
+
+bool
+io_polling(void)
+{
+	return polling;
+}
+
+void
+io_interrupt(void)
+{
+	uint64_t one = 1;
+	ssize_t ret = write(wake_fd, &one, sizeof(one));
+	(void)ret;
+}
+
+void
+io_poll(struct timespec *timeout)
+{
+	struct epoll_event events[MAX_EVENTS];
+	bool block = timeout == NULL || timeout->tv_sec > 0 ||
+		timeout->tv_nsec > 0;
+	int n, i;
+
+	if (epfd < 0) {
+		return;
+	}
+	if (block) {
+		assert(!polling);
+		polling = true;
+		interrupts_on();
+	}
+	n = epoll_pwait2(epfd, events, MAX_EVENTS, timeout, NULL);
+	if (block) {
+		interrupts_off();
+		polling = false;
+	}
+
+	for (i = 0; i < n; i++) {
+		int fd = events[i].data.fd;
+		uint32_t e = events[i].events;
+		khiter_t k;
+
+		if (fd == wake_fd) {
+			uint64_t count;
+			ssize_t ret = read(wake_fd, &count, sizeof(count));
+			(void)ret;
+			continue;
+		}
+		k = kh_get(iofds, iofds, fd);
+		if (k == kh_end(iofds)) {
+			continue;
+		}
+		struct io_fd *io = kh_value(iofds, k);
+		if (e & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+			io->rd_seq++;
+			thread_unpark(&io->rd_seq, INT_MAX);
+		}
+		if (e & (EPOLLOUT | EPOLLHUP | EPOLLERR)) {
+			io->wr_seq++;
+			thread_unpark(&io->wr_seq, INT_MAX);
+		}
+	}
+}
+
+/* cleanup handler of io_wait, for a waiter that is killed */
+static void
+io_wait_killed(void *arg)
+{
+	nr_waiting--;
+}
+
+/* park the caller until the read (write) sequence number of io moves on
+ * from old, i.e. until the fd may have become readable (writable). */
+static void
+io_wait(struct io_fd *io, bool write, int old)
+{
+	struct thread_cleanup cleanup;
+	bool enabled = interrupts_off();
+
+	/* a thread killed while it waits never returns here */
+	nr_waiting++;
+	thread_cleanup_push(&cleanup, io_wait_killed, NULL);
+	thread_park(write ? &io->wr_seq : &io->rd_seq, old);
+	thread_cleanup_pop(&cleanup);
+	nr_waiting--;
+	interrupts_set(enabled);
+}
+
+/* after a call on the fd of io returned ret, park the caller if the call
+ * would have blocked, with io_wait. returns whether to make the call
+ * again. */
+static bool
+io_retry(struct io_fd *io, bool write, int old, ssize_t ret)
+{
+	if (ret >= 0 || io == NULL || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+		return false;
+	}
+	io_wait(io, write, old);
+	return true;
+}
+
+/* the sequence number to wait on if a call on the fd of io would block */
+static int
+io_seq(struct io_fd *io, bool write)
+{
+	if (io == NULL) {
+		return 0;
+	}
+	return __atomic_load_n(write ? &io->wr_seq : &io->rd_seq,
+			       __ATOMIC_SEQ_CST);
+}
+
+ssize_t
+thread_read(int fd, void *buf, size_t count)
+{
+	struct io_fd *io = io_fd_get(fd);
+	ssize_t ret;
+	int seq;
+
+	do {
+		seq = io_seq(io, false);
+		ret = read(fd, buf, count);
+	} while (io_retry(io, false, seq, ret));
+	return ret;
+}
+
+ssize_t
+thread_write(int fd, const void *buf, size_t count)
+{
+	struct io_fd *io = io_fd_get(fd);
+	ssize_t ret;
+	int seq;
+
+	do {
+		seq = io_seq(io, true);
+		ret = write(fd, buf, count);
+	} while (io_retry(io, true, seq, ret));
+	return ret;
+}
+
+int
+thread_accept(int fd, struct sockaddr *addr, socklen_t *addrlen)
+{
+	struct io_fd *io = io_fd_get(fd);
+	int ret;
+	int seq;
+
+	do {
+		seq = io_seq(io, false);
+		ret = accept4(fd, addr, addrlen, SOCK_CLOEXEC);
+	} while (io_retry(io, false, seq, ret));
+	return ret;
+}
+
+int
+thread_connect(int fd, const struct sockaddr *addr, socklen_t addrlen)
+{
+	struct io_fd *io = io_fd_get(fd);
+	int ret, seq;
+
+	ret = connect(fd, addr, addrlen);
+	if (ret == 0 || io == NULL || errno != EINPROGRESS) {
+		return ret;
+	}
+	/* the connection is made in the background, and the fd becomes
+	 * writable once it is done, one way or the other. connect is then
+	 * called again to find out how: it fails with EALREADY while the
+	 * connection is still being made, and with the error that ended it
+	 * otherwise. SO_ERROR would also report soft errors, such as a
+	 * dropped SYN that the kernel is still retrying. */
+	for (;;) {
+		seq = io_seq(io, true);
+		ret = connect(fd, addr, addrlen);
+		if (ret == 0 || errno == EISCONN) {
+			return 0;
+		}
+		if (errno != EALREADY && errno != EINPROGRESS) {
+			return -1;
+		}
+		io_wait(io, true, seq);
+	}
+}
+
+int
+thread_close(int fd)
+{
+	bool enabled = interrupts_off();
+	khiter_t k;
+
+	if (iofds != NULL && (k = kh_get(iofds, iofds, fd)) != kh_end(iofds)) {
+		epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+		free369(kh_value(iofds, k));
+		kh_del(iofds, iofds, k);
+	}
+	interrupts_set(enabled);
+	return close(fd);
+}
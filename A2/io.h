@@ -0,0 +1,32 @@
+#ifndef _IO_H_
+#define _IO_H_
+
+#include <stdbool.h>
+#include <time.h>
+
+/* The threads library's side of thread_read, thread_write, thread_accept
+ * and thread_connect (see thread.h). The fds that threads use are put in
+ * non-blocking mode and added to an epoll set. A thread whose call would
+ * block parks until the fd is ready, and the threads library polls the
+ * epoll set for it: without blocking on each timer tick, and blocking when
+ * a worker has nothing else to run.
+ *
+ * Like the timer wheel, this is only used with interrupts disabled.
+ */
+
+/* Whether a thread is parked waiting for an fd. */
+bool io_pending(void);
+
+/* Wake the threads whose fds are ready. If timeout is not zero, wait until
+ * an fd is ready, io_interrupt is called, or timeout (if not NULL) runs
+ * out; interrupts are enabled meanwhile. Only one worker at a time may wait
+ * (see io_polling). */
+void io_poll(struct timespec *timeout);
+
+/* Whether a worker is waiting in io_poll. */
+bool io_polling(void);
+
+/* Make the worker waiting in io_poll return. */
+void io_interrupt(void);
+
+#endif /* _IO_H_ */
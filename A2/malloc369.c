@@ -1,10 +1,33 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
 #include <assert.h>
 #include "khash.h"
 #include "interrupt.h"
 
+/* Two ways of tracking allocations, chosen at compile time.
+ *
+ * By default, every allocation is recorded in malloc_map, and freed ones
+ * stay there marked FREED, so that freeing a pointer malloc369 did not
+ * return, or freeing one twice, is always caught. The map grows with every
+ * allocation ever made, which long runs notice.
+ *
+ * With MALLOC369_FAST, each allocation is prefixed by a header holding its
+ * size, so the counters stay exact without looking anything up. Only one in
+ * MALLOC369_SAMPLE allocations (none if 0) is recorded in malloc_map, and it
+ * is removed again when freed, so the map only holds the live sample. A bad
+ * or double free is caught by the header's magic number instead. Freed
+ * memory is poisoned unless MALLOC369_POISON is 0.
+ */
+
+#ifndef MALLOC369_SAMPLE
+#define MALLOC369_SAMPLE 64
+#endif
+#ifndef MALLOC369_POISON
+#define MALLOC369_POISON 1
+#endif
+
 /* Need 2^63 bytes malloced before these will overflow as 
  * signed types, and having signs makes the math safer
  * if the accounting is wrong.
@@ -21,6 +44,110 @@ static bool verbose;
 
 KHASH_MAP_INIT_INT64(ptrmap, size_t)
 khash_t(ptrmap) *malloc_map;
+
+/* Fill freed memory with 0xee to help detect use-after-free bugs. */
+/* Why 0xee? Because (a) filling with 0xff can look like -1 which might
+ * be misleading, and (b) filling with a hex-word like '0xdead'
+ * requires either an assumption that malloc'd sizes are always even
+ * or more complicated code to check if size is even or odd.
+ * Depending on how you look at things you may see memory containing
+ * 0xee in different ways. For example, when viewed as:
+ *     char:     0xee (1 byte) = -18
+ *     unsigned char: 0xee (1 byte) = 238
+ *     Viewed as an int:   0xeeeeeeee (4 bytes) = -286331154
+ *     Viewed as unsigned: 0xeeeeeeee (4 bytes) = 4008636142
+ *     Viewed as long: 0xeeeeeeeeeeeeeeee (8 bytes) = -1229782938247303442
+ *     Viewed as unsigned long: 0xeeeeeeeeeeeeeeee (8 bytes) = 17216961135462248174
+ *     Viewed as ptr: 0xeeeeeeeeeeeeeeee (8 bytes) = 0xeeeeeeeeeeeeeeee
+ *
+ * Looking at memory in hex, or as (void *) type in gdb will make it
+ * easy to spot the 'freed memory chunk' pattern.
+ */
+static void poison(void *ptr, size_t size)
+{
+	memset(ptr, 0xee, size);
+}
+
+#ifdef MALLOC369_FAST
+
+/* Precedes each allocation. Two words keep the memory after it as aligned
+ * as malloc's. */
+struct header {
+	size_t size;
+	size_t magic;
+};
+
+#define LIVE    0x6d616c6c6f633639 /* "malloc69" */
+#define SAMPLED (LIVE ^ 1)         /* live, and recorded in malloc_map */
+
+extern void * malloc369(size_t size)
+{
+	struct header *h = malloc(sizeof(struct header) + size);
+	if (h == NULL) {
+		exit(-1);
+	}
+	h->size = size;
+	h->magic = LIVE;
+	num_mallocs++;
+	bytes_malloced += size;
+
+#if MALLOC369_SAMPLE > 0
+	if (num_mallocs % MALLOC369_SAMPLE == 0) {
+		int ret;
+		khiter_t k = kh_put(ptrmap, malloc_map, (size_t)(h + 1), &ret);
+		assert(ret >= 0);
+		if (ret == 0 && verbose) {
+			unintr_printf("malloc369 - malloc returned ptr that we did not delete!\n");
+		}
+		kh_value(malloc_map, k) = size;
+		h->magic = SAMPLED;
+	}
+#endif
+	return h + 1;
+}
+
+extern void free369(void * ptr)
+{
+	struct header *h = (struct header *)ptr - 1;
+	size_t size;
+
+	if (ptr == NULL) {
+		free(ptr);
+		return;
+	}
+
+	/* Freed memory belongs to malloc, which may have written over the
+	 * header. Either way the magic is gone. Nor is there a header to hand
+	 * to free(), so give up rather than corrupt malloc's state.
+	 */
+	if (h->magic != LIVE && h->magic != SAMPLED) {
+		if (verbose) {
+			unintr_printf("free369 - %p was not malloced by us, or "
+				      "was already freed!\n", ptr);
+		}
+		abort();
+	}
+	if (h->magic == SAMPLED) {
+		khiter_t k = kh_get(ptrmap, malloc_map, (size_t)ptr);
+		assert(k != kh_end(malloc_map));
+		assert(kh_value(malloc_map, k) == h->size);
+		kh_del(ptrmap, malloc_map, k);
+	}
+
+	size = h->size;
+	assert(num_mallocs - num_frees > 0);
+	num_frees++;
+	assert((bytes_malloced - bytes_freed) >= size);
+	bytes_freed += size;
+
+	if (MALLOC369_POISON) {
+		poison(ptr, size);
+	}
+	h->magic = 0;
+	free(h);
+}
+
+#else /* !MALLOC369_FAST */
 		
 extern void * malloc369(size_t size)
 {
@@ -95,34 +222,14 @@ extern void free369(void * ptr)
 	assert((bytes_malloced - bytes_freed) >= size);
 	bytes_freed += size;
 
-	/* Fill freed memory with 0xee to help detect use-after-free bugs. */
-	/* Why 0xee? Because (a) filling with 0xff can look like -1 which might
-	 * be misleading, and (b) filling with a hex-word like '0xdead' 
-	 * requires either an assumption that malloc'd sizes are always even
-	 * or more complicated code to check if size is even or odd. 
-	 * Depending on how you look at things you may see memory containing
-	 * 0xee in different ways. For example, when viewed as:
-	 *     char:     0xee (1 byte) = -18
-	 *     unsigned char: 0xee (1 byte) = 238      
-	 *     Viewed as an int:   0xeeeeeeee (4 bytes) = -286331154
-	 *     Viewed as unsigned: 0xeeeeeeee (4 bytes) = 4008636142
-	 *     Viewed as long: 0xeeeeeeeeeeeeeeee (8 bytes) = -1229782938247303442
-	 *     Viewed as unsigned long: 0xeeeeeeeeeeeeeeee (8 bytes) = 17216961135462248174
-	 *     Viewed as ptr: 0xeeeeeeeeeeeeeeee (8 bytes) = 0xeeeeeeeeeeeeeeee
-	 *
-	 * Looking at memory in hex, or as (void *) type in gdb will make it
-	 * easy to spot the 'freed memory chunk' pattern. 
-	 */
-
-	char *region = (char *)ptr;
-	for (size_t i = 0; i < size; i++) {
-		region[i] = 0xee;
-	}
+	poison(ptr, size);
 	free(ptr);
 	kh_value(malloc_map, k) |= FREED;
 	
 }
 
+#endif /* MALLOC369_FAST */
+
 
 extern void init_csc369_malloc(bool verb)
 {
@@ -168,3 +275,56 @@ extern  bool is_leak_free(int num_mallocs_tol, int num_bytes_tol)
 		return true;
 	}
 }
+
+/* Count mallocs allocations (frees, if negative) totalling bytes that were
+ * made without malloc369, e.g. from an object cache, so that leak checks see
+ * them. */
+extern void malloc369_count(long mallocs, long bytes)
+{
+	if (mallocs >= 0) {
+		num_mallocs += mallocs;
+		bytes_malloced += bytes;
+	} else {
+		num_frees -= mallocs;
+		assert((bytes_malloced - bytes_freed) >= bytes);
+		bytes_freed += bytes;
+	}
+}
+
+/* Number of unfreed allocations in the map, and (if map_buckets is not NULL)
+ * the number of buckets of the map, which grows with every allocation ever
+ * made unless MALLOC369_FAST. */
+extern long get_num_tracked(long *map_buckets)
+{
+	long n = 0;
+	khiter_t k;
+
+	for (k = kh_begin(malloc_map); k != kh_end(malloc_map); k++) {
+		if (kh_exist(malloc_map, k) &&
+		    !(kh_value(malloc_map, k) & FREED)) {
+			n++;
+		}
+	}
+	if (map_buckets) {
+		*map_buckets = kh_n_buckets(malloc_map);
+	}
+	return n;
+}
+
+/* Print up to max unfreed allocations from the map, as hints for finding a
+ * leak. */
+extern void print_tracked(int max)
+{
+	khiter_t k;
+
+	for (k = kh_begin(malloc_map); k != kh_end(malloc_map) && max > 0;
+	     k++) {
+		if (kh_exist(malloc_map, k) &&
+		    !(kh_value(malloc_map, k) & FREED)) {
+			unintr_printf("  unfreed %p: %lu bytes\n",
+				      (void *)kh_key(malloc_map, k),
+				      kh_value(malloc_map, k));
+			max--;
+		}
+	}
+}
@@ -0,0 +1,178 @@
+#ifndef _SCHED_H_
+#define _SCHED_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <ucontext.h>
+#include "thread.h"
+#include "wheel.h"
+
+/* This file contains the definitions shared by thread.c and the scheduling
+ * policies (sched_*.c): the thread control block, and the interface every
+ * policy implements. thread.c owns everything in the TCB except the fields
+ * marked as policy state, which belong to whichever policy is running.
+ */
+
+#ifdef THREAD_STATS
+/* What a thread has done, see thread_stats. Times are in nanoseconds. The
+ * time since since_ns is not yet charged to the thread's state, and
+ * ready_ns_at is when the thread last became ready. */
+struct thread_acct {
+	unsigned long voluntary;
+	unsigned long involuntary;
+	unsigned long run_ns;
+	unsigned long ready_ns;
+	unsigned long blocked_ns;
+	unsigned long max_ready_ns;
+	unsigned long since_ns;
+	unsigned long ready_ns_at;
+};
+#endif
+
+/* This is the thread control block. */
+typedef struct thread {
+	/* ... Fill this in ... */
+	Tid tid;
+    int state;
+    void* stack_bottom;
+	/* bytes of stack above stack_bottom, see thread_create_attr. */
+	size_t stack_size;
+	char name[THREAD_NAME_LEN];
+	/* nobody will wait for the thread, so its exit code is dropped. */
+	bool detached;
+    ucontext_t mycontext;
+	/* saved stack pointer, used instead of mycontext by thread_switch. */
+	void* sp;
+	// int exit_code;
+	/* ready queue links. The ready queue is threaded through the TCBs so
+	 * that enqueue, dequeue and removal by Tid need no allocation. */
+	struct thread* ready_next;
+	struct thread* ready_prev;
+	bool in_ready;
+	/* the wait queue this thread is sleeping on, if any. */
+	struct wait_queue* sleep_wq;
+	/* this thread's node in sleep_wq, for unlinking it in O(1). */
+	struct wait_node* wait_node;
+	/* the address this thread is parked on, see thread_park. */
+	const void* park_addr;
+	/* fires when a timed sleep runs out, see sleep_timeout. */
+	struct wheel_timer timeout;
+	bool timed_out;
+	/* the lock handed to this thread by lock_release while it waits for
+	 * it, see lock_handoff. */
+	struct lock* handoff;
+	/* priority set by thread_setprio, and the priority the thread runs at,
+	 * which includes what it inherits from the waiters of its locks. */
+	int prio;
+	int eff_prio;
+	/* the lock this thread waits for, and the locks it holds, linked
+	 * through the locks, for priority inheritance. */
+	struct lock* blocked_on;
+	struct lock* held_locks;
+	/* link on the reap list once the thread is DYING. */
+	struct thread* reap_next;
+	/* set by thread_kill while the thread runs on another worker. the
+	 * thread kills itself the next time it enters the scheduler. */
+	bool killed;
+	/* handlers to run if the thread is killed, last pushed first, see
+	 * thread_cleanup_push. */
+	struct thread_cleanup* cleanup;
+	/* what thread_join returns to this thread, and the value it is
+	 * handed, set by the thread it joins as it ends. */
+	Tid join_ret;
+	void* join_value;
+	/* the future whose task this thread runs, see thread_future_create. */
+	struct thread_future* future;
+#ifdef THREAD_STATS
+	struct thread_acct acct;
+#endif
+
+	/* policy state */
+	int level;	/* mlfq: queue level, 0 is the highest priority */
+	int ticks;	/* mlfq: ticks used at the current level */
+	int tickets;	/* stride: share of the CPU */
+	long pass;	/* stride: virtual time, lowest pass runs next */
+	int heap_idx;	/* stride: position in the run heap */
+	int cpu;	/* steal: worker whose run queue holds the thread */
+}thread;
+
+typedef enum thread_state {
+    RUNNING = -10,
+    READY = -11,
+    DYING = -12,
+	SLEEP = -13,
+	ZOMBIE = -14,
+} thread_state;
+
+#define DEFAULT_TICKETS 100
+
+/* A FIFO list of threads linked through ready_next/ready_prev, for policies
+ * that keep one or more run queues. */
+struct run_list {
+	thread* head;
+	thread* tail;
+};
+
+static inline void
+run_list_append(struct run_list* list, thread* th)
+{
+	th->ready_next = NULL;
+	th->ready_prev = list->tail;
+	if (list->tail == NULL) list->head = th;
+	else list->tail->ready_next = th;
+	list->tail = th;
+}
+
+static inline void
+run_list_remove(struct run_list* list, thread* th)
+{
+	if (th->ready_prev == NULL) list->head = th->ready_next;
+	else th->ready_prev->ready_next = th->ready_next;
+	if (th->ready_next == NULL) list->tail = th->ready_prev;
+	else th->ready_next->ready_prev = th->ready_prev;
+	th->ready_next = NULL;
+	th->ready_prev = NULL;
+}
+
+static inline thread*
+run_list_pop(struct run_list* list)
+{
+	thread* th = list->head;
+	if (th != NULL) run_list_remove(list, th);
+	return th;
+}
+
+// The scheduling policies.
+#define SCHEDULERS \
+	SCHED(fifo) \
+	SCHED(rr) \
+	SCHED(mlfq) \
+	SCHED(stride) \
+	SCHED(steal) \
+	SCHED(prio)
+
+/* The number of workers (kernel threads) running user threads, and the
+ * index, from 0 to nr_workers-1, of the one calling into the policy. */
+extern int nr_workers;
+int this_worker_id(void);
+
+// Scheduling policy functions. All of them run with interrupts disabled.
+//   enqueue   - th has become runnable.
+//   pick_next - remove and return the thread to run next, or NULL if there
+//               is none.
+//   remove    - take th, which is runnable, off the run queue (e.g. it is
+//               the target of thread_yield(tid), or it was killed).
+//   on_tick   - called on each timer interrupt with the running thread.
+//               Return true to preempt it.
+//   on_block  - the running thread is about to go to sleep.
+#define SCHED(name) \
+	void name ## _init(void); \
+	void name ## _enqueue(thread* th); \
+	thread* name ## _pick_next(void); \
+	void name ## _remove(thread* th); \
+	bool name ## _on_tick(thread* cur); \
+	void name ## _on_block(thread* cur);
+SCHEDULERS
+#undef SCHED
+
+#endif /* _SCHED_H_ */
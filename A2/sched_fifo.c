@@ -0,0 +1,79 @@
+#include "sched.h"
+
+/* First-in first-out scheduling. fifo never preempts: a thread runs until
+ * it yields, sleeps or exits. rr uses the same queue, but preempts the
+ * running thread on every timer tick, which is what the library has always
+ * done. */
+
+static struct run_list ready;
+
+void
+fifo_init(void)
+{
+	ready.head = NULL;
+	ready.tail = NULL;
+}
+
+void
+fifo_enqueue(thread* th)
+{
+	run_list_append(&ready, th);
+}
+
+thread*
+fifo_pick_next(void)
+{
+	return run_list_pop(&ready);
+}
+
+void
+fifo_remove(thread* th)
+{
+	run_list_remove(&ready, th);
+}
+
+bool
+fifo_on_tick(thread* cur)
+{
+	return false;
+}
+
+void
+fifo_on_block(thread* cur)
+{
+}
+
+void
+rr_init(void)
+{
+	fifo_init();
+}
+
+void
+rr_enqueue(thread* th)
+{
+	fifo_enqueue(th);
+}
+
+thread*
+rr_pick_next(void)
+{
+	return fifo_pick_next();
+}
+
+void
+rr_remove(thread* th)
+{
+	fifo_remove(th);
+}
+
+bool
+rr_on_tick(thread* cur)
+{
+	return true;
+}
+
+void
+rr_on_block(thread* cur)
+{
+}
@@ -0,0 +1,96 @@
+#include "sched.h"
+
+/* Multi-level feedback queue. Threads start at level 0, the highest
+ * priority, and the thread to run is taken from the highest non-empty
+ * level. A thread that uses up its quantum at a level is moved down one
+ * level, where the quantum is twice as long. A thread that blocks before its
+ * quantum is up keeps its level, so interactive and I/O-bound threads stay
+ * ahead of CPU-bound ones. Every MLFQ_BOOST_TICKS ticks all threads are moved
+ * back to level 0, so CPU-bound threads cannot starve.
+ */
+
+#define MLFQ_LEVELS 4
+#define MLFQ_BOOST_TICKS 200
+
+static struct run_list levels[MLFQ_LEVELS];
+static int ticks_since_boost;
+
+static int
+quantum(int level)
+{
+	return 1 << level;
+}
+
+void
+mlfq_init(void)
+{
+	for (int i = 0; i < MLFQ_LEVELS; i++) {
+		levels[i].head = NULL;
+		levels[i].tail = NULL;
+	}
+	ticks_since_boost = 0;
+}
+
+void
+mlfq_enqueue(thread* th)
+{
+	run_list_append(&levels[th->level], th);
+}
+
+thread*
+mlfq_pick_next(void)
+{
+	for (int i = 0; i < MLFQ_LEVELS; i++) {
+		if (levels[i].head != NULL) {
+			return run_list_pop(&levels[i]);
+		}
+	}
+	return NULL;
+}
+
+void
+mlfq_remove(thread* th)
+{
+	run_list_remove(&levels[th->level], th);
+}
+
+static void
+boost(void)
+{
+	for (int i = 1; i < MLFQ_LEVELS; i++) {
+		thread* th;
+		while ((th = run_list_pop(&levels[i])) != NULL) {
+			th->level = 0;
+			th->ticks = 0;
+			run_list_append(&levels[0], th);
+		}
+	}
+}
+
+bool
+mlfq_on_tick(thread* cur)
+{
+	if (++ticks_since_boost >= MLFQ_BOOST_TICKS) {
+		ticks_since_boost = 0;
+		boost();
+		cur->level = 0;
+		cur->ticks = 0;
+		return true;
+	}
+	if (++cur->ticks >= quantum(cur->level)) {
+		if (cur->level < MLFQ_LEVELS - 1) cur->level++;
+		cur->ticks = 0;
+		return true;
+	}
+	/* a thread at a higher level is waiting */
+	for (int i = 0; i < cur->level; i++) {
+		if (levels[i].head != NULL) return true;
+	}
+	return false;
+}
+
+void
+mlfq_on_block(thread* cur)
+{
+	cur->ticks = 0;
+}
@@ -0,0 +1,67 @@
+#include <assert.h>
+#include "sched.h"
+
+/* Priority scheduling. There is one FIFO run queue per priority level, and
+ * a bitmap of the levels that have runnable threads, so the highest level
+ * is found with a single count-leading-zeros. Threads are queued at their
+ * effective priority (eff_prio), which thread.c keeps up to date, including
+ * inherited priority; it takes a queued thread off before changing it.
+ */
+
+#define PRIO_LEVELS (THREAD_PRIO_MAX + 1)
+
+_Static_assert(PRIO_LEVELS <= 32, "the bitmap has one bit per level");
+
+static struct run_list ready[PRIO_LEVELS];
+static unsigned int nonempty;
+
+static int
+highest(void)
+{
+	return 31 - __builtin_clz(nonempty);
+}
+
+void
+prio_init(void)
+{
+	for (int i = 0; i < PRIO_LEVELS; i++) {
+		ready[i].head = NULL;
+		ready[i].tail = NULL;
+	}
+	nonempty = 0;
+}
+
+void
+prio_enqueue(thread* th)
+{
+	run_list_append(&ready[th->eff_prio], th);
+	nonempty |= 1U << th->eff_prio;
+}
+
+void
+prio_remove(thread* th)
+{
+	run_list_remove(&ready[th->eff_prio], th);
+	if (ready[th->eff_prio].head == NULL) nonempty &= ~(1U << th->eff_prio);
+}
+
+thread*
+prio_pick_next(void)
+{
+	if (nonempty == 0) return NULL;
+	thread* th = ready[highest()].head;
+	prio_remove(th);
+	return th;
+}
+
+bool
+prio_on_tick(thread* cur)
+{
+	// a thread of the same priority gets its turn, but not a lower one.
+	return nonempty != 0 && highest() >= cur->eff_prio;
+}
+
+void
+prio_on_block(thread* cur)
+{
+}
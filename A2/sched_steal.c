@@ -0,0 +1,65 @@
+#include "sched.h"
+
+/* Work stealing, for running threads on several workers (see
+ * thread_init_workers). Each worker has its own run queue, and a thread
+ * made runnable on a worker goes on that worker's queue. A worker runs the
+ * threads on its own queue round robin, preempting on every tick like rr.
+ * When its queue is empty, it steals from the tail of the other workers'
+ * queues, taking the thread that would otherwise wait the longest.
+ *
+ * The queues are protected by the scheduler lock that interrupts_off takes
+ * when there is more than one worker, like every other policy's state.
+ */
+
+static struct run_list ready[THREAD_MAX_WORKERS];
+
+void
+steal_init(void)
+{
+	for (int i = 0; i < THREAD_MAX_WORKERS; i++) {
+		ready[i].head = NULL;
+		ready[i].tail = NULL;
+	}
+}
+
+void
+steal_enqueue(thread* th)
+{
+	th->cpu = this_worker_id();
+	run_list_append(&ready[th->cpu], th);
+}
+
+thread*
+steal_pick_next(void)
+{
+	int self = this_worker_id();
+	thread* th = run_list_pop(&ready[self]);
+	if (th != NULL) return th;
+
+	for (int i = 1; i < nr_workers; i++) {
+		struct run_list* victim = &ready[(self + i) % nr_workers];
+		if (victim->tail != NULL) {
+			th = victim->tail;
+			run_list_remove(victim, th);
+			return th;
+		}
+	}
+	return NULL;
+}
+
+void
+steal_remove(thread* th)
+{
+	run_list_remove(&ready[th->cpu], th);
+}
+
+bool
+steal_on_tick(thread* cur)
+{
+	return true;
+}
+
+void
+steal_on_block(thread* cur)
+{
+}
@@ -0,0 +1,111 @@
+#include <assert.h>
+#include <stdlib.h>
+#include "sched.h"
+
+/* Stride scheduling. Each thread holds tickets, and its stride is
+ * STRIDE1 / tickets. The runnable thread with the lowest pass runs next and
+ * its pass advances by one stride each time it is picked, so over time each
+ * thread runs in proportion to its tickets. Runnable threads are kept in a
+ * binary min-heap ordered by pass, which grows with the number of threads,
+ * as the thread table does (see thread_set_max_threads).
+ */
+
+#define STRIDE1 (1L << 20)
+
+static thread** heap;
+static int heap_size;
+static int heap_cap;
+/* pass of the last thread picked. a thread that was asleep restarts from
+ * here, so it cannot build up credit while blocked. */
+static long global_pass;
+
+static void
+heap_set(int i, thread* th)
+{
+	heap[i] = th;
+	th->heap_idx = i;
+}
+
+static void
+sift_up(int i)
+{
+	thread* th = heap[i];
+	while (i > 0 && heap[(i - 1) / 2]->pass > th->pass) {
+		heap_set(i, heap[(i - 1) / 2]);
+		i = (i - 1) / 2;
+	}
+	heap_set(i, th);
+}
+
+static void
+sift_down(int i)
+{
+	thread* th = heap[i];
+	for (;;) {
+		int child = 2 * i + 1;
+		if (child >= heap_size) break;
+		if (child + 1 < heap_size &&
+		    heap[child + 1]->pass < heap[child]->pass) child++;
+		if (heap[child]->pass >= th->pass) break;
+		heap_set(i, heap[child]);
+		i = child;
+	}
+	heap_set(i, th);
+}
+
+void
+stride_init(void)
+{
+	heap_size = 0;
+	global_pass = 0;
+}
+
+void
+stride_enqueue(thread* th)
+{
+	if (heap_size == heap_cap) {
+		heap_cap = heap_cap ? heap_cap * 2 : THREAD_MAX_THREADS;
+		heap = realloc(heap, heap_cap * sizeof(thread*));
+		assert(heap);
+	}
+	if (th->pass < global_pass) th->pass = global_pass;
+	heap_set(heap_size, th);
+	heap_size++;
+	sift_up(heap_size - 1);
+}
+
+void
+stride_remove(thread* th)
+{
+	int i = th->heap_idx;
+	heap_size--;
+	if (i != heap_size) {
+		thread* moved = heap[heap_size];
+		heap_set(i, moved);
+		sift_up(i);
+		sift_down(moved->heap_idx);
+	}
+	th->heap_idx = -1;
+}
+
+thread*
+stride_pick_next(void)
+{
+	if (heap_size == 0) return NULL;
+	thread* th = heap[0];
+	stride_remove(th);
+	global_pass = th->pass;
+	th->pass += STRIDE1 / th->tickets;
+	return th;
+}
+
+bool
+stride_on_tick(thread* cur)
+{
+	return true;
+}
+
+void
+stride_on_block(thread* cur)
+{
+}
@@ -0,0 +1,143 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "interrupt.h"
+#include "malloc369.h"
+#include "slab.h"
+
+/* Objects are 16-byte aligned, like malloc's. A free object's link to the
+ * next free object is kept in the word after it, so that the link does not
+ * overwrite the state its constructor left it in. A slab starts with the
+ * link to the previous slab, padded to keep the objects aligned. */
+#define SLAB_ALIGN 16
+
+static struct slab_cache *caches = NULL;
+
+static void **
+free_link(struct slab_cache *cache, void *obj)
+{
+	return (void **)((char *)obj + cache->slot - sizeof(void *));
+}
+
+/* carve a new slab into free objects. */
+static void
+slab_grow(struct slab_cache *cache)
+{
+	char *slab = malloc(SLAB_ALIGN + cache->slot * SLAB_OBJECTS);
+	char *obj;
+	int i;
+
+	assert(slab);
+	*(void **)slab = cache->slab_list;
+	cache->slab_list = slab;
+	cache->stats.slabs++;
+	/* push them in reverse, so they are handed out in address order */
+	for (i = SLAB_OBJECTS - 1; i >= 0; i--) {
+		obj = slab + SLAB_ALIGN + i * cache->slot;
+		if (cache->ctor) {
+			cache->ctor(obj);
+		}
+		*free_link(cache, obj) = cache->free_list;
+		cache->free_list = obj;
+	}
+	cache->stats.cached += SLAB_OBJECTS;
+}
+
+void
+slab_cache_init(struct slab_cache *cache, const char *name, size_t size,
+		void (*ctor)(void *obj), long prealloc)
+{
+	bool enabled = interrupts_off();
+	struct slab_cache **last;
+
+	cache->stats = (struct slab_stats){ .name = name, .size = size };
+	cache->slot = (size + sizeof(void *) + SLAB_ALIGN - 1) &
+		~(size_t)(SLAB_ALIGN - 1);
+	cache->ctor = ctor;
+	cache->free_list = NULL;
+	cache->slab_list = NULL;
+	while (cache->stats.cached < prealloc) {
+		slab_grow(cache);
+	}
+	/* keep them in the order they were set up, for slab_stats_dump */
+	for (last = &caches; *last != NULL; last = &(*last)->next)
+		;
+	cache->next = NULL;
+	*last = cache;
+	interrupts_set(enabled);
+}
+
+void *
+slab_alloc(struct slab_cache *cache)
+{
+	bool enabled = interrupts_off();
+	void *obj;
+
+	if (cache->free_list == NULL) {
+		slab_grow(cache);
+	}
+	obj = cache->free_list;
+	cache->free_list = *free_link(cache, obj);
+	cache->stats.cached--;
+	cache->stats.in_use++;
+	cache->stats.allocs++;
+	malloc369_count(1, cache->stats.size);
+	interrupts_set(enabled);
+	return obj;
+}
+
+void
+slab_free(struct slab_cache *cache, void *obj)
+{
+	bool enabled;
+
+	if (obj == NULL) {
+		return;
+	}
+	enabled = interrupts_off();
+	assert(cache->stats.in_use > 0);
+	*free_link(cache, obj) = cache->free_list;
+	cache->free_list = obj;
+	cache->stats.cached++;
+	cache->stats.in_use--;
+	cache->stats.frees++;
+	malloc369_count(-1, cache->stats.size);
+	interrupts_set(enabled);
+}
+
+int
+slab_get_stats(const char *name, struct slab_stats *stats)
+{
+	bool enabled = interrupts_off();
+	struct slab_cache *cache;
+
+	for (cache = caches; cache != NULL; cache = cache->next) {
+		if (strcmp(cache->stats.name, name) == 0) {
+			*stats = cache->stats;
+			break;
+		}
+	}
+	interrupts_set(enabled);
+	return cache != NULL ? 0 : -1;
+}
+
+void
+slab_stats_dump(void)
+{
+	bool enabled;
+	struct slab_cache *cache;
+	struct slab_stats s;
+
+	unintr_printf("%-12s %6s %10s %10s %8s %8s %6s\n", "cache", "size",
+		      "allocs", "frees", "in use", "cached", "slabs");
+	for (cache = caches; cache != NULL; cache = cache->next) {
+		enabled = interrupts_off();
+		s = cache->stats;
+		interrupts_set(enabled);
+		unintr_printf("%-12s %6zu %10ld %10ld %8ld %8ld %6ld\n",
+			      s.name, s.size, s.allocs, s.frees, s.in_use,
+			      s.cached, s.slabs);
+	}
+}
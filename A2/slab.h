@@ -0,0 +1,61 @@
+#ifndef _SLAB_H_
+#define _SLAB_H_
+
+#include <stddef.h>
+
+/* Object caches for the structures the library allocates on its hot paths:
+ * TCBs, wait queue nodes, wait queues, locks and condition variables. A
+ * cache hands out objects of one size, carved from slabs of SLAB_OBJECTS
+ * objects, and keeps freed objects on a free list instead of giving them
+ * back, so that once it is warm, creating a thread or sleeping and waking up
+ * never calls the general purpose allocator. Slabs are never released.
+ *
+ * A cache may have a constructor, which runs once for each object, when its
+ * slab is carved. Objects must be freed in their constructed state, and are
+ * handed out again as they are.
+ *
+ * The slabs themselves are malloc'd, but malloc369 counts each object handed
+ * out as an allocation of its size, so that leak checks see objects that are
+ * never freed, and not what the caches keep.
+ */
+
+#define SLAB_OBJECTS 64 /* objects per slab */
+
+struct slab_stats {
+	const char *name;
+	size_t size;	/* bytes per object */
+	long allocs;	/* slab_alloc calls */
+	long frees;	/* slab_free calls */
+	long in_use;	/* objects handed out and not freed yet */
+	long cached;	/* objects on the free list */
+	long slabs;	/* slabs carved */
+};
+
+struct slab_cache {
+	struct slab_stats stats;
+	size_t slot;		  /* bytes per object, with its free list link */
+	void (*ctor)(void *obj);
+	void *free_list;
+	void *slab_list;	  /* every slab, linked through its first word */
+	struct slab_cache *next;  /* on the list of all caches */
+};
+
+/* Set up cache for objects of size bytes, constructed by ctor if it is not
+ * NULL, with room for at least prealloc objects. */
+void slab_cache_init(struct slab_cache *cache, const char *name, size_t size,
+		     void (*ctor)(void *obj), long prealloc);
+
+/* Return an object from cache, carving a new slab if none is free. */
+void *slab_alloc(struct slab_cache *cache);
+
+/* Give obj, from slab_alloc(cache), back to cache. obj may be NULL. */
+void slab_free(struct slab_cache *cache, void *obj);
+
+/* Copy the counters of the cache called name into stats. Returns -1 if
+ * there is no such cache. */
+int slab_get_stats(const char *name, struct slab_stats *stats);
+
+/* Print the counters of every cache. */
+void slab_stats_dump(void);
+
+#endif /* _SLAB_H_ */
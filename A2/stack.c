@@ -0,0 +1,163 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "thread.h"
+#include "interrupt.h"
+#include "stack.h"
+
+/* Only stacks of the default size are pooled. A cached stack keeps the link
+ * to the next cached stack in its top word, which is already resident from
+ * when the stack was last in use. The pages below the top one are dropped
+ * as the stack goes into the pool, so they cost no memory while it is
+ * cached, and the next thread to get it starts with a clean stack_touched. */
+#define POOL_STACK_SIZE THREAD_MIN_STACK
+
+/* Guard pages installed with madvise (Linux 6.13) do not split the mapping
+ * the way an mprotect'd page does, so stacks mapped one after another merge
+ * into a few large mappings. With mprotect, every stack costs two, and
+ * vm.max_map_count (65530 by default) caps the number of threads at about
+ * 32000. Older kernels fail the madvise with EINVAL, and mprotect is used. */
+#ifndef MADV_GUARD_INSTALL
+#define MADV_GUARD_INSTALL 102
+#endif
+
+static bool guard_madvise = true;
+
+static void *pool_head = NULL;
+static struct stack_pool_stats pool = { .cap = STACK_POOL_DEFAULT_CAP };
+
+static size_t
+guard_size(void)
+{
+	static size_t page = 0;
+	if (page == 0) {
+		page = sysconf(_SC_PAGESIZE);
+	}
+	return page;
+}
+
+static void **
+pool_link(void *stack)
+{
+	return (void **)((char *)stack + POOL_STACK_SIZE - sizeof(void *));
+}
+
+static void *
+stack_map(size_t size)
+{
+	size_t guard = guard_size();
+	char *base = mmap(NULL, guard + size, PROT_READ | PROT_WRITE,
+			  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK,
+			  -1, 0);
+	if (base == MAP_FAILED) {
+		return NULL;
+	}
+	/* the stack grows down, so the guard goes below the lowest address */
+	if (guard_madvise && madvise(base, guard, MADV_GUARD_INSTALL)) {
+		guard_madvise = false;
+	}
+	if (!guard_madvise && mprotect(base, guard, PROT_NONE)) {
+		munmap(base, guard + size);
+		return NULL;
+	}
+	pool.bytes_mapped += guard + size;
+	return base + guard;
+}
+
+static void
+stack_unmap(void *stack, size_t size)
+{
+	size_t guard = guard_size();
+	int ret = munmap((char *)stack - guard, guard + size);
+	assert(!ret);
+	pool.bytes_mapped -= guard + size;
+}
+
+void *
+stack_alloc(size_t size)
+{
+	bool enabled = interrupts_off();
+	void *stack;
+
+	if (size == POOL_STACK_SIZE && pool_head != NULL) {
+		stack = pool_head;
+		pool_head = *pool_link(stack);
+		pool.cached--;
+		pool.hits++;
+	} else {
+		stack = stack_map(size);
+		pool.misses++;
+	}
+	interrupts_set(enabled);
+	return stack;
+}
+
+void
+stack_free(void *stack, size_t size)
+{
+	bool enabled = interrupts_off();
+
+	if (stack == NULL) {
+		/* the initial thread runs on the process stack */
+	} else if (size == POOL_STACK_SIZE && pool.cached < pool.cap) {
+		int ret = madvise(stack, size - guard_size(), MADV_DONTNEED);
+		assert(!ret);
+		*pool_link(stack) = pool_head;
+		pool_head = stack;
+		pool.cached++;
+	} else {
+		stack_unmap(stack, size);
+	}
+	interrupts_set(enabled);
+}
+
+long
+stack_pool_set_cap(long cap)
+{
+	bool enabled = interrupts_off();
+	long old = pool.cap;
+
+	assert(cap >= 0);
+	pool.cap = cap;
+	while (pool.cached > pool.cap) {
+		void *stack = pool_head;
+		pool_head = *pool_link(stack);
+		pool.cached--;
+		stack_unmap(stack, POOL_STACK_SIZE);
+	}
+	interrupts_set(enabled);
+	return old;
+}
+
+void
+stack_pool_get_stats(struct stack_pool_stats *stats)
+{
+	bool enabled = interrupts_off();
+	*stats = pool;
+	interrupts_set(enabled);
+}
+
+size_t
+stack_touched(void *stack, size_t size)
+{
+	size_t page = guard_size();
+	size_t pages = size / page, i, j, n;
+	unsigned char vec[64];
+
+	/* the stack grows down, so the lowest resident page is the deepest
+	 * one it has reached */
+	for (i = 0; i < pages; i += n) {
+		n = pages - i < sizeof(vec) ? pages - i : sizeof(vec);
+		if (mincore((char *)stack + i * page, n * page, vec)) {
+			return 0;
+		}
+		for (j = 0; j < n; j++) {
+			if (vec[j] & 1) {
+				return size - (i + j) * page;
+			}
+		}
+	}
+	return 0;
+}
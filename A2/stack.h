@@ -0,0 +1,42 @@
+#ifndef _STACK_H_
+#define _STACK_H_
+
+#include <stddef.h>
+
+/* Thread stacks are mmap'd with MAP_NORESERVE, so pages that are never
+ * touched cost no memory, and have a guard page below them so an
+ * overflow faults instead of corrupting whatever is mapped next to it.
+ * Stacks of exited threads are kept in a pool and handed out again, up to
+ * a configurable number of cached stacks.
+ */
+
+#define STACK_POOL_DEFAULT_CAP 64 /* cached stacks kept by default */
+
+struct stack_pool_stats {
+	long hits;	   /* stack_alloc calls served from the pool */
+	long misses;	   /* stack_alloc calls that had to mmap a new stack */
+	long cached;	   /* stacks currently sitting in the pool */
+	long cap;	   /* maximum number of stacks kept in the pool */
+	long bytes_mapped; /* bytes mapped for stacks in use or in the pool */
+};
+
+/* Return the lowest usable address of a stack of at least size bytes, or
+ * NULL if no memory could be mapped. */
+void *stack_alloc(size_t size);
+
+/* Give a stack returned by stack_alloc(size) back. */
+void stack_free(void *stack, size_t size);
+
+/* Set the number of stacks the pool may cache. Extra cached stacks are
+ * unmapped right away. Returns the previous cap. */
+long stack_pool_set_cap(long cap);
+
+/* Copy the pool counters into stats. */
+void stack_pool_get_stats(struct stack_pool_stats *stats);
+
+/* Return how many bytes of a stack returned by stack_alloc(size), counted
+ * down from its top, have been touched, i.e. lie above its lowest resident
+ * page. size must be a multiple of the page size. */
+size_t stack_touched(void *stack, size_t size);
+
+#endif /* _STACK_H_ */
@@ -0,0 +1,279 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "thread.h"
+#include "malloc369.h"
+#include "interrupt.h"
+
+/* Synchronization primitives built on wait queues, in addition to the locks
+ * and condition variables of thread.c. Like those, they keep interrupts off
+ * while they look at their state and while they go to sleep, so a wakeup
+ * cannot be missed. A woken thread checks the state again, since another
+ * thread may get in first. Whether threads are waiting is read off the wait
+ * queues, which a thread leaves when it is killed, rather than counted
+ * around thread_sleep, which a killed thread never returns from. */
+
+struct rwlock {
+	int readers;		// readers holding the lock
+	bool writer;		// whether a writer holds the lock
+	bool prefer_writers;
+	struct wait_queue* read_wq;
+	struct wait_queue* write_wq;
+};
+
+struct rwlock *
+rwlock_create(bool prefer_writers)
+{
+	bool enabled = interrupts_off();
+	struct rwlock *rwlock;
+
+	rwlock = malloc369(sizeof(struct rwlock));
+	assert(rwlock);
+
+	rwlock->readers = 0;
+	rwlock->writer = false;
+	rwlock->prefer_writers = prefer_writers;
+	rwlock->read_wq = wait_queue_create();
+	rwlock->write_wq = wait_queue_create();
+
+	interrupts_set(enabled);
+	return rwlock;
+}
+
+void
+rwlock_destroy(struct rwlock *rwlock)
+{
+	bool enabled = interrupts_off();
+
+	assert(rwlock != NULL);
+	assert(rwlock->readers == 0 && !rwlock->writer);
+	wait_queue_destroy(rwlock->read_wq);
+	wait_queue_destroy(rwlock->write_wq);
+	free369(rwlock);
+
+	interrupts_set(enabled);
+}
+
+void
+rwlock_read_acquire(struct rwlock *rwlock)
+{
+	bool enabled = interrupts_off();
+	assert(rwlock != NULL);
+
+	while (rwlock->writer || (rwlock->prefer_writers && wait_queue_length(rwlock->write_wq) > 0))
+	{
+		thread_sleep(rwlock->read_wq);
+	}
+	rwlock->readers ++;
+
+	interrupts_set(enabled);
+}
+
+void
+rwlock_read_release(struct rwlock *rwlock)
+{
+	bool enabled = interrupts_off();
+	assert(rwlock != NULL);
+	assert(rwlock->readers > 0);
+
+	rwlock->readers --;
+	if (rwlock->readers == 0)
+	{
+		// readers only wait behind a holder or a waiting writer. if
+		// that writer was killed, there is none to let them in.
+		if (thread_wakeup(rwlock->write_wq, 0) == 0) thread_wakeup(rwlock->read_wq, 1);
+	}
+
+	interrupts_set(enabled);
+}
+
+void
+rwlock_write_acquire(struct rwlock *rwlock)
+{
+	bool enabled = interrupts_off();
+	assert(rwlock != NULL);
+
+	while (rwlock->writer || rwlock->readers > 0)
+	{
+		thread_sleep(rwlock->write_wq);
+	}
+	rwlock->writer = true;
+
+	interrupts_set(enabled);
+}
+
+void
+rwlock_write_release(struct rwlock *rwlock)
+{
+	bool enabled = interrupts_off();
+	assert(rwlock != NULL);
+	assert(rwlock->writer);
+
+	rwlock->writer = false;
+	// readers can share the lock, so they are all woken up, but only one
+	// writer can get it.
+	int readers_waiting = wait_queue_length(rwlock->read_wq);
+	int writers_waiting = wait_queue_length(rwlock->write_wq);
+	bool readers_first = rwlock->prefer_writers ? writers_waiting == 0 : readers_waiting > 0;
+	if (readers_first)
+	{
+		thread_wakeup(rwlock->read_wq, 1);
+	}
+	else
+	{
+		thread_wakeup(rwlock->write_wq, 0);
+	}
+
+	interrupts_set(enabled);
+}
+
+struct sema {
+	unsigned int value;
+	struct wait_queue* wq;
+};
+
+struct sema *
+sema_create(unsigned int value)
+{
+	bool enabled = interrupts_off();
+	struct sema *sema;
+
+	sema = malloc369(sizeof(struct sema));
+	assert(sema);
+
+	sema->value = value;
+	sema->wq = wait_queue_create();
+
+	interrupts_set(enabled);
+	return sema;
+}
+
+void
+sema_destroy(struct sema *sema)
+{
+	bool enabled = interrupts_off();
+
+	assert(sema != NULL);
+	wait_queue_destroy(sema->wq);
+	free369(sema);
+
+	interrupts_set(enabled);
+}
+
+void
+sema_down(struct sema *sema)
+{
+	bool enabled = interrupts_off();
+	assert(sema != NULL);
+
+	while (sema->value == 0)
+	{
+		thread_sleep(sema->wq);
+	}
+	sema->value --;
+
+	interrupts_set(enabled);
+}
+
+int
+sema_try_down(struct sema *sema)
+{
+	bool enabled = interrupts_off();
+	assert(sema != NULL);
+
+	int ret = THREAD_NONE;
+	if (sema->value > 0)
+	{
+		sema->value --;
+		ret = 0;
+	}
+
+	interrupts_set(enabled);
+	return ret;
+}
+
+void
+sema_up(struct sema *sema)
+{
+	sema_up_n(sema, 1);
+}
+
+void
+sema_up_n(struct sema *sema, unsigned int n)
+{
+	bool enabled = interrupts_off();
+	assert(sema != NULL);
+
+	sema->value += n;
+	// wake up a waiter for each unit, until the queue is empty.
+	for (unsigned int i = 0; i < n; i ++)
+	{
+		if (thread_wakeup(sema->wq, 0) == 0) break;
+	}
+
+	interrupts_set(enabled);
+}
+
+struct barrier {
+	unsigned int count;	// threads to wait for
+	unsigned long round;
+	struct wait_queue* wq;
+};
+
+struct barrier *
+barrier_create(unsigned int count)
+{
+	bool enabled = interrupts_off();
+	struct barrier *barrier;
+
+	assert(count > 0);
+	barrier = malloc369(sizeof(struct barrier));
+	assert(barrier);
+
+	barrier->count = count;
+	barrier->round = 0;
+	barrier->wq = wait_queue_create();
+
+	interrupts_set(enabled);
+	return barrier;
+}
+
+void
+barrier_destroy(struct barrier *barrier)
+{
+	bool enabled = interrupts_off();
+
+	assert(barrier != NULL);
+	wait_queue_destroy(barrier->wq);
+	free369(barrier);
+
+	interrupts_set(enabled);
+}
+
+int
+barrier_wait(struct barrier *barrier)
+{
+	bool enabled = interrupts_off();
+	assert(barrier != NULL);
+
+	// the threads that arrived in the current round are the ones on the
+	// queue: those of the last round were taken off it when woken.
+	if ((unsigned int) wait_queue_length(barrier->wq) + 1 == barrier->count)
+	{
+		barrier->round ++;
+		thread_wakeup(barrier->wq, 1);
+		interrupts_set(enabled);
+		return 1;
+	}
+	// the threads woken for this round may only run once the next round
+	// has begun, so wait for the round to change rather than for the queue
+	// to empty.
+	unsigned long round = barrier->round;
+	while (barrier->round == round)
+	{
+		thread_sleep(barrier->wq);
+	}
+
+	interrupts_set(enabled);
+	return 0;
+}
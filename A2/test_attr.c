@@ -0,0 +1,235 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * test_attr checks thread_create_attr and the stack probe.
+ * 1. A thread with a large stack can recurse far deeper than THREAD_MIN_STACK
+ *    allows, with either way of switching, and the probe sees how deep it
+ *    went.
+ * 2. A thread with a stack of THREAD_ATTR_MIN_STACK runs, and the probe
+ *    stays within it. Stacks that are too small or too large, including
+ *    sizes that would wrap around when rounded up to pages, and priorities
+ *    out of range, are refused.
+ * 3. A thread that gets a pooled stack which an earlier thread used deeply
+ *    sees only its own use of it.
+ * 4. The name and priority given are the thread's, and names that are too
+ *    long are cut short.
+ * 5. A detached thread cannot be waited for.
+ *****************************************************************************/
+
+#define BIG_STACK (1024 * 1024)
+#define DEEP (512 * 1024)
+#define NAME "a-rather-long-thread-name"
+
+static long usage;
+
+/* uses about depth bytes of stack, then probes it */
+static long
+recurse(long depth)
+{
+	volatile char pad[1024];
+
+	pad[0] = 1;
+	if (depth <= (long)sizeof(pad)) {
+		return thread_stack_usage(THREAD_SELF) + pad[0] - 1;
+	}
+	return recurse(depth - sizeof(pad)) + pad[0] - 1;
+}
+
+static void
+deep_thread(void *arg)
+{
+	usage = recurse((long)arg);
+}
+
+static void
+small_thread(void *arg)
+{
+	unintr_printf("running on a small stack\n");
+	usage = thread_stack_usage(THREAD_SELF);
+}
+
+static void
+yield_thread(void *arg)
+{
+	thread_yield(THREAD_ANY);
+}
+
+static Tid
+create(void (*fn)(void *), void *arg, size_t stack_size)
+{
+	struct thread_attr attr;
+
+	thread_attr_init(&attr);
+	attr.stack_size = stack_size;
+	return thread_create_attr(fn, arg, &attr);
+}
+
+static void
+test_deep(bool ucontext)
+{
+	Tid ret;
+
+	thread_use_ucontext(ucontext);
+	usage = 0;
+	ret = create(deep_thread, (void *)(long)DEEP, BIG_STACK);
+	assert(thread_ret_ok(ret));
+	ret = thread_wait(ret, NULL);
+	assert(thread_ret_ok(ret));
+	thread_use_ucontext(false);
+	if (usage >= DEEP && usage <= BIG_STACK) {
+		unintr_printf("test_attr: good, %s thread went %ld KB deep\n",
+			      ucontext ? "ucontext" : "switch", DEEP / 1024);
+	} else {
+		unintr_printf("test_attr: bad, probe saw %ld bytes\n", usage);
+	}
+}
+
+static void
+test_small(void)
+{
+	struct thread_attr attr;
+	Tid ret;
+
+	usage = 0;
+	ret = create(small_thread, NULL, THREAD_ATTR_MIN_STACK);
+	assert(thread_ret_ok(ret));
+	ret = thread_wait(ret, NULL);
+	assert(thread_ret_ok(ret));
+	if (usage > 0 && usage <= THREAD_ATTR_MIN_STACK) {
+		unintr_printf("test_attr: good, small stack used\n");
+	} else {
+		unintr_printf("test_attr: bad, small stack probe saw %ld "
+			      "bytes\n", usage);
+	}
+
+	thread_attr_init(&attr);
+	attr.prio = THREAD_PRIO_MAX + 1;
+	if (create(small_thread, NULL, THREAD_ATTR_MIN_STACK / 2) ==
+	    THREAD_INVALID &&
+	    create(small_thread, NULL, THREAD_ATTR_MAX_STACK + 1) ==
+	    THREAD_INVALID &&
+	    create(small_thread, NULL, (size_t)-1) == THREAD_INVALID &&
+	    thread_create_attr(small_thread, NULL, &attr) == THREAD_INVALID) {
+		unintr_printf("test_attr: good, invalid attributes refused\n");
+	} else {
+		unintr_printf("test_attr: bad, invalid attributes accepted\n");
+	}
+}
+
+static void
+test_pooled(void)
+{
+	long deep;
+	Tid ret;
+
+	/* stacks of the default size go back to the pool, and the last one
+	 * in is the first one out */
+	ret = thread_create(deep_thread, (void *)(long)(THREAD_MIN_STACK * 3 / 4));
+	assert(thread_ret_ok(ret));
+	ret = thread_wait(ret, NULL);
+	assert(thread_ret_ok(ret));
+	deep = usage;
+	ret = thread_create(deep_thread, (void *)1L);
+	assert(thread_ret_ok(ret));
+	ret = thread_wait(ret, NULL);
+	assert(thread_ret_ok(ret));
+	if (deep >= THREAD_MIN_STACK / 2 && usage > 0 &&
+	    usage < THREAD_MIN_STACK / 2) {
+		unintr_printf("test_attr: good, pooled stack probed afresh\n");
+	} else {
+		unintr_printf("test_attr: bad, pooled stack probe saw %ld bytes "
+			      "after %ld\n", usage, deep);
+	}
+}
+
+static void
+test_name_prio(void)
+{
+	struct thread_attr attr;
+	char name[THREAD_NAME_LEN], mine[THREAD_NAME_LEN];
+	Tid ret;
+	long used;
+
+	thread_attr_init(&attr);
+	attr.name = NAME;
+	attr.prio = THREAD_PRIO_MIN + 1;
+	ret = thread_create_attr(yield_thread, NULL, &attr);
+	assert(thread_ret_ok(ret));
+	thread_getname(ret, name, sizeof(name));
+	thread_getname(THREAD_SELF, mine, sizeof(mine));
+	used = thread_stack_usage(ret);
+	if (strncmp(name, NAME, THREAD_NAME_LEN - 1) == 0 &&
+	    strlen(name) == THREAD_NAME_LEN - 1 && strcmp(mine, "main") == 0 &&
+	    thread_getprio(ret) == THREAD_PRIO_MIN + 1) {
+		unintr_printf("test_attr: good, name is %s\n", name);
+	} else {
+		unintr_printf("test_attr: bad, name %s, prio %d\n", name,
+			      thread_getprio(ret));
+	}
+	/* only the initial frame has been written so far */
+	if (used > 0 && used <= THREAD_MIN_STACK &&
+	    thread_stack_usage(THREAD_SELF) == THREAD_INVALID) {
+		unintr_printf("test_attr: good, probe of a new thread\n");
+	} else {
+		unintr_printf("test_attr: bad, probe of a new thread saw %ld "
+			      "bytes\n", used);
+	}
+	thread_wait(ret, NULL);
+}
+
+static void
+test_detached(void)
+{
+	struct thread_attr attr;
+	Tid ret;
+
+	thread_attr_init(&attr);
+	attr.detached = true;
+	ret = thread_create_attr(yield_thread, NULL, &attr);
+	assert(thread_ret_ok(ret));
+	if (thread_wait(ret, NULL) == THREAD_INVALID) {
+		/* let it run and exit */
+		while (thread_yield(THREAD_ANY) != THREAD_NONE)
+			;
+		if (thread_wait(ret, NULL) == THREAD_INVALID) {
+			unintr_printf("test_attr: good, detached thread is "
+				      "not waited for\n");
+			return;
+		}
+	}
+	unintr_printf("test_attr: bad, detached thread waited for\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	long start_mallocs, start_bytes;
+
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+
+	unintr_printf("starting attr test\n");
+	start_mallocs = get_current_num_mallocs();
+	start_bytes = get_current_bytes_malloced();
+	test_deep(false);
+	test_deep(true);
+	test_small();
+	test_pooled();
+	test_name_prio();
+	test_detached();
+	if (is_leak_free(start_mallocs, start_bytes)) {
+		unintr_printf("No memory leaks detected.\n");
+	} else {
+		unintr_printf("Detected memory leaks.\n");
+	}
+	unintr_printf("attr test done\n");
+	return 0;
+}
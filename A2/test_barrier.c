@@ -0,0 +1,116 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * test_barrier stress tests the barriers, with preemption enabled. NTHREADS
+ * threads go through a barrier for NROUNDS rounds, yielding at random in
+ * between. No thread may leave a round before every thread has arrived in
+ * it, and barrier_wait must return 1 in exactly one thread per round. A
+ * thread that is killed while it waits at a barrier must not count as having
+ * arrived.
+ *****************************************************************************/
+
+#define NROUNDS 50
+
+static struct barrier *barrier;
+static int arrived[NROUNDS];
+static int serial[NROUNDS];
+static int errors;
+
+static void
+barrier_thread(void *arg)
+{
+	int r;
+
+	for (r = 0; r < NROUNDS; r++) {
+		if (random() % 2) {
+			thread_yield(THREAD_ANY);
+		}
+		__atomic_add_fetch(&arrived[r], 1, __ATOMIC_SEQ_CST);
+		if (barrier_wait(barrier)) {
+			__atomic_add_fetch(&serial[r], 1, __ATOMIC_SEQ_CST);
+		}
+		if (__atomic_load_n(&arrived[r], __ATOMIC_SEQ_CST) != NTHREADS) {
+			__atomic_add_fetch(&errors, 1, __ATOMIC_SEQ_CST);
+		}
+	}
+}
+
+static volatile int passed;
+
+static void
+pass_thread(void *arg)
+{
+	barrier_wait(barrier);
+	passed = 1;
+}
+
+static void
+test_kill(void)
+{
+	Tid killed, waiter;
+
+	barrier = barrier_create(2);
+	passed = 0;
+	killed = thread_create(pass_thread, NULL);
+	assert(thread_ret_ok(killed));
+	thread_yield(killed);
+	thread_kill(killed);
+	waiter = thread_create(pass_thread, NULL);
+	assert(thread_ret_ok(waiter));
+	thread_yield(waiter);
+	if (!passed && barrier_wait(barrier) == 1) {
+		thread_wait(waiter, NULL);
+		unintr_printf("test_barrier: good, killed thread did not "
+			      "arrive\n");
+	} else {
+		thread_wait(waiter, NULL);
+		unintr_printf("test_barrier: bad, released by a killed "
+			      "thread\n");
+	}
+	barrier_destroy(barrier);
+}
+
+int
+main(int argc, char **argv)
+{
+	Tid result[NTHREADS];
+	int i, r;
+
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+	/* Enable preemption */
+	register_interrupt_handler(false);
+
+	unintr_printf("starting barrier test\n");
+	barrier = barrier_create(NTHREADS);
+	for (i = 0; i < NTHREADS; i++) {
+		result[i] = thread_create(barrier_thread, NULL);
+		assert(thread_ret_ok(result[i]));
+	}
+	for (i = 0; i < NTHREADS; i++) {
+		thread_wait(result[i], NULL);
+	}
+	barrier_destroy(barrier);
+
+	for (r = 0; r < NROUNDS; r++) {
+		if (serial[r] != 1) {
+			errors++;
+		}
+	}
+	if (errors == 0) {
+		unintr_printf("test_barrier: good, %d rounds\n", NROUNDS);
+	} else {
+		unintr_printf("test_barrier: bad, %d errors\n", errors);
+	}
+	test_kill();
+	unintr_printf("barrier test done\n");
+	return 0;
+}
@@ -3,6 +3,7 @@
 #include "thread.h"
 #include "interrupt.h"
 #include "test_thread.h"
+#include "stack.h"
 
 static void hello(char *msg);
 static int fact(int n);
@@ -146,7 +147,10 @@ test_basic()
 	/* create a thread */
 	ret = thread_create((void (*)(void *))hello, "hello from first thread");
 
-	if (get_current_bytes_malloced() < THREAD_MIN_STACK) { 
+	/* stacks come from the mmap'd stack pool rather than malloc369 */
+	struct stack_pool_stats stack_stats;
+	stack_pool_get_stats(&stack_stats);
+	if (stack_stats.bytes_mapped < THREAD_MIN_STACK) { 
 		unintr_printf("it appears that the thread stack is not being"
 			      "allocated dynamically\n");
 		assert(0);
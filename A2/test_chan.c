@@ -0,0 +1,262 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * test_chan tests the channels, with preemption enabled.
+ * 1. The non-blocking calls fail rather than sleep on a full or empty
+ *    channel, and everything fails once the channel is closed and empty.
+ * 2. One producer sends a sequence in batches of varying size, and one
+ *    consumer receives it in batches of another size. The elements must
+ *    arrive in order.
+ * 3. For a buffered and an unbuffered channel, NTHREADS/2 producers send
+ *    NITEMS values each, one at a time or in batches, and NTHREADS/2
+ *    consumers receive them until the channel is closed. Every value must
+ *    be received exactly once.
+ * 4. A receiver, and a sender, that are killed while they wait are taken off
+ *    the channel: the next element goes to the receiver after them, and
+ *    nothing is received from the killed sender.
+ *****************************************************************************/
+
+#define NITEMS 500 /* per producer */
+#define NSEQ 10000
+#define CAPACITY 16
+
+static struct chan *chan;
+static unsigned long received_sum, received_count;
+
+static void
+sequence_thread(void *arg)
+{
+	int buf[37];
+	int next = 0, i, n;
+
+	while (next < NSEQ) {
+		n = random() % 37 + 1;
+		if (n > NSEQ - next) {
+			n = NSEQ - next;
+		}
+		for (i = 0; i < n; i++) {
+			buf[i] = next++;
+		}
+		if (n == 1) {
+			chan_send(chan, buf);
+		} else {
+			chan_send_n(chan, buf, n);
+		}
+	}
+	chan_close(chan);
+}
+
+static void
+test_order(void)
+{
+	int buf[23];
+	int expected = 0, errors = 0, i, n;
+	Tid tid;
+
+	chan = chan_create(CAPACITY, sizeof(int));
+	tid = thread_create(sequence_thread, NULL);
+	assert(thread_ret_ok(tid));
+	while ((n = chan_recv_n(chan, buf, random() % 23 + 1)) > 0) {
+		for (i = 0; i < n; i++) {
+			if (buf[i] != expected++) {
+				errors++;
+			}
+		}
+	}
+	thread_wait(tid, NULL);
+	chan_destroy(chan);
+
+	if (errors == 0 && expected == NSEQ) {
+		unintr_printf("test_chan: good, %d elements in order\n", NSEQ);
+	} else {
+		unintr_printf("test_chan: bad, %d out of order, %d received\n",
+			      errors, expected);
+	}
+}
+
+static void
+producer_thread(void *arg)
+{
+	unsigned long buf[16];
+	unsigned long i;
+	int n = 0;
+
+	for (i = 1; i <= NITEMS; i++) {
+		if ((long)arg % 2) {
+			chan_send(chan, &i);
+			continue;
+		}
+		buf[n++] = i;
+		if (n == 16 || i == NITEMS) {
+			assert(chan_send_n(chan, buf, n) == n);
+			n = 0;
+		}
+	}
+}
+
+static void
+consumer_thread(void *arg)
+{
+	unsigned long buf[8];
+	unsigned long sum = 0, count = 0;
+	int n, i;
+
+	while ((n = chan_recv_n(chan, buf, 8)) > 0) {
+		for (i = 0; i < n; i++) {
+			sum += buf[i];
+		}
+		count += n;
+		if (random() % 4 == 0) {
+			thread_yield(THREAD_ANY);
+		}
+	}
+	__atomic_add_fetch(&received_sum, sum, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(&received_count, count, __ATOMIC_SEQ_CST);
+}
+
+static void
+test_stress(unsigned int capacity)
+{
+	Tid producers[NTHREADS / 2], consumers[NTHREADS / 2];
+	unsigned long nproducers = NTHREADS / 2;
+	long i;
+
+	chan = chan_create(capacity, sizeof(unsigned long));
+	received_sum = received_count = 0;
+	for (i = 0; i < NTHREADS / 2; i++) {
+		producers[i] = thread_create(producer_thread, (void *)i);
+		assert(thread_ret_ok(producers[i]));
+		consumers[i] = thread_create(consumer_thread, NULL);
+		assert(thread_ret_ok(consumers[i]));
+	}
+	for (i = 0; i < NTHREADS / 2; i++) {
+		thread_wait(producers[i], NULL);
+	}
+	chan_close(chan);
+	for (i = 0; i < NTHREADS / 2; i++) {
+		thread_wait(consumers[i], NULL);
+	}
+	chan_destroy(chan);
+
+	if (received_count == nproducers * NITEMS &&
+	    received_sum == nproducers * NITEMS * (NITEMS + 1) / 2) {
+		unintr_printf("test_chan: good, capacity %u, every value "
+			      "received once\n", capacity);
+	} else {
+		unintr_printf("test_chan: bad, capacity %u, %lu values "
+			      "received\n", capacity, received_count);
+	}
+}
+
+static void
+test_nonblocking(void)
+{
+	int x = 1, y = 0;
+	bool ok;
+
+	chan = chan_create(1, sizeof(int));
+	ok = chan_try_recv(chan, &y) == THREAD_NONE;
+	ok = ok && chan_try_send(chan, &x) == 0;
+	ok = ok && chan_try_send(chan, &x) == THREAD_NONE;
+	chan_close(chan);
+	ok = ok && chan_send(chan, &x) == THREAD_INVALID;
+	ok = ok && chan_try_recv(chan, &y) == 0 && y == 1;
+	ok = ok && chan_recv(chan, &y) == THREAD_INVALID;
+	ok = ok && chan_recv_n(chan, &y, 1) == 0;
+	chan_destroy(chan);
+
+	if (ok) {
+		unintr_printf("test_chan: good, non-blocking calls and close\n");
+	} else {
+		unintr_printf("test_chan: bad, non-blocking calls and close\n");
+	}
+}
+
+static int got;
+
+static void
+recv_thread(void *arg)
+{
+	int y;
+
+	if (chan_recv(chan, &y) == 0) {
+		got = y;
+	}
+}
+
+static void
+send_thread(void *arg)
+{
+	int x = 2;
+
+	chan_send(chan, &x);
+}
+
+static void
+test_kill(void)
+{
+	Tid killed, receiver;
+	int x = 1, y = 0;
+	bool ok;
+
+	chan = chan_create(0, sizeof(int));
+	got = 0;
+	killed = thread_create(recv_thread, NULL);
+	assert(thread_ret_ok(killed));
+	thread_yield(killed);
+	receiver = thread_create(recv_thread, NULL);
+	assert(thread_ret_ok(receiver));
+	thread_yield(receiver);
+	thread_kill(killed);
+	ok = chan_send(chan, &x) == 0;
+	thread_wait(receiver, NULL);
+	ok = ok && got == 1;
+
+	killed = thread_create(send_thread, NULL);
+	assert(thread_ret_ok(killed));
+	thread_yield(killed);
+	thread_kill(killed);
+	ok = ok && chan_try_recv(chan, &y) == THREAD_NONE && y == 0;
+	chan_destroy(chan);
+
+	if (ok) {
+		unintr_printf("test_chan: good, killed waiters taken off\n");
+	} else {
+		unintr_printf("test_chan: bad, killed waiters left on\n");
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	long start_mallocs, start_bytes;
+
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+	/* Enable preemption */
+	register_interrupt_handler(false);
+
+	unintr_printf("starting chan test\n");
+	start_mallocs = get_current_num_mallocs();
+	start_bytes = get_current_bytes_malloced();
+	test_nonblocking();
+	test_order();
+	test_stress(CAPACITY);
+	test_stress(0);
+	test_kill();
+	if (is_leak_free(start_mallocs, start_bytes)) {
+		unintr_printf("No memory leaks detected.\n");
+	} else {
+		unintr_printf("Detected memory leaks.\n");
+	}
+	unintr_printf("chan test done\n");
+	return 0;
+}
@@ -0,0 +1,286 @@
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * test_io tests thread_read, thread_write, thread_accept and thread_connect,
+ * with preemption enabled.
+ * 1. A thread reading from an empty pipe must only block itself: the
+ *    initial thread keeps running until it writes to the pipe. Once such a
+ *    reader is killed, the last thread can still exit the process.
+ * 2. A writer pushes NBYTES through a pipe, which holds much less, to a
+ *    reader. Every byte must arrive, in order.
+ * 3. A server thread accepts NCONNS loopback connections and starts an
+ *    echo thread for each, while NCONNS client threads connect, write a
+ *    message and read it back.
+ *****************************************************************************/
+
+#define NBYTES (1 << 20)
+#define NCONNS 400
+
+static int fds[2];
+static volatile int got;
+
+static void
+pipe_reader(void *arg)
+{
+	char c;
+
+	if (thread_read(fds[0], &c, 1) == 1 && c == 'x') {
+		got = 1;
+	}
+}
+
+static void
+test_block(void)
+{
+	long spins = 0;
+	Tid tid;
+
+	assert(pipe(fds) == 0);
+	tid = thread_create(pipe_reader, NULL);
+	assert(thread_ret_ok(tid));
+	/* the reader runs, blocks, and lets us go on */
+	while (spins < 1000) {
+		thread_yield(THREAD_ANY);
+		spins++;
+	}
+	assert(!got);
+	assert(thread_write(fds[1], "x", 1) == 1);
+	thread_wait(tid, NULL);
+	thread_close(fds[0]);
+	thread_close(fds[1]);
+
+	if (got) {
+		unintr_printf("test_io: good, a blocked read only blocks its "
+			      "thread\n");
+	} else {
+		unintr_printf("test_io: bad, read did not get the byte\n");
+	}
+}
+
+static void
+test_kill(void)
+{
+	int status = 0, i;
+	pid_t pid;
+	Tid tid;
+
+	/* or the child prints what is buffered again */
+	fflush(stdout);
+	pid = fork();
+	assert(pid >= 0);
+	if (pid == 0) {
+		assert(pipe(fds) == 0);
+		tid = thread_create(pipe_reader, NULL);
+		assert(thread_ret_ok(tid));
+		thread_yield(tid);
+		thread_kill(tid);
+		/* nothing waits for I/O any more, so this exits */
+		thread_exit(0);
+	}
+	for (i = 0; i < 500; i++) {
+		if (waitpid(pid, &status, WNOHANG) == pid) {
+			break;
+		}
+		usleep(10000);
+	}
+	/* the child runs the threads library, timers and all, so a crash in
+	 * it is told apart from the hang this checks for */
+	if (i == 500) {
+		kill(pid, SIGKILL);
+		waitpid(pid, &status, 0);
+		unintr_printf("test_io: bad, exit hangs after a reader is "
+			      "killed\n");
+	} else if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+		unintr_printf("test_io: good, exit after a reader is killed\n");
+	} else {
+		unintr_printf("test_io: bad, child exited with status %d after "
+			      "a reader is killed\n", status);
+	}
+}
+
+static void
+stream_writer(void *arg)
+{
+	unsigned char buf[4096];
+	int sent = 0, i, n;
+
+	while (sent < NBYTES) {
+		for (i = 0; i < sizeof(buf); i++) {
+			buf[i] = (sent + i) % 251;
+		}
+		n = thread_write(fds[1], buf, sizeof(buf));
+		assert(n > 0);
+		/* a short write starts the next block where it stopped */
+		sent += n;
+	}
+	thread_close(fds[1]);
+}
+
+static void
+test_stream(void)
+{
+	unsigned char buf[1000];
+	long received = 0, errors = 0;
+	int n, i;
+	Tid tid;
+
+	assert(pipe(fds) == 0);
+	tid = thread_create(stream_writer, NULL);
+	assert(thread_ret_ok(tid));
+	while ((n = thread_read(fds[0], buf, sizeof(buf))) > 0) {
+		for (i = 0; i < n; i++) {
+			if (buf[i] != (received + i) % 251) {
+				errors++;
+			}
+		}
+		received += n;
+	}
+	thread_wait(tid, NULL);
+	thread_close(fds[0]);
+
+	if (received == NBYTES && errors == 0) {
+		unintr_printf("test_io: good, %d bytes through a pipe\n",
+			      NBYTES);
+	} else {
+		unintr_printf("test_io: bad, %ld bytes, %ld wrong\n", received,
+			      errors);
+	}
+}
+
+static int listen_fd;
+static struct sockaddr_in server_addr;
+static int echoed;
+
+static void
+echo_thread(void *arg)
+{
+	int fd = (long)arg;
+	char buf[64];
+	int n;
+
+	while ((n = thread_read(fd, buf, sizeof(buf))) > 0) {
+		assert(thread_write(fd, buf, n) == n);
+	}
+	thread_close(fd);
+}
+
+static void
+server_thread(void *arg)
+{
+	Tid handlers[NCONNS];
+	int i;
+
+	for (i = 0; i < NCONNS; i++) {
+		int fd = thread_accept(listen_fd, NULL, NULL);
+		assert(fd >= 0);
+		handlers[i] = thread_create(echo_thread, (void *)(long)fd);
+		assert(thread_ret_ok(handlers[i]));
+	}
+	for (i = 0; i < NCONNS; i++) {
+		thread_wait(handlers[i], NULL);
+	}
+}
+
+static void
+client_thread(void *arg)
+{
+	char msg[32], buf[32];
+	struct linger linger = { 1, 0 };
+	int fd, len, n = 0, ret;
+
+	len = snprintf(msg, sizeof(msg), "hello %ld", (long)arg);
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	assert(fd >= 0);
+	ret = thread_connect(fd, (struct sockaddr *)&server_addr,
+			     sizeof(server_addr));
+	assert(ret == 0);
+	assert(thread_write(fd, msg, len) == len);
+	while (n < len && (ret = thread_read(fd, buf + n, len - n)) > 0) {
+		n += ret;
+	}
+	if (n == len && memcmp(buf, msg, len) == 0) {
+		__atomic_add_fetch(&echoed, 1, __ATOMIC_SEQ_CST);
+	}
+	/* reset rather than leave the port in TIME_WAIT, so that running the
+	 * test repeatedly does not use up the ephemeral ports */
+	setsockopt(fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+	thread_close(fd);
+}
+
+static void
+test_server(void)
+{
+	socklen_t len = sizeof(server_addr);
+	Tid server, clients[NCONNS];
+	long i;
+
+	listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	assert(listen_fd >= 0);
+	memset(&server_addr, 0, sizeof(server_addr));
+	server_addr.sin_family = AF_INET;
+	server_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	assert(bind(listen_fd, (struct sockaddr *)&server_addr, len) == 0);
+	assert(getsockname(listen_fd, (struct sockaddr *)&server_addr,
+			   &len) == 0);
+	assert(listen(listen_fd, NCONNS) == 0);
+
+	server = thread_create(server_thread, NULL);
+	assert(thread_ret_ok(server));
+	for (i = 0; i < NCONNS; i++) {
+		clients[i] = thread_create(client_thread, (void *)i);
+		assert(thread_ret_ok(clients[i]));
+	}
+	for (i = 0; i < NCONNS; i++) {
+		thread_wait(clients[i], NULL);
+	}
+	thread_wait(server, NULL);
+	thread_close(listen_fd);
+
+	if (echoed == NCONNS) {
+		unintr_printf("test_io: good, %d connections echoed\n",
+			      NCONNS);
+	} else {
+		unintr_printf("test_io: bad, %d of %d connections echoed\n",
+			      echoed, NCONNS);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	long start_mallocs, start_bytes;
+
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+	/* Enable preemption */
+	register_interrupt_handler(false);
+
+	unintr_printf("starting io test\n");
+	start_mallocs = get_current_num_mallocs();
+	start_bytes = get_current_bytes_malloced();
+	test_block();
+	test_kill();
+	test_stream();
+	test_server();
+	if (is_leak_free(start_mallocs, start_bytes)) {
+		unintr_printf("No memory leaks detected.\n");
+	} else {
+		unintr_printf("Detected memory leaks.\n");
+	}
+	unintr_printf("io test done\n");
+	return 0;
+}
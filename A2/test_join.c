@@ -0,0 +1,306 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+#include "slab.h"
+
+/******************************************************************************
+ * test_join checks thread_join, detached threads and futures.
+ * 1. Many threads join one thread at once, and all get the value it exits
+ *    with. It can be joined again after it ended, and thread_wait still
+ *    collects its exit code.
+ * 2. The joiners of a thread that is killed get THREAD_FAILED.
+ * 3. A detached thread that is killed is reaped at once, and one that exits
+ *    is reaped by the next thread to run, even a new one.
+ * 4. Futures fan out NFUTURES tasks, and one call gathers their results. A
+ *    task that is killed shows up as a failure.
+ * 5. Once the initial thread has exited and been reaped, Tid 0 cannot be
+ *    killed, though it can still be joined.
+ *****************************************************************************/
+
+#define NJOINERS 16
+#define NFUTURES 100
+
+static struct wait_queue *queue;
+static int token;
+static Tid target;
+static int joined, failed;
+static long in_use;
+
+static void
+exit_value_thread(void *arg)
+{
+	thread_sleep_for(1000);
+	thread_exit_value(&token);
+}
+
+static void
+sleeper_thread(void *arg)
+{
+	bool enabled = interrupts_off();
+	thread_sleep(queue);
+	interrupts_set(enabled);
+}
+
+static void
+joiner_thread(void *arg)
+{
+	void *value;
+	Tid ret = thread_join(target, &value);
+
+	if (ret == target && value == &token) {
+		joined++;
+	} else if (ret == THREAD_FAILED && value == NULL) {
+		failed++;
+	}
+}
+
+static void
+nothing_thread(void *arg)
+{
+}
+
+static long
+threads_in_use(void)
+{
+	struct slab_stats stats;
+	int ret = slab_get_stats("thread", &stats);
+
+	assert(ret == 0);
+	return stats.in_use;
+}
+
+static void
+count_thread(void *arg)
+{
+	in_use = threads_in_use();
+}
+
+static void
+fan_out(void (*fn)(void *))
+{
+	int i;
+	Tid ret;
+
+	target = thread_create(fn, NULL);
+	assert(thread_ret_ok(target));
+	joined = 0;
+	failed = 0;
+	for (i = 0; i < NJOINERS; i++) {
+		ret = thread_create(joiner_thread, NULL);
+		assert(thread_ret_ok(ret));
+	}
+	/* let the joiners start waiting */
+	thread_yield(THREAD_ANY);
+	while (thread_yield(THREAD_ANY) != THREAD_NONE)
+		;
+}
+
+static void
+test_join(void)
+{
+	void *value;
+	int code;
+
+	fan_out(exit_value_thread);
+	joiner_thread(NULL);
+	while (thread_yield(THREAD_ANY) != THREAD_NONE)
+		;
+	if (joined == NJOINERS + 1) {
+		unintr_printf("test_join: good, %d threads joined one\n",
+			      joined);
+	} else {
+		unintr_printf("test_join: bad, %d of %d joins\n", joined,
+			      NJOINERS + 1);
+	}
+	if (thread_join(target, &value) == target && value == &token &&
+	    thread_wait(target, &code) == target && code == 0 &&
+	    thread_join(target, NULL) == target) {
+		unintr_printf("test_join: good, ended thread joined again\n");
+	} else {
+		unintr_printf("test_join: bad, ended thread not joined\n");
+	}
+	if (thread_join(thread_id(), NULL) == THREAD_INVALID &&
+	    thread_join(-1, NULL) == THREAD_INVALID) {
+		unintr_printf("test_join: good, invalid joins refused\n");
+	} else {
+		unintr_printf("test_join: bad, invalid joins accepted\n");
+	}
+}
+
+static void
+test_kill(void)
+{
+	Tid ret;
+
+	queue = wait_queue_create();
+	fan_out(sleeper_thread);
+	ret = thread_kill(target);
+	assert(ret == target);
+	while (thread_yield(THREAD_ANY) != THREAD_NONE)
+		;
+	if (failed == NJOINERS &&
+	    thread_join(target, NULL) == THREAD_FAILED) {
+		unintr_printf("test_join: good, joiners of a killed thread "
+			      "failed\n");
+	} else {
+		unintr_printf("test_join: bad, %d of %d joins failed\n",
+			      failed, NJOINERS);
+	}
+	wait_queue_destroy(queue);
+}
+
+static void
+test_detached(void)
+{
+	struct thread_attr attr;
+	long before = threads_in_use();
+	Tid ret, counter;
+
+	thread_attr_init(&attr);
+	attr.detached = true;
+	ret = thread_create_attr(nothing_thread, NULL, &attr);
+	assert(thread_ret_ok(ret));
+	thread_kill(ret);
+	if (threads_in_use() == before &&
+	    thread_join(ret, NULL) == THREAD_INVALID) {
+		unintr_printf("test_join: good, killed detached thread "
+			      "reaped at once\n");
+	} else {
+		unintr_printf("test_join: bad, killed detached thread kept\n");
+	}
+
+	/* the detached thread exits, and switches to the new one */
+	ret = thread_create_attr(nothing_thread, NULL, &attr);
+	assert(thread_ret_ok(ret));
+	counter = thread_create(count_thread, NULL);
+	assert(thread_ret_ok(counter));
+	thread_yield(ret);
+	thread_wait(counter, NULL);
+	if (in_use == before + 1) {
+		unintr_printf("test_join: good, exited detached thread "
+			      "reaped by a new thread\n");
+	} else {
+		unintr_printf("test_join: bad, %ld threads in use\n", in_use);
+	}
+}
+
+static void *
+square_task(void *arg)
+{
+	long n = (long)arg;
+
+	thread_yield(THREAD_ANY);
+	return (void *)(n * n);
+}
+
+static void *
+stuck_task(void *arg)
+{
+	bool enabled = interrupts_off();
+
+	target = thread_id();
+	thread_sleep(queue);
+	interrupts_set(enabled);
+	return arg;
+}
+
+static void
+test_futures(void)
+{
+	struct thread_future *futures[NFUTURES + 1];
+	void *values[NFUTURES + 1];
+	long before = threads_in_use();
+	int i, bad = 0, ret;
+	void *value;
+
+	for (i = 0; i < NFUTURES; i++) {
+		futures[i] = thread_future_create(square_task, (void *)(long)i);
+		assert(futures[i]);
+	}
+	ret = thread_future_gather(futures, NFUTURES, values);
+	for (i = 0; i < NFUTURES; i++) {
+		if ((long)values[i] != (long)i * i) {
+			bad++;
+		}
+	}
+	if (ret == 0 && bad == 0 &&
+	    thread_future_get(futures[7], &value) == 0 && (long)value == 49) {
+		unintr_printf("test_join: good, %d futures gathered\n",
+			      NFUTURES);
+	} else {
+		unintr_printf("test_join: bad, %d futures wrong\n", bad);
+	}
+	while (thread_yield(THREAD_ANY) != THREAD_NONE)
+		;
+	if (threads_in_use() == before) {
+		unintr_printf("test_join: good, future threads reaped\n");
+	} else {
+		unintr_printf("test_join: bad, future threads kept\n");
+	}
+
+	/* one of the tasks gets killed */
+	queue = wait_queue_create();
+	futures[NFUTURES] = thread_future_create(stuck_task, NULL);
+	assert(futures[NFUTURES]);
+	thread_yield(THREAD_ANY);
+	thread_kill(target);
+	ret = thread_future_gather(futures + NFUTURES - 1, 2, values);
+	if (ret == 1 && values[1] == NULL &&
+	    thread_future_get(futures[NFUTURES], NULL) == THREAD_FAILED) {
+		unintr_printf("test_join: good, killed task failed\n");
+	} else {
+		unintr_printf("test_join: bad, killed task gathered\n");
+	}
+	wait_queue_destroy(queue);
+
+	for (i = 0; i <= NFUTURES; i++) {
+		thread_future_destroy(futures[i]);
+	}
+}
+
+static void
+last_thread(void *arg)
+{
+	/* the initial thread exited before the switch here, and is gone */
+	thread_yield(THREAD_ANY);
+	if (thread_kill(0) == THREAD_INVALID &&
+	    thread_join(0, NULL) == 0) {
+		unintr_printf("test_join: good, exited initial thread "
+			      "refused\n");
+	} else {
+		unintr_printf("test_join: bad, exited initial thread "
+			      "accepted\n");
+	}
+	unintr_printf("join test done\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	long start_mallocs, start_bytes;
+
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+
+	unintr_printf("starting join test\n");
+	start_mallocs = get_current_num_mallocs();
+	start_bytes = get_current_bytes_malloced();
+	test_join();
+	test_kill();
+	test_detached();
+	test_futures();
+	if (is_leak_free(start_mallocs, start_bytes)) {
+		unintr_printf("No memory leaks detected.\n");
+	} else {
+		unintr_printf("Detected memory leaks.\n");
+	}
+	thread_create(last_thread, NULL);
+	thread_exit(0);
+	return 0;
+}
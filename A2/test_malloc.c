@@ -0,0 +1,141 @@
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * test_malloc checks the malloc369 tracking itself.
+ * 1. Over many rounds of allocations of random sizes, freed in random order,
+ *    the counters match exactly what is outstanding.
+ * 2. Freed allocations leave the map. With MALLOC369_FAST, a steady number
+ *    of live allocations keeps the map the same size however many rounds
+ *    run, and only a sample of them is in it.
+ * 3. Freeing a pointer twice aborts. This runs in a child process, since the
+ *    abort kills it.
+ *****************************************************************************/
+
+#define NROUNDS 200
+#define NPTRS 1000
+#define MAXSIZE 4096
+
+static void *ptrs[NPTRS];
+static size_t sizes[NPTRS];
+
+static void
+test_counters(void)
+{
+	long start_mallocs, start_bytes, start_tracked, bytes, tracked, buckets;
+	int round, i, j;
+	bool exact = true;
+#ifdef MALLOC369_FAST
+	long buckets1 = 0;
+#endif
+
+	start_mallocs = get_current_num_mallocs();
+	start_bytes = get_current_bytes_malloced();
+	start_tracked = get_num_tracked(NULL);
+	for (round = 0; round < NROUNDS; round++) {
+		bytes = 0;
+		for (i = 0; i < NPTRS; i++) {
+			sizes[i] = 1 + random() % MAXSIZE;
+			ptrs[i] = malloc369(sizes[i]);
+			assert(ptrs[i]);
+			bytes += sizes[i];
+		}
+		if (get_current_num_mallocs() - start_mallocs != NPTRS ||
+		    get_current_bytes_malloced() - start_bytes != bytes) {
+			exact = false;
+		}
+		tracked = get_num_tracked(&buckets) - start_tracked;
+#ifdef MALLOC369_FAST
+		/* one in MALLOC369_SAMPLE, give or take the rounding */
+		if (tracked > NPTRS / 2) {
+			unintr_printf("test_malloc: bad, %ld of %d tracked\n",
+				      tracked, NPTRS);
+		}
+		if (round == 0) {
+			buckets1 = buckets;
+		} else if (buckets > buckets1) {
+			unintr_printf("test_malloc: bad, map grew from %ld to "
+				      "%ld buckets\n", buckets1, buckets);
+			buckets1 = buckets;
+		}
+#else
+		if (tracked != NPTRS) {
+			unintr_printf("test_malloc: bad, %ld of %d tracked\n",
+				      tracked, NPTRS);
+		}
+#endif
+
+		/* free in random order */
+		for (i = NPTRS - 1; i >= 0; i--) {
+			j = random() % (i + 1);
+			free369(ptrs[j]);
+			bytes -= sizes[j];
+			ptrs[j] = ptrs[i];
+			sizes[j] = sizes[i];
+			if (get_current_bytes_malloced() - start_bytes != bytes) {
+				exact = false;
+			}
+		}
+		if (!is_leak_free(start_mallocs, start_bytes) ||
+		    get_num_tracked(NULL) != start_tracked) {
+			exact = false;
+		}
+	}
+	free369(NULL);
+	if (exact) {
+		unintr_printf("test_malloc: good, counters exact\n");
+	} else {
+		unintr_printf("test_malloc: bad, counters off\n");
+	}
+}
+
+static void
+test_double_free(void)
+{
+	int status;
+	pid_t pid;
+	void *p;
+
+	pid = fork();
+	assert(pid >= 0);
+	if (pid == 0) {
+		/* don't let the fatal handlers catch the abort, and keep
+		 * malloc's complaint out of the output */
+		signal(SIGABRT, SIG_DFL);
+		dup2(open("/dev/null", O_WRONLY), STDERR_FILENO);
+		p = malloc369(64);
+		free369(p);
+		free369(p);
+		_exit(0);
+	}
+	assert(waitpid(pid, &status, 0) == pid);
+	if (WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT) {
+		unintr_printf("test_malloc: good, double free aborts\n");
+	} else {
+		unintr_printf("test_malloc: bad, double free did not abort\n");
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+
+	unintr_printf("starting malloc test\n");
+	test_counters();
+	test_double_free();
+	unintr_printf("malloc test done\n");
+	return 0;
+}
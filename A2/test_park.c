@@ -0,0 +1,172 @@
+#include <limits.h>
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * test_park tests thread_park and thread_unpark, with preemption enabled.
+ * 1. thread_park returns at once when the word does not hold the expected
+ *    value, and thread_park_timeout times out when nobody unparks it.
+ * 2. NTHREADS threads increment a counter under a mutex that is a single int
+ *    (unlocked, locked, or locked with waiters), parking while it is taken.
+ *    No increment may be lost.
+ * 3. NWAITERS threads park on a word. thread_unpark(word, n) must wake
+ *    exactly n of them.
+ * The parking lot must not leak the queues it creates while threads park.
+ *****************************************************************************/
+
+#define NINCREMENTS 100 /* per thread */
+#define NWAITERS 32
+
+/* a mutex in one word: 0 is unlocked, 1 locked, 2 locked with waiters */
+static int mutex;
+static unsigned long counter;
+
+static int
+cas(int *word, int old, int new)
+{
+	__atomic_compare_exchange_n(word, &old, new, false, __ATOMIC_SEQ_CST,
+				    __ATOMIC_SEQ_CST);
+	return old;
+}
+
+static void
+mutex_lock(int *m)
+{
+	int c = cas(m, 0, 1);
+
+	if (c == 0) {
+		return;
+	}
+	do {
+		if (c == 2 || cas(m, 1, 2) != 0) {
+			thread_park(m, 2);
+		}
+	} while ((c = cas(m, 0, 2)) != 0);
+}
+
+static void
+mutex_unlock(int *m)
+{
+	if (__atomic_exchange_n(m, 0, __ATOMIC_SEQ_CST) == 2) {
+		thread_unpark(m, 1);
+	}
+}
+
+static void
+counter_thread(void *arg)
+{
+	int i;
+
+	for (i = 0; i < NINCREMENTS; i++) {
+		mutex_lock(&mutex);
+		unsigned long c = counter;
+		thread_yield(THREAD_ANY);
+		counter = c + 1;
+		mutex_unlock(&mutex);
+	}
+}
+
+static int gate;
+static volatile int passed;
+
+static void
+waiter_thread(void *arg)
+{
+	thread_park(&gate, 0);
+	__atomic_add_fetch(&passed, 1, __ATOMIC_SEQ_CST);
+}
+
+/* yield until nothing else can run, i.e. until all the waiters sleep */
+static void
+settle(void)
+{
+	while (thread_yield(THREAD_ANY) != THREAD_NONE)
+		;
+}
+
+int
+main(int argc, char **argv)
+{
+	long start_mallocs, start_bytes;
+	Tid result[NTHREADS];
+	int word = 1;
+	int i, ret;
+
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+	/* Enable preemption */
+	register_interrupt_handler(false);
+
+	unintr_printf("starting park test\n");
+	start_mallocs = get_current_num_mallocs();
+	start_bytes = get_current_bytes_malloced();
+
+	/* 1. value mismatch and timeout */
+	ret = thread_park(&word, 0);
+	if (ret == 0) {
+		unintr_printf("test_park: good, no park on a changed word\n");
+	} else {
+		unintr_printf("test_park: bad, park returned %d\n", ret);
+	}
+	ret = thread_park_timeout(&word, 1, 1000);
+	if (ret == THREAD_TIMEDOUT && thread_unpark(&word, 1) == 0) {
+		unintr_printf("test_park: good, park timed out\n");
+	} else {
+		unintr_printf("test_park: bad, timed park returned %d\n", ret);
+	}
+
+	/* 2. a one word mutex */
+	for (i = 0; i < NTHREADS; i++) {
+		result[i] = thread_create(counter_thread, NULL);
+		assert(thread_ret_ok(result[i]));
+	}
+	for (i = 0; i < NTHREADS; i++) {
+		thread_wait(result[i], NULL);
+	}
+	if (counter == (unsigned long)NTHREADS * NINCREMENTS && mutex == 0) {
+		unintr_printf("test_park: good, counter is %lu\n", counter);
+	} else {
+		unintr_printf("test_park: bad, counter is %lu, expected %lu\n",
+			      counter, (unsigned long)NTHREADS * NINCREMENTS);
+	}
+
+	/* 3. thread_unpark(addr, n) */
+	for (i = 0; i < NWAITERS; i++) {
+		result[i] = thread_create(waiter_thread, NULL);
+		assert(thread_ret_ok(result[i]));
+	}
+	settle();
+	assert(passed == 0);
+	ret = thread_unpark(&gate, NWAITERS / 4);
+	settle();
+	if (ret == NWAITERS / 4 && passed == NWAITERS / 4) {
+		unintr_printf("test_park: good, unpark woke %d\n", passed);
+	} else {
+		unintr_printf("test_park: bad, unpark woke %d, expected %d\n",
+			      passed, NWAITERS / 4);
+	}
+	ret = thread_unpark(&gate, INT_MAX);
+	for (i = 0; i < NWAITERS; i++) {
+		thread_wait(result[i], NULL);
+	}
+	if (ret == NWAITERS - NWAITERS / 4 && thread_unpark(&gate, 1) == 0) {
+		unintr_printf("test_park: good, unpark woke the rest\n");
+	} else {
+		unintr_printf("test_park: bad, unpark woke %d\n", ret);
+	}
+
+	if (is_leak_free(start_mallocs, start_bytes)) {
+		unintr_printf("No memory leaks detected.\n");
+	} else {
+		unintr_printf("Detected memory leaks.\n");
+	}
+	unintr_printf("park test done\n");
+	return 0;
+}
@@ -0,0 +1,255 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * test_prio checks the prio policy, with preemption enabled.
+ * 1. Threads created with different priorities run in order of priority.
+ * 2. A low priority thread holding a lock inherits the priority of a high
+ *    priority thread waiting for it, and drops it on release.
+ * 3. Priority inversion: a low priority thread holds a lock, medium priority
+ *    threads use all of the CPU, and a high priority thread wants the lock.
+ *    The low priority thread must inherit the high priority, finish its
+ *    critical section and hand the lock over, despite the medium threads.
+ * 4. A thread that is killed while it holds a lock hands it to its waiter,
+ *    and the lock can be taken again afterwards.
+ *****************************************************************************/
+
+#define LOW 5
+#define MEDIUM 16
+#define HIGH 25
+#define NMEDIUM 4
+#define HOLD_USECS 20000 /* low thread's critical section */
+
+static struct lock *testlock;
+static int order[4];
+static int norder;
+
+static long
+now_usecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+static void
+record_thread(void *arg)
+{
+	order[norder++] = thread_getprio(THREAD_SELF);
+}
+
+static void
+test_order(void)
+{
+	int prios[4] = { 10, 25, 5, 20 };
+	int i;
+
+	/* nothing can run before the caller is done creating threads */
+	thread_setprio(THREAD_SELF, THREAD_PRIO_MAX);
+	for (i = 0; i < 4; i++) {
+		Tid ret = thread_create_prio(record_thread, NULL, prios[i]);
+		assert(thread_ret_ok(ret));
+	}
+	thread_setprio(THREAD_SELF, THREAD_PRIO_MIN);
+	while (norder < 4) {
+		thread_yield(THREAD_ANY);
+	}
+	thread_setprio(THREAD_SELF, THREAD_PRIO_DEFAULT);
+
+	if (order[0] == 25 && order[1] == 20 && order[2] == 10 && order[3] == 5) {
+		unintr_printf("test_prio: good, threads ran in priority order\n");
+	} else {
+		unintr_printf("test_prio: bad, threads ran as %d %d %d %d\n",
+			      order[0], order[1], order[2], order[3]);
+	}
+}
+
+static volatile int holding, release, got_lock;
+static int after_release;
+
+static void
+holder_thread(void *arg)
+{
+	lock_acquire(testlock);
+	holding = 1;
+	while (!release) {
+		thread_yield(THREAD_ANY);
+	}
+	lock_release(testlock);
+	after_release = thread_getprio(THREAD_SELF);
+}
+
+static void
+waiter_thread(void *arg)
+{
+	lock_acquire(testlock);
+	got_lock = 1;
+	lock_release(testlock);
+}
+
+static void
+test_inherit(void)
+{
+	Tid low, high;
+	int before, boosted;
+
+	low = thread_create_prio(holder_thread, NULL, LOW);
+	assert(thread_ret_ok(low));
+	while (!holding) {
+		thread_yield(THREAD_ANY);
+	}
+	before = thread_getprio(low);
+	high = thread_create_prio(waiter_thread, NULL, HIGH);
+	assert(thread_ret_ok(high));
+	while (thread_getprio(low) == LOW) {
+		thread_yield(high);
+	}
+	boosted = thread_getprio(low);
+	release = 1;
+	thread_wait(high, NULL);
+	thread_wait(low, NULL);
+
+	if (before == LOW && boosted == HIGH && after_release == LOW &&
+	    got_lock) {
+		unintr_printf("test_prio: good, lock holder inherited priority "
+			      "%d\n", boosted);
+	} else {
+		unintr_printf("test_prio: bad, lock holder ran at %d, %d, %d\n",
+			      before, boosted, after_release);
+	}
+}
+
+static volatile int stop;
+static long waited;
+
+static void
+low_thread(void *arg)
+{
+	lock_acquire(testlock);
+	holding = 1;
+	spin(HOLD_USECS);
+	lock_release(testlock);
+}
+
+static void
+medium_thread(void *arg)
+{
+	long start = now_usecs();
+
+	/* give up after a second, so a failure does not hang the test */
+	while (!stop && now_usecs() - start < 1000000)
+		;
+}
+
+static void
+high_thread(void *arg)
+{
+	long start;
+
+	thread_sleep_for(1000);
+	start = now_usecs();
+	lock_acquire(testlock);
+	waited = now_usecs() - start;
+	lock_release(testlock);
+}
+
+static void
+test_inversion(void)
+{
+	Tid low, high, medium[NMEDIUM];
+	int i;
+
+	thread_setprio(THREAD_SELF, THREAD_PRIO_MAX);
+	holding = 0;
+	low = thread_create_prio(low_thread, NULL, LOW);
+	assert(thread_ret_ok(low));
+	while (!holding) {
+		thread_yield(low);
+	}
+	for (i = 0; i < NMEDIUM; i++) {
+		medium[i] = thread_create_prio(medium_thread, NULL, MEDIUM);
+		assert(thread_ret_ok(medium[i]));
+	}
+	high = thread_create_prio(high_thread, NULL, HIGH);
+	assert(thread_ret_ok(high));
+	thread_wait(high, NULL);
+	stop = 1;
+	for (i = 0; i < NMEDIUM; i++) {
+		thread_wait(medium[i], NULL);
+	}
+	thread_wait(low, NULL);
+
+	if (waited < HOLD_USECS + 100000) {
+		unintr_printf("test_prio: good, no priority inversion\n");
+	} else {
+		unintr_printf("test_prio: bad, high priority thread waited "
+			      "%ld usecs for the lock\n", waited);
+	}
+}
+
+static void
+dead_holder_thread(void *arg)
+{
+	lock_acquire(testlock);
+	holding = 1;
+	thread_sleep_for(10000000);
+	lock_release(testlock);
+}
+
+static void
+test_kill_holder(void)
+{
+	Tid low, high;
+
+	holding = 0;
+	got_lock = 0;
+	low = thread_create_prio(dead_holder_thread, NULL, LOW);
+	assert(thread_ret_ok(low));
+	while (!holding) {
+		thread_yield(THREAD_ANY);
+	}
+	high = thread_create_prio(waiter_thread, NULL, HIGH);
+	assert(thread_ret_ok(high));
+	thread_yield(high);
+	thread_kill(low);
+	thread_wait(high, NULL);
+	/* nobody holds it now */
+	lock_acquire(testlock);
+	lock_release(testlock);
+	if (got_lock) {
+		unintr_printf("test_prio: good, killed holder handed the lock "
+			      "on\n");
+	} else {
+		unintr_printf("test_prio: bad, killed holder kept the lock\n");
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	int ret;
+
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library with priority scheduling */
+	ret = thread_init_sched("prio");
+	assert(!ret);
+	/* Enable preemption */
+	register_interrupt_handler(false);
+
+	unintr_printf("starting prio test\n");
+	testlock = lock_create();
+	test_order();
+	test_inherit();
+	test_inversion();
+	test_kill_holder();
+	lock_destroy(testlock);
+	unintr_printf("prio test done\n");
+	return 0;
+}
@@ -0,0 +1,131 @@
+#include <sys/wait.h>
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * test_quantum checks the timer interrupts.
+ * 1. A thread running alone should not be interrupted more than once: the
+ *    first tick finds nothing else to run and stops the ticks.
+ * 2. With a second runnable thread, the ticks start again, and arrive once
+ *    per quantum, for a quantum of 1000 and of SIG_INTERVAL usecs. Ticks
+ *    that the kernel merges into one signal, when the process does not
+ *    get to run in time, are still counted.
+ * 3. Once the second thread has exited, the ticks stop again.
+ * 4. A child forked while the ticks are stopped gets timers of its own: they
+ *    start again once it creates a thread.
+ *****************************************************************************/
+
+#define DURATION 100000 /* usecs to run each part for */
+
+static volatile int stop;
+
+static void
+busy_thread(void *arg)
+{
+	while (!stop)
+		;
+}
+
+/* spins for DURATION and returns the number of ticks seen meanwhile */
+static unsigned long
+count_ticks(void)
+{
+	unsigned long before = interrupts_ticks();
+	spin(DURATION);
+	return interrupts_ticks() - before;
+}
+
+static void
+check_ticks(const char *what, unsigned long ticks, unsigned long lo,
+	    unsigned long hi)
+{
+	if (ticks >= lo && ticks <= hi) {
+		unintr_printf("test_quantum: good, %s\n", what);
+	} else {
+		unintr_printf("test_quantum: bad, %s: %lu ticks, "
+			      "expected %lu to %lu\n", what, ticks, lo, hi);
+	}
+}
+
+static void
+test_fork(void)
+{
+	int status;
+	pid_t pid;
+	Tid ret;
+
+	/* or the child prints what is buffered again */
+	fflush(stdout);
+	pid = fork();
+	assert(pid >= 0);
+	if (pid == 0) {
+		stop = 0;
+		ret = thread_create(busy_thread, NULL);
+		assert(thread_ret_ok(ret));
+		_exit(count_ticks() > 0 ? 0 : 1);
+	}
+	assert(waitpid(pid, &status, 0) == pid);
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+		unintr_printf("test_quantum: good, forked child gets ticks\n");
+	} else {
+		unintr_printf("test_quantum: bad, forked child status %d\n",
+			      status);
+	}
+}
+
+static void
+test_quantum(void)
+{
+	unsigned long expected;
+	Tid ret;
+
+	unintr_printf("starting quantum test\n");
+
+	/* 1. alone. the tick that stops the ticks may come late, and count
+	 * the expirations it was merged with (see interrupts_ticks) */
+	check_ticks("lone thread is not interrupted", count_ticks(), 0, 4);
+
+	/* 2. two threads */
+	ret = thread_create(busy_thread, NULL);
+	assert(thread_ret_ok(ret));
+	interrupts_set_quantum(1000);
+	assert(interrupts_get_quantum() == 1000);
+	expected = DURATION / 1000;
+	check_ticks("ticks every 1000 usecs", count_ticks(), expected / 2,
+		    expected * 3 / 2);
+	interrupts_set_quantum(SIG_INTERVAL);
+	expected = DURATION / SIG_INTERVAL;
+	check_ticks("ticks every SIG_INTERVAL usecs", count_ticks(),
+		    expected / 2, expected * 3 / 2);
+
+	/* 3. alone again */
+	stop = 1;
+	while (thread_yield(THREAD_ANY) != THREAD_NONE)
+		;
+	count_ticks();
+	check_ticks("ticks stop after the thread exits", count_ticks(), 0, 4);
+
+	/* 4. in a child */
+	test_fork();
+
+	unintr_printf("quantum test done\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+	/* Enable preemption */
+	register_interrupt_handler(false);
+
+	test_quantum();
+	return 0;
+}
@@ -0,0 +1,230 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * test_rwlock stress tests the reader-writer locks, with preemption enabled.
+ * 1. For each preference, NTHREADS threads read (90%) or write (10%) under
+ *    the lock, yielding inside their critical sections. A writer must always
+ *    be alone, and several readers should share the lock at some point.
+ * 2. With writer preference, a writer must get the lock even though readers
+ *    keep holding it in turn.
+ * 3. With writer preference, readers queued behind a writer that is killed
+ *    while it waits must still get the lock.
+ *****************************************************************************/
+
+#define NOPS 200 /* per thread */
+
+static struct rwlock *testlock;
+/* readers share the lock and can be preempted, so these are atomic */
+static int nreaders, nwriters;
+static int max_readers;
+static int errors;
+
+static int
+get(int *counter)
+{
+	return __atomic_load_n(counter, __ATOMIC_SEQ_CST);
+}
+
+static int
+add(int *counter, int n)
+{
+	return __atomic_add_fetch(counter, n, __ATOMIC_SEQ_CST);
+}
+
+static void
+rwlock_thread(void *arg)
+{
+	int i;
+
+	for (i = 0; i < NOPS; i++) {
+		if (random() % 10 == 0) {
+			rwlock_write_acquire(testlock);
+			int n = add(&nwriters, 1);
+			if (n != 1 || get(&nreaders) != 0) {
+				add(&errors, 1);
+			}
+			thread_yield(THREAD_ANY);
+			n = add(&nwriters, -1);
+			if (n != 0 || get(&nreaders) != 0) {
+				add(&errors, 1);
+			}
+			rwlock_write_release(testlock);
+		} else {
+			rwlock_read_acquire(testlock);
+			int n = add(&nreaders, 1);
+			if (get(&nwriters) != 0) {
+				add(&errors, 1);
+			}
+			/* only a hint, so a lost update does not matter */
+			if (n > max_readers) {
+				max_readers = n;
+			}
+			thread_yield(THREAD_ANY);
+			if (get(&nwriters) != 0) {
+				add(&errors, 1);
+			}
+			add(&nreaders, -1);
+			rwlock_read_release(testlock);
+		}
+	}
+}
+
+static volatile int stop;
+
+static void
+reader_thread(void *arg)
+{
+	while (!stop) {
+		rwlock_read_acquire(testlock);
+		thread_yield(THREAD_ANY);
+		rwlock_read_release(testlock);
+	}
+}
+
+static void
+test_stress(bool prefer_writers)
+{
+	Tid result[NTHREADS];
+	int i;
+
+	testlock = rwlock_create(prefer_writers);
+	nreaders = nwriters = max_readers = errors = 0;
+	for (i = 0; i < NTHREADS; i++) {
+		result[i] = thread_create(rwlock_thread, NULL);
+		assert(thread_ret_ok(result[i]));
+	}
+	for (i = 0; i < NTHREADS; i++) {
+		thread_wait(result[i], NULL);
+	}
+	rwlock_destroy(testlock);
+
+	if (errors == 0 && max_readers > 1) {
+		unintr_printf("test_rwlock: good, %s preference, up to %d "
+			      "readers at once\n",
+			      prefer_writers ? "writer" : "reader", max_readers);
+	} else {
+		unintr_printf("test_rwlock: bad, %s preference, %d errors, up "
+			      "to %d readers at once\n",
+			      prefer_writers ? "writer" : "reader", errors,
+			      max_readers);
+	}
+}
+
+static void
+test_writer_preference(void)
+{
+	Tid result[8];
+	int i;
+
+	testlock = rwlock_create(true);
+	stop = 0;
+	for (i = 0; i < 8; i++) {
+		result[i] = thread_create(reader_thread, NULL);
+		assert(thread_ret_ok(result[i]));
+	}
+	thread_yield(THREAD_ANY);
+	/* the readers overlap, so without writer preference the lock would
+	 * never be free for a writer */
+	rwlock_write_acquire(testlock);
+	stop = 1;
+	rwlock_write_release(testlock);
+	for (i = 0; i < 8; i++) {
+		thread_wait(result[i], NULL);
+	}
+	rwlock_destroy(testlock);
+	unintr_printf("test_rwlock: good, writer was not starved\n");
+}
+
+static volatile int got;
+
+static void
+writer_thread(void *arg)
+{
+	rwlock_write_acquire(testlock);
+	rwlock_write_release(testlock);
+}
+
+static void
+blocked_reader_thread(void *arg)
+{
+	rwlock_read_acquire(testlock);
+	got++;
+	rwlock_read_release(testlock);
+}
+
+/* queue a writer, then a reader behind it, while the lock is held for
+ * writing (or reading), and kill the writer */
+static int
+kill_writer(bool write)
+{
+	Tid writer, reader;
+
+	got = 0;
+	if (write) {
+		rwlock_write_acquire(testlock);
+	} else {
+		rwlock_read_acquire(testlock);
+	}
+	writer = thread_create(writer_thread, NULL);
+	assert(thread_ret_ok(writer));
+	thread_yield(writer);
+	reader = thread_create(blocked_reader_thread, NULL);
+	assert(thread_ret_ok(reader));
+	thread_yield(reader);
+	thread_kill(writer);
+	if (write) {
+		rwlock_write_release(testlock);
+	} else {
+		rwlock_read_release(testlock);
+	}
+	thread_wait(reader, NULL);
+	return got;
+}
+
+static void
+test_killed_writer(void)
+{
+	testlock = rwlock_create(true);
+	if (kill_writer(true) && kill_writer(false)) {
+		unintr_printf("test_rwlock: good, readers get past a killed "
+			      "writer\n");
+	} else {
+		unintr_printf("test_rwlock: bad, readers stuck behind a killed "
+			      "writer\n");
+	}
+	rwlock_destroy(testlock);
+}
+
+int
+main(int argc, char **argv)
+{
+	long start_mallocs, start_bytes;
+
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+	/* Enable preemption */
+	register_interrupt_handler(false);
+
+	unintr_printf("starting rwlock test\n");
+	start_mallocs = get_current_num_mallocs();
+	start_bytes = get_current_bytes_malloced();
+	test_stress(false);
+	test_stress(true);
+	test_writer_preference();
+	test_killed_writer();
+	if (is_leak_free(start_mallocs, start_bytes)) {
+		unintr_printf("No memory leaks detected.\n");
+	} else {
+		unintr_printf("Detected memory leaks.\n");
+	}
+	unintr_printf("rwlock test done\n");
+	return 0;
+}
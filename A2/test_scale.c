@@ -0,0 +1,163 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+#include "stack.h"
+
+/******************************************************************************
+ * test_scale checks that the thread table grows past THREAD_MAX_THREADS.
+ * 1. thread_set_max_threads only accepts limits between the current one and
+ *    THREAD_TABLE_MAX.
+ * 2. NSCALE threads are created, all sleep at once, and are joined, each
+ *    returning its own exit code. One more thread than the limit allows
+ *    fails with THREAD_NOMORE.
+ * 3. A Tid whose slot has been given to a new thread is stale, and is
+ *    rejected rather than referring to the new thread, as are THREAD_ANY
+ *    and THREAD_SELF.
+ * 4. Once the threads are gone, so are their stacks, beyond what the stack
+ *    pool keeps.
+ *****************************************************************************/
+
+#define NSCALE 100000
+#define SLEEP_USECS 10000
+
+static Tid tids[NSCALE];
+
+static void
+sleeper_thread(void *arg)
+{
+	int ret = thread_sleep_for(SLEEP_USECS);
+	assert(ret == 0);
+	thread_exit((long)arg);
+}
+
+/* resident set size of the process, in MB */
+static long
+rss_mb(void)
+{
+	long pages = 0, resident = 0;
+	FILE *f = fopen("/proc/self/statm", "r");
+
+	if (f) {
+		if (fscanf(f, "%ld %ld", &pages, &resident) != 2) {
+			resident = 0;
+		}
+		fclose(f);
+	}
+	return resident * sysconf(_SC_PAGESIZE) / (1024 * 1024);
+}
+
+static void
+test_limit(void)
+{
+	if (thread_set_max_threads(THREAD_MAX_THREADS / 2) == THREAD_INVALID &&
+	    thread_set_max_threads(THREAD_TABLE_MAX + 1) == THREAD_INVALID &&
+	    thread_set_max_threads(NSCALE + 1) == 0) {
+		unintr_printf("test_scale: good, limit raised to %d\n",
+			      NSCALE + 1);
+	} else {
+		unintr_printf("test_scale: bad, limit not checked\n");
+	}
+}
+
+static void
+test_create_join(void)
+{
+	struct stack_pool_stats stats;
+	Tid ret;
+	int i, code, bad = 0;
+
+	for (i = 0; i < NSCALE; i++) {
+		tids[i] = thread_create(sleeper_thread, (void *)(long)i);
+		assert(thread_ret_ok(tids[i]));
+	}
+	ret = thread_create(sleeper_thread, NULL);
+	if (ret == THREAD_NOMORE) {
+		unintr_printf("test_scale: good, %d threads created\n",
+			      NSCALE);
+	} else {
+		unintr_printf("test_scale: bad, created past the limit\n");
+	}
+	stack_pool_get_stats(&stats);
+	unintr_printf("%ld MB of stacks mapped, %ld MB resident\n",
+		      stats.bytes_mapped / (1024 * 1024), rss_mb());
+
+	for (i = 0; i < NSCALE; i++) {
+		ret = thread_wait(tids[i], &code);
+		if (ret != tids[i] || code != i) {
+			bad++;
+		}
+	}
+	if (bad == 0) {
+		unintr_printf("test_scale: good, %d threads joined\n",
+			      NSCALE);
+	} else {
+		unintr_printf("test_scale: bad, %d joins failed\n", bad);
+	}
+}
+
+static void
+test_stale(void)
+{
+	Tid ret, fresh;
+	int code;
+
+	/* the lowest free slot is the one tids[0] had */
+	fresh = thread_create(sleeper_thread, (void *)1L);
+	assert(thread_ret_ok(fresh));
+	if (fresh != tids[0] && thread_kill(tids[0]) == THREAD_INVALID &&
+	    thread_wait(tids[0], NULL) == THREAD_INVALID &&
+	    thread_kill(THREAD_ANY) == THREAD_INVALID &&
+	    thread_kill(THREAD_SELF) == THREAD_INVALID) {
+		unintr_printf("test_scale: good, stale tid rejected\n");
+	} else {
+		unintr_printf("test_scale: bad, stale tid %d accepted\n",
+			      tids[0]);
+	}
+	ret = thread_wait(fresh, &code);
+	assert(ret == fresh && code == 1);
+}
+
+static void
+test_unmapped(void)
+{
+	struct stack_pool_stats stats;
+
+	stack_pool_get_stats(&stats);
+	if (stats.bytes_mapped <=
+	    (stats.cached + 1) * (THREAD_MIN_STACK + getpagesize())) {
+		unintr_printf("test_scale: good, stacks unmapped\n");
+	} else {
+		unintr_printf("test_scale: bad, %ld bytes of stacks still "
+			      "mapped\n", stats.bytes_mapped);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	long start_mallocs, start_bytes;
+
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+
+	unintr_printf("starting scale test\n");
+	start_mallocs = get_current_num_mallocs();
+	start_bytes = get_current_bytes_malloced();
+	test_limit();
+	test_create_join();
+	test_stale();
+	test_unmapped();
+	if (is_leak_free(start_mallocs, start_bytes)) {
+		unintr_printf("No memory leaks detected.\n");
+	} else {
+		unintr_printf("Detected memory leaks.\n");
+	}
+	unintr_printf("scale test done\n");
+	return 0;
+}
@@ -0,0 +1,151 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * test_sema stress tests the counting semaphores, with preemption enabled.
+ * 1. NTHREADS/2 producers and NTHREADS/2 consumers pass items through a
+ *    bounded buffer, counted by two semaphores. Every item must be consumed
+ *    exactly once.
+ * 2. NWAITERS threads wait on a semaphore. sema_up_n(sem, n) must let exactly
+ *    n of them through, and sema_try_down must not block.
+ *****************************************************************************/
+
+#define NITEMS 500 /* per producer */
+#define BUFSIZE 16
+#define NWAITERS 32
+
+static struct sema *slots, *items;
+static struct lock *buflock;
+static unsigned long buffer[BUFSIZE];
+static int head, tail;
+static unsigned long consumed_sum;
+
+static void
+producer_thread(void *arg)
+{
+	unsigned long i;
+
+	for (i = 1; i <= NITEMS; i++) {
+		sema_down(slots);
+		lock_acquire(buflock);
+		buffer[tail] = i;
+		tail = (tail + 1) % BUFSIZE;
+		thread_yield(THREAD_ANY);
+		lock_release(buflock);
+		sema_up(items);
+	}
+}
+
+static void
+consumer_thread(void *arg)
+{
+	int i;
+
+	for (i = 0; i < NITEMS; i++) {
+		sema_down(items);
+		lock_acquire(buflock);
+		consumed_sum += buffer[head];
+		head = (head + 1) % BUFSIZE;
+		lock_release(buflock);
+		sema_up(slots);
+	}
+}
+
+static struct sema *gate;
+static volatile int passed;
+
+static void
+waiter_thread(void *arg)
+{
+	sema_down(gate);
+	__atomic_add_fetch(&passed, 1, __ATOMIC_SEQ_CST);
+}
+
+/* yield until nothing else can run, i.e. until all the waiters sleep */
+static void
+settle(void)
+{
+	while (thread_yield(THREAD_ANY) != THREAD_NONE)
+		;
+}
+
+static void
+test_sema(void)
+{
+	Tid result[NTHREADS];
+	int i;
+
+	unintr_printf("starting sema test\n");
+
+	/* 1. bounded buffer */
+	slots = sema_create(BUFSIZE);
+	items = sema_create(0);
+	buflock = lock_create();
+	for (i = 0; i < NTHREADS; i++) {
+		result[i] = thread_create(i % 2 ? consumer_thread :
+					  producer_thread, NULL);
+		assert(thread_ret_ok(result[i]));
+	}
+	for (i = 0; i < NTHREADS; i++) {
+		thread_wait(result[i], NULL);
+	}
+	if (consumed_sum == (unsigned long)NTHREADS / 2 * NITEMS * (NITEMS + 1) / 2
+	    && head == tail && sema_try_down(items) == THREAD_NONE) {
+		unintr_printf("test_sema: good, every item consumed once\n");
+	} else {
+		unintr_printf("test_sema: bad, consumed sum is %lu\n",
+			      consumed_sum);
+	}
+	sema_destroy(slots);
+	sema_destroy(items);
+	lock_destroy(buflock);
+
+	/* 2. sema_up_n */
+	gate = sema_create(0);
+	for (i = 0; i < NWAITERS; i++) {
+		result[i] = thread_create(waiter_thread, NULL);
+		assert(thread_ret_ok(result[i]));
+	}
+	settle();
+	assert(passed == 0);
+	sema_up_n(gate, NWAITERS / 4);
+	settle();
+	if (passed == NWAITERS / 4) {
+		unintr_printf("test_sema: good, sema_up_n let %d through\n",
+			      passed);
+	} else {
+		unintr_printf("test_sema: bad, sema_up_n let %d through, "
+			      "expected %d\n", passed, NWAITERS / 4);
+	}
+	sema_up_n(gate, NWAITERS - NWAITERS / 4 + 1);
+	for (i = 0; i < NWAITERS; i++) {
+		thread_wait(result[i], NULL);
+	}
+	if (sema_try_down(gate) == 0 && sema_try_down(gate) == THREAD_NONE) {
+		unintr_printf("test_sema: good, one unit left over\n");
+	} else {
+		unintr_printf("test_sema: bad, wrong value left over\n");
+	}
+	sema_destroy(gate);
+
+	unintr_printf("sema test done\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+	/* Enable preemption */
+	register_interrupt_handler(false);
+
+	test_sema();
+	return 0;
+}
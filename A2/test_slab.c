@@ -0,0 +1,165 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+#include "slab.h"
+
+/******************************************************************************
+ * test_slab checks the object caches.
+ * 1. thread_init fills the caches ahead of time, so that threads that are
+ *    created and exit one after another, or sleep and are woken up, reuse
+ *    cached TCBs and wait nodes without carving new slabs.
+ * 2. A cache that runs out carves more slabs, and keeps the objects once
+ *    they are freed.
+ * 3. An object that is never freed still shows up as a leak, while what the
+ *    caches keep does not.
+ *****************************************************************************/
+
+#define NCHURN 1000
+#define NLOCKS (SLAB_OBJECTS * 3 + 1)
+
+static struct wait_queue *queue;
+static volatile int stop;
+
+static void
+get(const char *name, struct slab_stats *stats)
+{
+	int ret = slab_get_stats(name, stats);
+	assert(ret == 0);
+}
+
+static void
+exit_thread(void *arg)
+{
+	thread_exit(0);
+}
+
+static void
+sleeper_thread(void *arg)
+{
+	bool enabled = interrupts_off();
+	while (!stop) {
+		thread_sleep(queue);
+	}
+	interrupts_set(enabled);
+}
+
+static void
+test_reuse(void)
+{
+	struct slab_stats th0, th1, wn0, wn1;
+	Tid ret;
+	int i;
+
+	get("thread", &th0);
+	get("wait_node", &wn0);
+	if (th0.cached + th0.in_use >= SLAB_OBJECTS &&
+	    wn0.cached + wn0.in_use >= SLAB_OBJECTS) {
+		unintr_printf("test_slab: good, caches filled by thread_init\n");
+	} else {
+		unintr_printf("test_slab: bad, caches not filled\n");
+	}
+
+	for (i = 0; i < NCHURN; i++) {
+		ret = thread_create(exit_thread, NULL);
+		assert(thread_ret_ok(ret));
+		thread_yield(ret);
+	}
+
+	queue = wait_queue_create();
+	stop = 0;
+	ret = thread_create(sleeper_thread, NULL);
+	assert(thread_ret_ok(ret));
+	thread_yield(ret);
+	for (i = 0; i < NCHURN; i++) {
+		thread_wakeup(queue, 0);
+		thread_yield(ret);
+	}
+	stop = 1;
+	thread_wakeup(queue, 0);
+	thread_wait(ret, NULL);
+	wait_queue_destroy(queue);
+
+	get("thread", &th1);
+	get("wait_node", &wn1);
+	if (th1.allocs - th0.allocs == NCHURN + 1 &&
+	    wn1.allocs - wn0.allocs >= NCHURN &&
+	    th1.slabs == th0.slabs && wn1.slabs == wn0.slabs &&
+	    wn1.in_use == wn0.in_use) {
+		unintr_printf("test_slab: good, objects reused\n");
+	} else {
+		unintr_printf("test_slab: bad, %ld thread and %ld wait_node "
+			      "slabs carved\n", th1.slabs - th0.slabs,
+			      wn1.slabs - wn0.slabs);
+	}
+}
+
+static void
+test_grow(void)
+{
+	struct lock *locks[NLOCKS];
+	struct slab_stats l0, l1, l2;
+	int i;
+
+	get("lock", &l0);
+	for (i = 0; i < NLOCKS; i++) {
+		locks[i] = lock_create();
+	}
+	get("lock", &l1);
+	for (i = 0; i < NLOCKS; i++) {
+		lock_destroy(locks[i]);
+	}
+	get("lock", &l2);
+	if (l1.in_use - l0.in_use == NLOCKS &&
+	    l1.slabs * SLAB_OBJECTS >= l1.in_use &&
+	    l2.in_use == l0.in_use && l2.slabs == l1.slabs &&
+	    l2.cached == l2.slabs * SLAB_OBJECTS - l2.in_use) {
+		unintr_printf("test_slab: good, cache grows and keeps "
+			      "objects\n");
+	} else {
+		unintr_printf("test_slab: bad, lock cache counters off\n");
+	}
+}
+
+static void
+test_leak(long start_mallocs, long start_bytes)
+{
+	struct cv *cv = cv_create();
+
+	if (!is_leak_free(start_mallocs, start_bytes) &&
+	    get_current_num_mallocs() - start_mallocs == 2) {
+		unintr_printf("test_slab: good, unfreed object is a leak\n");
+	} else {
+		unintr_printf("test_slab: bad, unfreed object missed\n");
+	}
+	cv_destroy(cv);
+}
+
+int
+main(int argc, char **argv)
+{
+	long start_mallocs, start_bytes;
+
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+
+	unintr_printf("starting slab test\n");
+	start_mallocs = get_current_num_mallocs();
+	start_bytes = get_current_bytes_malloced();
+	test_reuse();
+	test_grow();
+	test_leak(start_mallocs, start_bytes);
+	if (is_leak_free(start_mallocs, start_bytes)) {
+		unintr_printf("No memory leaks detected.\n");
+	} else {
+		unintr_printf("Detected memory leaks.\n");
+	}
+	slab_stats_dump();
+	unintr_printf("slab test done\n");
+	return 0;
+}
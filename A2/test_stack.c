@@ -0,0 +1,113 @@
+#include <sys/wait.h>
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+#include "stack.h"
+
+/******************************************************************************
+ * test_stack checks the thread stack pool.
+ * 1. Threads that are created and exit one after another should reuse the
+ *    same cached stack instead of mapping a new one each time.
+ * 2. Lowering the pool cap releases cached stacks.
+ * 3. Overflowing a thread stack must hit the guard page (SIGSEGV) rather
+ *    than silently scribbling over other memory. This runs in a child
+ *    process, since the fault kills it.
+ *****************************************************************************/
+
+#define NCHURN 200
+
+static void
+short_lived_thread(void *arg)
+{
+	thread_exit(0);
+}
+
+/* recurses far deeper than THREAD_MIN_STACK allows */
+static int
+recurse_deep(int depth)
+{
+	volatile char pad[512];
+	pad[0] = depth;
+	if (depth > THREAD_MIN_STACK) {
+		return pad[0];
+	}
+	return recurse_deep(depth + 1) + pad[0];
+}
+
+static void
+overflow_thread(void *arg)
+{
+	recurse_deep(0);
+}
+
+static void
+test_stack(void)
+{
+	struct stack_pool_stats before, after;
+	int i, status;
+	Tid ret;
+	pid_t pid;
+
+	unintr_printf("starting stack test\n");
+
+	/* 1. churn */
+	stack_pool_get_stats(&before);
+	for (i = 0; i < NCHURN; i++) {
+		ret = thread_create(short_lived_thread, NULL);
+		assert(thread_ret_ok(ret));
+		ret = thread_yield(ret);
+		assert(thread_ret_ok(ret));
+	}
+	stack_pool_get_stats(&after);
+	unintr_printf("churn: %ld hits, %ld misses\n",
+		      after.hits - before.hits, after.misses - before.misses);
+	if (after.misses - before.misses > 1) {
+		unintr_printf("test_stack: bad, exited stacks are not reused\n");
+	} else {
+		unintr_printf("test_stack: good, exited stacks are reused\n");
+	}
+
+	/* 2. cap */
+	stack_pool_set_cap(0);
+	stack_pool_get_stats(&after);
+	assert(after.cached == 0);
+	assert(after.cap == 0);
+	stack_pool_set_cap(STACK_POOL_DEFAULT_CAP);
+	unintr_printf("test_stack: good, cap releases cached stacks\n");
+
+	/* 3. guard page */
+	fflush(stdout);
+	pid = fork();
+	assert(pid >= 0);
+	if (pid == 0) {
+		signal(SIGSEGV, SIG_DFL);
+		ret = thread_create(overflow_thread, NULL);
+		assert(thread_ret_ok(ret));
+		thread_yield(ret);
+		_exit(0);
+	}
+	waitpid(pid, &status, 0);
+	if (WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV) {
+		unintr_printf("test_stack: good, overflow hit the guard page\n");
+	} else {
+		unintr_printf("test_stack: bad, overflow did not fault\n");
+	}
+
+	unintr_printf("stack test done\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+
+	test_stack();
+	return 0;
+}
@@ -0,0 +1,177 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * test_stats checks the scheduler statistics, with preemption enabled.
+ * 1. A thread that yields YIELDS times to the initial thread, which yields
+ *    back, has made at least YIELDS voluntary switches.
+ * 2. A thread that sleeps for SLEEP usecs has been blocked for about that
+ *    long, and has switched away voluntarily.
+ * 3. Two threads that spin for DURATION usecs share the CPU: both are
+ *    preempted, both wait on the ready queue, and their run and ready times
+ *    add up to about the time they spun for.
+ * 4. The global counters have seen the ticks, the switches and the ready
+ *    queue of the above, and only the initial thread is left.
+ *****************************************************************************/
+
+#define YIELDS 100
+#define SLEEP 50000
+#define DURATION 100000
+
+static struct thread_stats result[2];
+static volatile int done;
+
+static void
+check(const char *what, bool ok)
+{
+	if (ok) {
+		unintr_printf("test_stats: good, %s\n", what);
+	} else {
+		unintr_printf("test_stats: bad, %s\n", what);
+	}
+}
+
+static void
+yielder(void *arg)
+{
+	int i;
+
+	for (i = 0; i < YIELDS; i++) {
+		thread_yield(THREAD_ANY);
+	}
+	thread_stats(THREAD_SELF, &result[0]);
+	done = 1;
+}
+
+static void
+sleeper(void *arg)
+{
+	thread_sleep_for(SLEEP);
+	thread_stats(THREAD_SELF, &result[0]);
+}
+
+static void
+spinner(void *arg)
+{
+	spin(DURATION);
+	thread_stats(THREAD_SELF, &result[(long)arg]);
+}
+
+static void
+run(void (*fn)(void *), long n)
+{
+	Tid tids[2];
+	long i;
+
+	for (i = 0; i < n; i++) {
+		tids[i] = thread_create(fn, (void *)i);
+		assert(thread_ret_ok(tids[i]));
+	}
+	for (i = 0; i < n; i++) {
+		thread_wait(tids[i], NULL);
+	}
+}
+
+static void
+test_yield(void)
+{
+	Tid tid;
+
+	done = 0;
+	tid = thread_create(yielder, NULL);
+	assert(thread_ret_ok(tid));
+	while (!done) {
+		thread_yield(THREAD_ANY);
+	}
+	thread_wait(tid, NULL);
+	check("yields are voluntary switches",
+	      result[0].voluntary >= YIELDS);
+}
+
+static void
+test_sleep(void)
+{
+	run(sleeper, 1);
+	check("a sleep is blocked time",
+	      result[0].blocked_usecs >= SLEEP * 9 / 10 &&
+	      result[0].blocked_usecs < SLEEP * 3 &&
+	      result[0].voluntary >= 1);
+}
+
+static void
+test_spin(void)
+{
+	unsigned long total;
+	int i;
+
+	run(spinner, 2);
+	for (i = 0; i < 2; i++) {
+		total = result[i].run_usecs + result[i].ready_usecs;
+		check("spinners are preempted", result[i].involuntary > 0);
+		check("spinners wait to run", result[i].ready_usecs > 0 &&
+		      result[i].max_ready_usecs > 0 &&
+		      result[i].max_ready_usecs <= result[i].ready_usecs);
+		check("run and ready time add up",
+		      total >= DURATION * 9 / 10 && total < DURATION * 3);
+	}
+}
+
+static void
+test_global(void)
+{
+	struct thread_sched_stats stats;
+	struct thread_stats self;
+
+	assert(thread_sched_stats(&stats) == 0);
+	check("ticks are counted", stats.ticks > 0);
+	check("switches are counted", stats.switches >= YIELDS);
+	check("the ready queue was seen", stats.max_ready >= 2 &&
+	      stats.ready_len_sum > 0);
+	check("only the initial thread is left", stats.nr_threads == 1 &&
+	      stats.nr_ready == 0 && stats.nr_blocked == 0);
+	check("the initial thread has run",
+	      thread_stats(THREAD_SELF, &self) == 0 && self.run_usecs > 0);
+	check("no stats for a thread that is gone",
+	      thread_stats(1, &self) == THREAD_INVALID &&
+	      thread_stats(THREAD_MAX_THREADS, &self) == THREAD_INVALID);
+	thread_stats_dump();
+}
+
+int
+main(int argc, char **argv)
+{
+	struct thread_sched_stats stats;
+	long start_mallocs, start_bytes;
+
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+	/* Enable preemption */
+	register_interrupt_handler(false);
+
+	unintr_printf("starting stats test\n");
+	if (thread_sched_stats(&stats) == THREAD_INVALID) {
+		unintr_printf("test_stats: stats are not compiled in\n");
+		unintr_printf("stats test done\n");
+		return 0;
+	}
+	start_mallocs = get_current_num_mallocs();
+	start_bytes = get_current_bytes_malloced();
+	test_yield();
+	test_sleep();
+	test_spin();
+	test_global();
+	if (is_leak_free(start_mallocs, start_bytes)) {
+		unintr_printf("No memory leaks detected.\n");
+	} else {
+		unintr_printf("Detected memory leaks.\n");
+	}
+	unintr_printf("stats test done\n");
+	return 0;
+}
@@ -0,0 +1,213 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * test_timeout checks timed sleeps and timeouts, with preemption enabled.
+ * 1. A thread sleeping alone with thread_sleep_for must wake up on time,
+ *    neither early nor much too late.
+ * 2. NSLEEPERS threads sleep for random times. None may wake up early.
+ * 3. lock_acquire_timeout on a held lock must time out, and must succeed
+ *    once the lock is free.
+ * 4. cv_timedwait must time out without a signal, and return 0 when it is
+ *    signalled before the timeout.
+ * 5. A thread in a long timed sleep is killed, and must exit at once.
+ * 6. While the only thread sleeps, the process must block rather than spin:
+ *    it may use little CPU time, and the time must count as idle.
+ * 7. Timed sleeps and waits also work with the ucontext switch, when the
+ *    worker goes idle on it, and after switching back.
+ *****************************************************************************/
+
+#define NSLEEPERS 200
+#define MAX_SLEEP 50000 /* usecs */
+#define LATE 20000	/* usecs a sleep may overrun */
+#define IDLE_SLEEP 100000 /* usecs */
+
+static struct lock *testlock;
+static struct cv *testcv;
+static int early;
+static int finished;
+static volatile int holding;
+
+static long
+clock_usecs(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+static long
+now_usecs(void)
+{
+	return clock_usecs(CLOCK_MONOTONIC);
+}
+
+static void
+check(const char *what, int good)
+{
+	unintr_printf("test_timeout: %s, %s\n", good ? "good" : "bad", what);
+}
+
+static void
+sleeper_thread(void *arg)
+{
+	long usecs = (long)arg;
+	long start = now_usecs();
+	int ret = thread_sleep_for(usecs);
+
+	assert(ret == 0);
+	lock_acquire(testlock);
+	if (now_usecs() - start < usecs) {
+		early++;
+	}
+	finished++;
+	cv_signal(testcv, testlock);
+	lock_release(testlock);
+}
+
+static void
+holder_thread(void *arg)
+{
+	lock_acquire(testlock);
+	holding = 1;
+	thread_sleep_for(50000);
+	lock_release(testlock);
+}
+
+static void
+signaller_thread(void *arg)
+{
+	thread_sleep_for(10000);
+	lock_acquire(testlock);
+	cv_signal(testcv, testlock);
+	lock_release(testlock);
+}
+
+static void
+long_sleeper_thread(void *arg)
+{
+	thread_sleep_for(10000000);
+	unintr_printf("test_timeout: bad, killed thread woke up\n");
+}
+
+static void
+test_timeout(void)
+{
+	long start, elapsed, cpu, idle;
+	Tid ret;
+	int i, err;
+
+	unintr_printf("starting timeout test\n");
+	testlock = lock_create();
+	testcv = cv_create();
+
+	/* 1. alone */
+	assert(thread_sleep_for(-1) == THREAD_INVALID);
+	start = now_usecs();
+	err = thread_sleep_for(20000);
+	elapsed = now_usecs() - start;
+	check("lone thread sleeps for its time",
+	      err == 0 && elapsed >= 20000 && elapsed < 20000 + LATE);
+
+	/* 2. many sleepers */
+	for (i = 0; i < NSLEEPERS; i++) {
+		ret = thread_create(sleeper_thread, (void *)(random() % MAX_SLEEP));
+		assert(thread_ret_ok(ret));
+	}
+	lock_acquire(testlock);
+	while (finished < NSLEEPERS) {
+		cv_wait(testcv, testlock);
+	}
+	lock_release(testlock);
+	check("no sleeper woke up early", early == 0);
+
+	/* 3. lock timeout */
+	ret = thread_create(holder_thread, NULL);
+	assert(thread_ret_ok(ret));
+	while (!holding) {
+		thread_yield(ret);
+	}
+	start = now_usecs();
+	err = lock_acquire_timeout(testlock, 10000);
+	elapsed = now_usecs() - start;
+	check("lock_acquire_timeout times out",
+	      err == THREAD_TIMEDOUT && elapsed >= 10000);
+	err = lock_acquire_timeout(testlock, 1000000);
+	check("lock_acquire_timeout acquires a released lock", err == 0);
+	lock_release(testlock);
+	thread_wait(ret, NULL);
+
+	/* 4. cv timeout */
+	lock_acquire(testlock);
+	start = now_usecs();
+	err = cv_timedwait(testcv, testlock, 10000);
+	elapsed = now_usecs() - start;
+	check("cv_timedwait times out",
+	      err == THREAD_TIMEDOUT && elapsed >= 10000);
+	ret = thread_create(signaller_thread, NULL);
+	assert(thread_ret_ok(ret));
+	err = cv_timedwait(testcv, testlock, 1000000);
+	check("cv_timedwait is signalled", err == 0);
+	lock_release(testlock);
+	thread_wait(ret, NULL);
+
+	/* 5. kill a timed sleeper */
+	ret = thread_create(long_sleeper_thread, NULL);
+	assert(thread_ret_ok(ret));
+	thread_yield(ret);
+	start = now_usecs();
+	err = thread_kill(ret);
+	assert(err == ret);
+	thread_wait(ret, NULL);
+	elapsed = now_usecs() - start;
+	check("killed sleeper exits at once", elapsed < LATE);
+
+	/* 6. idle */
+	cpu = clock_usecs(CLOCK_PROCESS_CPUTIME_ID);
+	idle = thread_idle_usecs();
+	thread_sleep_for(IDLE_SLEEP);
+	cpu = clock_usecs(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+	idle = thread_idle_usecs() - idle;
+	check("process blocks while idle",
+	      cpu < IDLE_SLEEP / 10 && idle >= IDLE_SLEEP * 9 / 10);
+
+	/* 7. ucontext */
+	thread_use_ucontext(true);
+	start = now_usecs();
+	err = thread_sleep_for(20000);
+	elapsed = now_usecs() - start;
+	lock_acquire(testlock);
+	ret = thread_create(signaller_thread, NULL);
+	assert(thread_ret_ok(ret));
+	err |= cv_timedwait(testcv, testlock, 1000000);
+	lock_release(testlock);
+	thread_wait(ret, NULL);
+	thread_use_ucontext(false);
+	err |= thread_sleep_for(1000);
+	check("timed sleeps with the ucontext switch",
+	      err == 0 && elapsed >= 20000);
+
+	cv_destroy(testcv);
+	lock_destroy(testlock);
+	unintr_printf("timeout test done\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+	/* Enable preemption */
+	register_interrupt_handler(false);
+
+	test_timeout();
+	return 0;
+}
@@ -0,0 +1,247 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+#include "trace.h"
+
+/******************************************************************************
+ * test_trace checks the scheduler event trace, with preemption enabled.
+ * 1. A traced run of threads that sleep, hold a lock that the initial
+ *    thread contends for, spin until preempted, and get killed, is saved
+ *    and read back. Every kind of event is there, from the expected
+ *    threads, in time order, and the switches chain up: each thread
+ *    switched away from is the one last switched to on its worker.
+ * 2. Once stopped, nothing more is recorded.
+ * 3. More than TRACE_SIZE switches keep the last TRACE_SIZE events.
+ *****************************************************************************/
+
+#define SLEEP 10000
+#define DURATION 50000
+
+static char path[] = "/tmp/test_trace.XXXXXX";
+static struct trace_header header;
+static struct trace_event events[TRACE_SIZE];
+static struct lock *lock;
+static Tid sleeper_tid, holder_tid;
+
+static void
+check(const char *what, bool ok)
+{
+	if (ok) {
+		unintr_printf("test_trace: good, %s\n", what);
+	} else {
+		unintr_printf("test_trace: bad, %s\n", what);
+	}
+}
+
+/* save the trace, and read it back into header and events */
+static void
+load(void)
+{
+	FILE *f;
+
+	assert(thread_trace_save(path) == 0);
+	f = fopen(path, "r");
+	assert(f);
+	assert(fread(&header, sizeof(header), 1, f) == 1);
+	assert(header.magic == TRACE_MAGIC);
+	assert(fread(events, sizeof(events[0]), header.nr_events, f) ==
+	       header.nr_events);
+	fclose(f);
+}
+
+static int
+count(int type, int tid, int arg)
+{
+	uint32_t i;
+	int n = 0;
+
+	for (i = 0; i < header.nr_events; i++) {
+		if (events[i].type == type &&
+		    (tid == THREAD_ANY || events[i].tid == tid) &&
+		    (arg == THREAD_ANY || events[i].arg == arg)) {
+			n++;
+		}
+	}
+	return n;
+}
+
+static void
+sleeper(void *arg)
+{
+	thread_sleep_for(SLEEP);
+}
+
+static void
+holder(void *arg)
+{
+	lock_acquire(lock);
+	thread_sleep_for(SLEEP);
+	lock_release(lock);
+}
+
+static void
+spinner(void *arg)
+{
+	spin(DURATION);
+}
+
+static void
+victim(void *arg)
+{
+	assert(0);
+}
+
+static void
+test_events(void)
+{
+	Tid spinners[2], killed;
+	uint32_t i;
+	int running = 0;
+	bool ordered = true, chained = true;
+
+	lock = lock_create();
+	thread_trace_start();
+	sleeper_tid = thread_create(sleeper, NULL);
+	holder_tid = thread_create(holder, NULL);
+	killed = thread_create(victim, NULL);
+	assert(thread_ret_ok(killed));
+	assert(thread_kill(killed) == killed);
+	/* let the holder take the lock, and sleep with it, before contending
+	 * for it */
+	thread_yield(holder_tid);
+	lock_acquire(lock);
+	lock_release(lock);
+	spinners[0] = thread_create(spinner, NULL);
+	spinners[1] = thread_create(spinner, NULL);
+	thread_wait(sleeper_tid, NULL);
+	thread_wait(holder_tid, NULL);
+	thread_wait(spinners[0], NULL);
+	thread_wait(spinners[1], NULL);
+	thread_wait(killed, NULL);
+	load();
+	lock_destroy(lock);
+
+	check("nothing was lost", header.lost == 0 && header.nr_events > 0 &&
+	      header.tsc_per_usec > 0);
+	check("creates", count(TRACE_CREATE, 0, THREAD_ANY) == 5);
+	check("kill", count(TRACE_KILL, 0, killed) == 1);
+	check("sleep and wakeup", count(TRACE_SLEEP, sleeper_tid,
+					THREAD_ANY) == 1 &&
+	      count(TRACE_WAKEUP, THREAD_ANY, sleeper_tid) == 1);
+	check("lock contention", count(TRACE_CONTEND, 0, holder_tid) == 1);
+	check("preemption", count(TRACE_PREEMPT, spinners[0], THREAD_ANY) > 0 &&
+	      count(TRACE_PREEMPT, spinners[1], THREAD_ANY) > 0);
+	check("yield", count(TRACE_YIELD, 0, holder_tid) == 1);
+	check("exits", count(TRACE_EXIT, THREAD_ANY, THREAD_ANY) == 4 &&
+	      count(TRACE_EXIT, killed, THREAD_ANY) == 0);
+	check("ticks", count(TRACE_TICK, THREAD_ANY, THREAD_ANY) > 0);
+
+	for (i = 0; i < header.nr_events; i++) {
+		struct trace_event *e = &events[i];
+
+		if (i > 0 && e->tsc < events[i - 1].tsc) {
+			ordered = false;
+		}
+		if (e->type <= TRACE_EXIT) {
+			if (e->tid != running) {
+				chained = false;
+			}
+			running = e->arg;
+		} else if (e->type == TRACE_RUN) {
+			if (running != THREAD_NONE) {
+				chained = false;
+			}
+			running = e->arg;
+		}
+	}
+	check("events are in time order", ordered);
+	check("switches chain up", chained);
+}
+
+static void
+test_stop(void)
+{
+	int i;
+
+	thread_trace_start();
+	thread_trace_stop();
+	for (i = 0; i < 20; i++) {
+		thread_wait(thread_create(sleeper, NULL), NULL);
+	}
+	load();
+	check("nothing is recorded once stopped", header.nr_events == 0);
+}
+
+static volatile int stop;
+
+static void
+yielder(void *arg)
+{
+	while (!stop) {
+		thread_yield(THREAD_ANY);
+	}
+}
+
+static void
+test_wrap(void)
+{
+	Tid tid;
+	int i;
+
+	stop = 0;
+	tid = thread_create(yielder, NULL);
+	assert(thread_ret_ok(tid));
+	thread_trace_start();
+	for (i = 0; i < TRACE_SIZE; i++) {
+		thread_yield(THREAD_ANY);
+	}
+	stop = 1;
+	thread_wait(tid, NULL);
+	load();
+	check("the ring keeps the last events", header.nr_events ==
+	      TRACE_SIZE && header.lost > 0);
+	/* a tick may come after it */
+	for (i = TRACE_SIZE - 1; events[i].type == TRACE_TICK; i--)
+		;
+	check("the last switch is the exit", events[i].type == TRACE_EXIT &&
+	      events[i].tid == tid);
+}
+
+int
+main(int argc, char **argv)
+{
+	long start_mallocs, start_bytes;
+	int fd;
+
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+	/* Enable preemption */
+	register_interrupt_handler(false);
+
+	fd = mkstemp(path);
+	assert(fd >= 0);
+	close(fd);
+
+	unintr_printf("starting trace test\n");
+	start_mallocs = get_current_num_mallocs();
+	start_bytes = get_current_bytes_malloced();
+	test_events();
+	test_stop();
+	test_wrap();
+	if (is_leak_free(start_mallocs, start_bytes)) {
+		unintr_printf("No memory leaks detected.\n");
+	} else {
+		unintr_printf("Detected memory leaks.\n");
+	}
+	unlink(path);
+	unintr_printf("trace test done\n");
+	return 0;
+}
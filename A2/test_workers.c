@@ -0,0 +1,203 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * test_workers runs threads on NWORKERS kernel threads (thread_init_workers)
+ * with preemption enabled, so the threads really run in parallel.
+ * 1. NTHREADS threads increment a shared counter under a lock, with a
+ *    read-spin-write race window inside the critical section. The final
+ *    count must be exact.
+ * 2. NPAIRS producers and NPAIRS consumers pass items through a bounded
+ *    buffer protected by a lock and two condition variables. Every item
+ *    must be consumed exactly once.
+ * 3. A thread spinning on another worker is killed, and must stop.
+ *****************************************************************************/
+
+#define NWORKERS 4
+#define NINCREMENTS 500
+#define NPAIRS 4
+#define NITEMS 2000
+#define BUFSIZE 8
+
+static struct lock *testlock;
+static volatile unsigned long counter;
+
+/* threads that finished, counted under testlock. Tids are reused as soon as
+ * a thread exits, which may be before the initial thread has created all
+ * of them, so it cannot thread_wait on each Tid. */
+static int finished;
+static struct cv *finished_cv;
+
+static struct cv *notfull, *notempty;
+static unsigned long buffer[BUFSIZE];
+static int head, count;
+static unsigned long consumed_sum;
+
+static void
+finish(void)
+{
+	lock_acquire(testlock);
+	finished++;
+	cv_signal(finished_cv, testlock);
+	lock_release(testlock);
+}
+
+/* wait for n more threads to finish */
+static void
+wait_finished(int n)
+{
+	lock_acquire(testlock);
+	while (finished < n) {
+		cv_wait(finished_cv, testlock);
+	}
+	finished = 0;
+	lock_release(testlock);
+}
+
+static void
+increment_thread(void *arg)
+{
+	int i;
+
+	for (i = 0; i < NINCREMENTS; i++) {
+		assert(interrupts_enabled());
+		lock_acquire(testlock);
+		unsigned long val = counter;
+		/* give another worker a chance to race with us */
+		for (volatile int j = 0; j < 100; j++)
+			;
+		counter = val + 1;
+		lock_release(testlock);
+	}
+	finish();
+}
+
+static void
+producer_thread(void *arg)
+{
+	unsigned long i;
+
+	for (i = 1; i <= NITEMS; i++) {
+		lock_acquire(testlock);
+		while (count == BUFSIZE) {
+			cv_wait(notfull, testlock);
+		}
+		buffer[(head + count) % BUFSIZE] = i;
+		count++;
+		cv_signal(notempty, testlock);
+		lock_release(testlock);
+	}
+	finish();
+}
+
+static void
+consumer_thread(void *arg)
+{
+	int i;
+
+	for (i = 0; i < NITEMS; i++) {
+		lock_acquire(testlock);
+		while (count == 0) {
+			cv_wait(notempty, testlock);
+		}
+		consumed_sum += buffer[head];
+		head = (head + 1) % BUFSIZE;
+		count--;
+		cv_signal(notfull, testlock);
+		lock_release(testlock);
+	}
+	finish();
+}
+
+static volatile int spinner_started;
+
+static void
+spinner_thread(void *arg)
+{
+	spinner_started = 1;
+	while (1) {
+		spin(100);
+	}
+}
+
+static void
+test_workers(void)
+{
+	Tid ret;
+	int i;
+
+	unintr_printf("starting workers test\n");
+	testlock = lock_create();
+	finished_cv = cv_create();
+
+	/* 1. counter */
+	for (i = 0; i < NTHREADS; i++) {
+		ret = thread_create(increment_thread, NULL);
+		assert(thread_ret_ok(ret));
+	}
+	wait_finished(NTHREADS);
+	if (counter == NTHREADS * NINCREMENTS) {
+		unintr_printf("test_workers: good, counter is %lu\n", counter);
+	} else {
+		unintr_printf("test_workers: bad, counter is %lu, expected %d\n",
+			      counter, NTHREADS * NINCREMENTS);
+	}
+
+	/* 2. bounded buffer */
+	notfull = cv_create();
+	notempty = cv_create();
+	for (i = 0; i < NPAIRS; i++) {
+		ret = thread_create(producer_thread, NULL);
+		assert(thread_ret_ok(ret));
+		ret = thread_create(consumer_thread, NULL);
+		assert(thread_ret_ok(ret));
+	}
+	wait_finished(2 * NPAIRS);
+	if (consumed_sum == (unsigned long)NPAIRS * NITEMS * (NITEMS + 1) / 2
+	    && count == 0) {
+		unintr_printf("test_workers: good, every item consumed once\n");
+	} else {
+		unintr_printf("test_workers: bad, consumed sum is %lu\n",
+			      consumed_sum);
+	}
+	cv_destroy(notfull);
+	cv_destroy(notempty);
+
+	/* 3. kill a running thread */
+	ret = thread_create(spinner_thread, NULL);
+	assert(thread_ret_ok(ret));
+	while (!spinner_started) {
+		thread_yield(THREAD_ANY);
+	}
+	/* the spinner dies at its next tick, on whichever worker it is */
+	while (thread_kill(ret) != THREAD_INVALID) {
+		thread_yield(THREAD_ANY);
+	}
+	unintr_printf("test_workers: good, running thread was killed\n");
+
+	cv_destroy(finished_cv);
+	lock_destroy(testlock);
+	unintr_printf("workers test done\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	int ret;
+
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library with several workers */
+	ret = thread_init_workers(NWORKERS);
+	assert(!ret);
+	/* Preempt threads on every worker */
+	register_interrupt_handler(false);
+
+	test_workers();
+	return 0;
+}
@@ -1,40 +1,66 @@
 #include <assert.h>
 #include <stdlib.h>
+#include <signal.h>
 #include <ucontext.h>
 #include "thread.h"
 #include <stdio.h>
-#include "malloc369.h"
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include "interrupt.h"
+#include "stack.h"
+#include "slab.h"
+#include "sched.h"
+#include "wheel.h"
+#include "io.h"
+#include "trace.h"
+#include "khash.h"
 
 /* This is the wait queue structure, needed for Assignment 2. */ 
 struct wait_queue {
 	/* ... Fill this in Assignment 2 ... */
 	struct wait_node* waitHead;
 	struct wait_node* waitTail;
+	// threads on the queue, see wait_queue_length.
+	int length;
 };
 
 typedef struct wait_node {
 	struct wait_node* next;
+	struct wait_node* prev;
 	Tid tid;
 } wait_node;
 
-void enqueue_wait(Tid tid, struct wait_queue* wq)
+/* object caches for TCBs, wait nodes, wait queues, locks, cvs and futures (see
+ * slab.h), set up by caches_init. */
+static struct slab_cache thread_cache;
+static struct slab_cache wait_node_cache;
+static struct slab_cache wait_queue_cache;
+static struct slab_cache lock_cache;
+static struct slab_cache cv_cache;
+static struct slab_cache future_cache;
+
+wait_node* enqueue_wait(Tid tid, struct wait_queue* wq)
 {
+	wait_node* temp = slab_alloc(&wait_node_cache);
+	temp -> tid = tid;
+	temp -> next = NULL;
+	temp -> prev = wq->waitTail;
 	if (wq->waitHead == NULL && wq->waitTail == NULL)
 	{
-		wq->waitHead = malloc369(sizeof(wait_node));
-		wq->waitHead -> next = NULL;
-		wq->waitHead -> tid = tid;
-		wq->waitTail = wq->waitHead;
+		wq->waitHead = temp;
 	}
 	else
 	{
-		wait_node* temp = malloc369(sizeof(wait_node));
-		temp -> tid = tid;
-		temp -> next = NULL;
 		wq->waitTail -> next = temp;
-		wq->waitTail = temp;
 	}
+	wq->waitTail = temp;
+	wq->length ++;
+	return temp;
 }
 
 Tid dequeue_wait(struct wait_queue* wq)
@@ -45,138 +71,486 @@ Tid dequeue_wait(struct wait_queue* wq)
 	int rel = temp -> tid;
 	wq->waitHead = wq->waitHead -> next;
 	if (wq->waitHead == NULL) wq->waitTail = NULL;
-	free369(temp);
+	else wq->waitHead -> prev = NULL;
+	wq->length --;
+	slab_free(&wait_node_cache, temp);
 	return rel;
 }
 
+/* move the first node of from to the end of to. returns the node, or NULL
+ * if from is empty. */
+wait_node* requeue_wait(struct wait_queue* from, struct wait_queue* to)
+{
+	wait_node* node = from->waitHead;
+	if (node == NULL) return NULL;
+	from->waitHead = node -> next;
+	if (from->waitHead == NULL) from->waitTail = NULL;
+	else from->waitHead -> prev = NULL;
+
+	node -> next = NULL;
+	node -> prev = to->waitTail;
+	if (to->waitTail == NULL) to->waitHead = node;
+	else to->waitTail -> next = node;
+	to->waitTail = node;
+	from->length --;
+	to->length ++;
+	return node;
+}
+
+/* unlink node from the middle of wq, e.g. when a sleeping thread is killed
+ * or its sleep times out. */
+void remove_wait(wait_node* node, struct wait_queue* wq)
+{
+	if (node -> prev == NULL) wq->waitHead = node -> next;
+	else node -> prev -> next = node -> next;
+	if (node -> next == NULL) wq->waitTail = node -> prev;
+	else node -> next -> prev = node -> prev;
+	wq->length --;
+	slab_free(&wait_node_cache, node);
+}
+
 /* For Assignment 1, you will need a queue structure to keep track of the 
  * runnable threads. You can use the tutorial 1 queue implementation if you 
  * like. You will probably find in Assignment 2 that the operations needed
  * for the wait_queue are the same as those needed for the ready_queue.
  */
 
-/* This is the thread control block. */
-typedef struct thread {
-	/* ... Fill this in ... */
+/* The thread control block is in sched.h, where the scheduling policies
+ * can see it. The ready queue belongs to the policy selected in
+ * thread_init_sched; nr_ready counts the threads on it. */
+int nr_ready = 0;
+
+#define DEFAULT_SCHED "rr"
+
+/* Each scheduling policy is represented by a structure with its name and
+ * its functions. The list of SCHEDULERS is found in sched.h. */
+struct scheduler {
+	const char* name;
+	void (*init)(void);
+	void (*enqueue)(thread*);
+	thread* (*pick_next)(void);
+	void (*remove)(thread*);
+	bool (*on_tick)(thread*);
+	void (*on_block)(thread*);
+};
+
+static struct scheduler schedulers[] = {
+#define SCHED(name) \
+	{ #name, name ## _init, name ## _enqueue, name ## _pick_next, \
+	  name ## _remove, name ## _on_tick, name ## _on_block },
+SCHEDULERS
+#undef SCHED
+};
+static int num_schedulers = sizeof(schedulers) / sizeof(schedulers[0]);
+
+static struct scheduler* sched = NULL;
+// whether the policy is "prio", the only one that looks at priorities.
+static bool prio_sched = false;
+
+/* dead threads waiting to have their stack and TCB freed. the whole list is
+ * reaped at once by the next thread to run after a switch completes, rather
+ * than by sweeping the thread table on every yield. */
+thread* reapHead = NULL;
+
+/* Each worker is a kernel thread that runs user threads. Without
+ * thread_init_workers there is only worker 0, the kernel thread that
+ * called thread_init. */
+struct worker {
+	int id;
+	// the thread running on this worker, or THREAD_NONE while it is idle.
+	Tid cur_tid;
+	// saved stack pointer of the worker's idle loop, and its context for
+	// the ucontext path.
+	void* idle_sp;
+	ucontext_t idle_context;
+	// the stack of worker 0's idle loop, see idle_init.
+	void* idle_stack;
+	// time spent blocked in the idle loop, see thread_idle_usecs.
+	unsigned long idle_nsecs;
+	pthread_t pthread;
+};
+
+struct worker workers[THREAD_MAX_WORKERS];
+int nr_workers = 1;
+// workers in their idle loop. they wait with futex on idle_seq, which is
+// bumped whenever a thread is made runnable.
+int nr_idle = 0;
+unsigned int idle_seq = 0;
+int nr_started = 0;
+
+static __thread struct worker* self_worker = NULL;
+
+/* return the worker the caller is running on. a thread may resume on
+ * another worker after any switch, so this is kept out of line: the
+ * compiler must not reuse the thread-local address from before a switch. */
+static __attribute__((noinline)) struct worker* this_worker()
+{
+	__asm__ volatile("");
+	return self_worker;
+}
+
+int this_worker_id()
+{
+	return this_worker()->id;
+}
+/* The thread table. A Tid's low TID_SLOT_BITS bits are its slot in the
+ * table, and the bits above them the generation of the slot, which goes up
+ * each time the slot is given to a new thread while Tids are tagged (see
+ * thread_set_max_threads). The table is split into segments, allocated as
+ * threads are created and never freed, so its size follows the most threads
+ * that ever existed at once, not the limit. */
+#define TID_SLOT_BITS 20
+#define TID_SLOT_MASK ((1 << TID_SLOT_BITS) - 1)
+#define TID_GEN_MASK ((1 << (31 - TID_SLOT_BITS)) - 1)
+#define TID_SEG_SIZE 1024
+#define TID_SEGS (THREAD_TABLE_MAX / TID_SEG_SIZE)
+#define TID_WORD_BITS 64
+
+struct tid_entry {
+	// the thread in the slot, until it is reaped.
+	thread* th;
+	// the Tid of the thread that has, or last had, the slot.
 	Tid tid;
-    int state;
-    void* stack_bottom;
-    ucontext_t mycontext;
-	struct wait_queue* wq;
-	// int exit_code;
-}thread;
+	int exit_code;
+	// set while exit_code holds an exit code that thread_wait has not collected.
+	bool exited;
+	// set once the thread has exited or was killed, unless it was
+	// detached, with what thread_join returns for it.
+	bool done;
+	bool killed;
+	void* value;
+};
+
+struct tid_seg {
+	// one bit per slot, set while the slot is in use.
+	unsigned long used[TID_SEG_SIZE / TID_WORD_BITS];
+	int nr_used;
+	struct tid_entry entries[TID_SEG_SIZE];
+};
+
+struct tid_seg* tid_segs[TID_SEGS] = {NULL};
+// slots in use, at most tid_max.
+int nr_tids = 0;
+int tid_max = THREAD_MAX_THREADS;
+// every segment below this one is full.
+int tid_hint = 0;
+// whether new Tids carry a generation.
+bool tid_tagged = false;
+
+/* return the entry of slot, or NULL if its segment is not allocated yet. */
+static inline struct tid_entry* tid_slot(int slot)
+{
+	struct tid_seg* seg = tid_segs[slot / TID_SEG_SIZE];
+	return seg != NULL ? &seg->entries[slot % TID_SEG_SIZE] : NULL;
+}
 
-typedef enum thread_state {
-    RUNNING = -10,
-    READY = -11,
-    DYING = -12,
-	SLEEP = -13,
-	ZOMBIE = -14,
-} thread_state;
+/* return the entry of tid, or NULL if tid is out of range, or its slot has
+ * been given to another thread since. */
+static inline struct tid_entry* tid_entry(Tid tid)
+{
+	if (tid < 0 || (tid & TID_SLOT_MASK) >= tid_max) return NULL;
+	struct tid_entry* e = tid_slot(tid & TID_SLOT_MASK);
+	return e != NULL && e->tid == tid ? e : NULL;
+}
+
+/* return the thread tid refers to, or NULL if there is none. a thread that
+ * is DYING is still returned until it is reaped. */
+static inline thread* tid_thread(Tid tid)
+{
+	struct tid_entry* e = tid_entry(tid);
+	return e != NULL ? e->th : NULL;
+}
 
-typedef struct ready_node{
-    struct ready_node* next;
-    Tid tid;
-}ready_queue;
+/* switch with getcontext/setcontext instead of thread_switch (switch.S). */
+bool use_ucontext = false;
 
-ready_queue* readyHead = NULL;
-ready_queue* readyTail = NULL;
+/* defined in switch.S */
+extern void thread_switch(void** save_sp, void* new_sp);
+extern void thread_start(void);
 
-Tid cur_tid = 0;
-// global array of thread pointer. pointer is easily to set up value, delete and require less state 
-// after trying to implement statically thread array.
-thread* thread_pool[THREAD_MAX_THREADS] = {NULL};
-int exit_arr [THREAD_MAX_THREADS] = {0};
+/* initial MXCSR and x87 control word loaded by thread_switch for a new
+ * thread, i.e. the values the process starts with. */
+#define INITIAL_FPU_STATE ((0x037FUL << 32) | 0x1F80UL)
+
+/* Scheduler statistics, see thread_stats. Every state change of a thread
+ * goes through set_state, which charges the time spent in the old state to
+ * the thread. Without THREAD_STATS, the stats_* hooks are empty. */
+#ifdef THREAD_STATS
+static struct thread_sched_stats sched_stats;
+
+static unsigned long now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/* charge the time since th->acct.since_ns, up to now, to th's state. */
+static void stats_charge(thread* th, unsigned long now)
+{
+	struct thread_acct* a = &th->acct;
+	unsigned long ns = now - a->since_ns;
+	if (th->state == RUNNING) a->run_ns += ns;
+	else if (th->state == READY) a->ready_ns += ns;
+	else if (th->state == SLEEP) a->blocked_ns += ns;
+	a->since_ns = now;
+}
+
+static void stats_init(thread* th)
+{
+	memset(&th->acct, 0, sizeof(th->acct));
+	th->acct.since_ns = now_ns();
+	th->acct.ready_ns_at = th->acct.since_ns;
+}
 
-void enqueue(Tid tid)
+/* set th's state, at time now. */
+static void set_state_at(thread* th, int state, unsigned long now)
 {
-	if (readyHead == NULL && readyTail == NULL)
+	struct thread_acct* a = &th->acct;
+	stats_charge(th, now);
+	if (th->state == READY && now - a->ready_ns_at > a->max_ready_ns) a->max_ready_ns = now - a->ready_ns_at;
+	if (state == READY) a->ready_ns_at = now;
+	th->state = state;
+}
+
+static void set_state(thread* th, int state)
+{
+	set_state_at(th, state, now_ns());
+}
+
+/* prev is being switched away from, preempted by a tick or not. returns
+ * the time, which the two sides of the switch share, as reading the clock
+ * costs about as much as the switch itself. */
+static unsigned long stats_switch(thread* prev, bool preempted)
+{
+	if (preempted) prev->acct.involuntary ++;
+	else prev->acct.voluntary ++;
+	sched_stats.switches ++;
+	return now_ns();
+}
+
+static void stats_tick()
+{
+	sched_stats.ticks ++;
+	sched_stats.ready_len_sum += nr_ready;
+}
+
+static void stats_enqueue()
+{
+	if (nr_ready > sched_stats.max_ready) sched_stats.max_ready = nr_ready;
+}
+#else
+static inline void stats_init(thread* th) {}
+static inline void set_state_at(thread* th, int state, unsigned long now) { th->state = state; }
+static inline void set_state(thread* th, int state) { th->state = state; }
+static inline unsigned long stats_switch(thread* prev, bool preempted) { return 0; }
+static inline void stats_tick() {}
+static inline void stats_enqueue() {}
+#endif
+
+void wake_idle_worker()
+{
+	__atomic_add_fetch(&idle_seq, 1, __ATOMIC_SEQ_CST);
+	syscall(SYS_futex, &idle_seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+	// a worker waiting for I/O does not see the futex.
+	if (io_polling()) io_interrupt();
+}
+
+void enqueue(thread* th)
+{
+	if (th->in_ready) return;
+
+	th->in_ready = true;
+	nr_ready ++;
+	stats_enqueue();
+	sched->enqueue(th);
+	// there is something to preempt to now.
+	interrupts_stop_ticks(false);
+	if (nr_idle > 0) wake_idle_worker();
+}
+
+int remove_from_queue(thread* th)
+{
+	if (!th->in_ready) return -1;
+
+	sched->remove(th);
+	th->in_ready = false;
+	nr_ready --;
+	return 0;
+}
+
+/* change the priority th runs at, moving it within the ready queue. */
+void set_eff_prio(thread* th, int prio)
+{
+	if (th->eff_prio == prio) return;
+	if (th->in_ready && prio_sched)
 	{
-		readyHead = malloc369(sizeof(ready_queue));
-		readyHead -> next = NULL;
-		readyHead -> tid = tid;
-		readyTail = readyHead;
+		sched->remove(th);
+		th->eff_prio = prio;
+		sched->enqueue(th);
 	}
-	else
+	else th->eff_prio = prio;
+}
+
+/* take the next thread to run off the ready queue, or return NULL. */
+thread* dequeue()
+{
+	thread* th = sched->pick_next();
+	if (th == NULL) 
 	{
-		ready_queue* temp = malloc369(sizeof(ready_queue));
-		temp -> tid = tid;
-		temp -> next = NULL;
-		readyTail -> next = temp;
-		readyTail = temp;
+		return NULL;
 	}
+	th->in_ready = false;
+	nr_ready --;
+	return th;
 }
 
-Tid dequeue()
+/* claim the lowest free slot, allocating its segment if need be. returns
+ * the slot, or THREAD_NOMORE if all tid_max slots are in use, or
+ * THREAD_NOMEMORY. a slot is released as soon as its thread is marked
+ * DYING, matching the old linear scan, which also treated dying spots as
+ * free. */
+int find_spot()
 {
-	if (readyHead == NULL && readyTail == NULL) 
+	for (int s = tid_hint; s * TID_SEG_SIZE < tid_max; s ++)
 	{
-		return THREAD_NONE;
+		struct tid_seg* seg = tid_segs[s];
+		if (seg == NULL)
+		{
+			seg = calloc(1, sizeof(struct tid_seg));
+			if (seg == NULL) return THREAD_NOMEMORY;
+			tid_segs[s] = seg;
+		}
+		if (seg->nr_used == TID_SEG_SIZE) continue;
+		tid_hint = s;
+		int w = 0;
+		while (seg->used[w] == ~0UL) w ++;
+		int bit = __builtin_ctzl(~seg->used[w]);
+		int slot = s * TID_SEG_SIZE + w * TID_WORD_BITS + bit;
+		if (slot >= tid_max) break;
+		seg->used[w] |= 1UL << bit;
+		seg->nr_used ++;
+		nr_tids ++;
+		return slot;
 	}
-	ready_queue* temp = readyHead;
-	int rel = temp -> tid;
-	readyHead = readyHead -> next;
-	if (readyHead == NULL) readyTail = NULL;
-	free369(temp);
-	return rel;
+	return THREAD_NOMORE;
+}
+
+/* give slot, claimed by find_spot, the Tid of a new thread. the Tid of the
+ * slot's last thread, and its exit code, are gone from then on. */
+Tid new_tid(int slot)
+{
+	struct tid_entry* e = tid_slot(slot);
+	Tid gen = tid_tagged ? ((e->tid >> TID_SLOT_BITS) + 1) & TID_GEN_MASK : 0;
+	e->tid = gen << TID_SLOT_BITS | slot;
+	e->exited = false;
+	e->done = false;
+	e->killed = false;
+	e->value = NULL;
+	return e->tid;
+}
+
+void release_spot(Tid tid)
+{
+	int s = (tid & TID_SLOT_MASK) / TID_SEG_SIZE;
+	int i = tid % TID_SEG_SIZE;
+	struct tid_seg* seg = tid_segs[s];
+	seg->used[i / TID_WORD_BITS] &= ~(1UL << (i % TID_WORD_BITS));
+	seg->nr_used --;
+	nr_tids --;
+	if (s < tid_hint) tid_hint = s;
+}
+
+/* free the TCB and stack of a dead thread. the slot may already have been
+ * handed to a new thread, so only clear it if it is still ours. */
+void reap_thread(thread* th)
+{
+	stack_free(th->stack_bottom, th->stack_size);
+	struct tid_entry* e = tid_slot(th->tid & TID_SLOT_MASK);
+	if (e->th == th) e->th = NULL;
+	slab_free(&thread_cache, th);
 }
 
-int remove_from_queue(Tid tid)
+/* mark the thread dead and hand it to the reaper. it must already be off
+ * the ready queue and out of any wait queue. */
+void make_zombie(thread* th)
 {
-	ready_queue* cur = readyHead;
-	ready_queue* prev = NULL;
+	set_state(th, DYING);
+	release_spot(th->tid);
+	th->reap_next = reapHead;
+	reapHead = th;
+}
 
-	while (cur != NULL)
+/* free every thread on the reap list, except the current thread, which may
+ * still be running on its stack on its way out of thread_exit. */
+void reap_zombies()
+{
+	thread* keep = NULL;
+	Tid cur = this_worker()->cur_tid;
+	while (reapHead != NULL)
 	{
-		if (cur -> tid == tid)
+		thread* th = reapHead;
+		reapHead = th->reap_next;
+		if (cur >= 0 && th == tid_thread(cur))
 		{
-			if (prev == NULL)
-			{
-				readyHead = cur -> next; // deleting head.
-			} 
-			else
-			{
-				prev -> next = cur -> next; // deleting other.
-			}
-			if (cur == readyTail) readyTail = prev; // if deleing the tail.
-			free369(cur);
-			return 0;
-		}
-		else
-		{
-			prev = cur;
-			cur = cur -> next;
+			keep = th;
+			continue;
 		}
+		reap_thread(th);
+	}
+	if (keep != NULL)
+	{
+		keep->reap_next = NULL;
+		reapHead = keep;
 	}
-	return -1;
 }
 
-Tid find_spot()
+/* whether a thread other than the caller can run: a ready thread, or one
+ * running on another worker, which may yet wake the caller, or a thread that
+ * waits for a timeout or for I/O. */
+bool others_runnable()
 {
-	int t = -1;
-	for (int i = 0; i < THREAD_MAX_THREADS; ++ i)
-    {
-        if (thread_pool[i] == NULL || thread_pool[i]->state == DYING)
-        {
-            t = i;
-            break;
-        }
-    }
-	return t;
+	return nr_ready > 0 || nr_workers - nr_idle > 1 || !wheel_empty() || io_pending();
 }
 
-void clean_zombies()
+// threads made runnable after sleeping, see thread_wakeups.
+unsigned long nr_wakeups = 0;
+
+void lock_handoff(struct lock* lock);
+void lock_drop(struct lock* lock, thread* th);
+void locks_release(thread* th);
+void lock_unblock(thread* th);
+void prio_update(thread* th);
+int park_wake(const void* addr, int n);
+void park_put(const void* addr);
+struct wait_queue* park_queue(const void* addr, bool create);
+
+/* make th, which is asleep, runnable. */
+void wake_thread(thread* th)
+{
+	nr_wakeups ++;
+	trace(TRACE_WAKEUP, thread_id(), th->tid);
+	if (wheel_pending(&th->timeout)) wheel_del(&th->timeout);
+	th->sleep_wq = NULL;
+	th->wait_node = NULL;
+	set_state(th, READY);
+	enqueue(th);
+}
+
+/* called by the timer wheel when the sleep of a thread times out. */
+void timeout_expired(struct wheel_timer* t)
 {
-	for (int i = 0; i < THREAD_MAX_THREADS; i ++)
-    {
-        if (thread_pool[i] != NULL && thread_pool[i]->state == DYING && i != cur_tid)
-        {
-			wait_queue_destroy(thread_pool[i]->wq);
-			free369(thread_pool[i]->stack_bottom);
-            free369(thread_pool[i]);
-            thread_pool[i] = NULL;
-        }
-    }
+	thread* th = (thread*) ((char*) t - offsetof(thread, timeout));
+	if (th->state != SLEEP) return;
+	if (th->sleep_wq != NULL) remove_wait(th->wait_node, th->sleep_wq);
+	th->timed_out = true;
+	wake_thread(th);
+}
+
+/* wake the threads whose timeouts have expired. */
+void run_timers()
+{
+	if (!wheel_empty()) wheel_advance(wheel_time(0, false), timeout_expired);
 }
 
 /**************************************************************************
@@ -184,26 +558,450 @@ void clean_zombies()
  *               functions you need to implement. 
  **************************************************************************/
 
-void
-thread_init(void)
+/* fill in the fields every new TCB starts with. */
+void tcb_init(thread* th, Tid tid, int state, void* stack_bottom, size_t stack_size)
 {
+	th->tid = tid;
+	th->state = state;
+	th->stack_bottom = stack_bottom;
+	th->stack_size = stack_size;
+	th->name[0] = '\0';
+	th->detached = false;
+	th->sp = NULL;
+	th->ready_next = NULL;
+	th->ready_prev = NULL;
+	th->in_ready = false;
+	th->sleep_wq = NULL;
+	th->wait_node = NULL;
+	th->park_addr = NULL;
+	wheel_timer_init(&th->timeout);
+	th->timed_out = false;
+	th->handoff = NULL;
+	th->prio = THREAD_PRIO_DEFAULT;
+	th->eff_prio = THREAD_PRIO_DEFAULT;
+	th->blocked_on = NULL;
+	th->held_locks = NULL;
+	th->reap_next = NULL;
+	th->killed = false;
+	th->cleanup = NULL;
+	th->join_ret = THREAD_NONE;
+	th->join_value = NULL;
+	th->future = NULL;
+	th->level = 0;
+	th->ticks = 0;
+	th->tickets = DEFAULT_TICKETS;
+	th->pass = 0;
+	th->heap_idx = -1;
+	th->cpu = 0;
+	stats_init(th);
+}
+
+void caches_init(void);
+
+int
+thread_init_sched(const char* policy)
+{
+	int i;
+	for (i = 0; i < num_schedulers; i ++)
+	{
+		if (strcmp(schedulers[i].name, policy) == 0) break;
+	}
+	if (i == num_schedulers) return -1;
+	sched = &schedulers[i];
+	sched->init();
+	prio_sched = strcmp(policy, "prio") == 0;
+	caches_init();
+
 	/* Add necessary initialization for your threads library here. */
         /* Initialize the thread control block for the first thread */
-    thread* t = (thread *)malloc369(sizeof(thread));
-	t->tid = 0;
-    t->state = RUNNING;
-    t->stack_bottom = NULL;
-	t->wq = NULL;
+    thread* t = slab_alloc(&thread_cache);
+	// the first thread always gets Tid 0, whether or not Tids are tagged.
+	int slot = find_spot();
+	assert(slot == 0);
+	tcb_init(t, 0, RUNNING, NULL, 0);
+	strcpy(t->name, "main");
 	getcontext(&t->mycontext);
-    cur_tid = t->tid;
-    thread_pool[t->tid] = t;
+	workers[0].id = 0;
+	workers[0].cur_tid = t->tid;
+	self_worker = &workers[0];
+	tid_slot(slot)->th = t;
 	// t->exit_code = -50;
+	return 0;
+}
+
+void
+thread_init(void)
+{
+	int ret = thread_init_sched(DEFAULT_SCHED);
+	assert(!ret);
+}
+
+/* block the idle worker w until a thread may have been made runnable:
+ * until idle_seq moves on from seq, a signal arrives, or timeout (if not
+ * NULL) runs out. while threads wait for I/O, one worker waits in epoll
+ * instead, and wakes them as their fds become ready. the time is added to
+ * the worker's idle time. */
+void idle_wait(struct worker* w, unsigned int seq, struct timespec* timeout)
+{
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (io_pending() && !io_polling()) io_poll(timeout);
+	else
+	{
+		interrupts_on();
+		syscall(SYS_futex, &idle_seq, FUTEX_WAIT_PRIVATE, seq, timeout, NULL, 0);
+		interrupts_off();
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	w->idle_nsecs += (end.tv_sec - start.tv_sec) * 1000000000UL + end.tv_nsec - start.tv_nsec;
+}
+
+/* the idle loop of a worker, entered with interrupts disabled. it runs
+ * whatever thread it can find, from its own run queue or by stealing, and
+ * otherwise waits until a thread is made runnable or a timeout expires. */
+void worker_idle()
+{
+	// the idle loop never moves to another worker.
+	struct worker* w = this_worker();
+	for (;;)
+	{
+		if (reapHead != NULL) reap_zombies();
+		run_timers();
+		thread* th = dequeue();
+		if (th != NULL)
+		{
+			nr_idle --;
+			// the ticks may have stopped while the worker was idle.
+			if (nr_ready > 0) interrupts_stop_ticks(false);
+			w->cur_tid = th->tid;
+			set_state(th, RUNNING);
+			trace(TRACE_RUN, THREAD_NONE, th->tid);
+			if (use_ucontext) swapcontext(&w->idle_context, &th->mycontext);
+			else thread_switch(&w->idle_sp, th->sp);
+			continue;
+		}
+		unsigned int seq = idle_seq;
+		struct timespec ts;
+		struct timespec* timeout = NULL;
+		unsigned long next = wheel_next();
+		if (next != 0)
+		{
+			unsigned long now = wheel_time(0, false);
+			if (next <= now) continue;
+			long usecs = (next - now) * WHEEL_TICK_USECS;
+			ts.tv_sec = usecs / 1000000;
+			ts.tv_nsec = (usecs % 1000000) * 1000;
+			timeout = &ts;
+		}
+		idle_wait(w, seq, timeout);
+	}
+}
+
+/* give worker 0 an idle loop, or start it over. it idles on a stack of its
+ * own, since the stack of its kernel thread belongs to thread 0, which can
+ * move to other workers. the other workers idle on the stacks of their
+ * kernel threads. */
+void idle_init(struct worker* w)
+{
+	if (w->idle_stack == NULL) w->idle_stack = stack_alloc(THREAD_MIN_STACK);
+	void* stack = w->idle_stack;
+	assert(stack);
+	// build the frame thread_switch pops, returning into worker_idle as
+	// if it had been called.
+	unsigned long* sp = (unsigned long*) (stack + THREAD_MIN_STACK);
+	*--sp = 0;
+	*--sp = (unsigned long) &worker_idle;
+	for (int i = 0; i < 6; i ++) *--sp = 0; // rbp, rbx, r12-r15
+	*--sp = INITIAL_FPU_STATE;
+	w->idle_sp = sp;
+	// the same entry for the ucontext path, below that frame. the caller
+	// has interrupts disabled, so the idle loop starts with them disabled
+	// too.
+	getcontext(&w->idle_context);
+	w->idle_context.uc_stack.ss_sp = stack;
+	w->idle_context.uc_stack.ss_size = (void*) sp - stack;
+	w->idle_context.uc_link = NULL;
+	makecontext(&w->idle_context, worker_idle, 0);
+}
+
+void* worker_main(void* arg)
+{
+	struct worker* w = arg;
+	self_worker = w;
+	interrupts_init_worker(w->id);
+	__atomic_add_fetch(&nr_started, 1, __ATOMIC_SEQ_CST);
+	interrupts_off();
+	worker_idle();
+	return NULL;
+}
+
+int
+thread_init_workers(int nworkers)
+{
+	if (nworkers < 1 || nworkers > THREAD_MAX_WORKERS) return -1;
+	int ret = thread_init_sched("steal");
+	assert(!ret);
+	if (nworkers == 1) return 0;
+
+	nr_workers = nworkers;
+	nr_idle = nworkers - 1;
+	interrupts_init_worker(0);
+
+	for (int i = 1; i < nworkers; i ++)
+	{
+		workers[i].id = i;
+		workers[i].cur_tid = THREAD_NONE;
+		ret = pthread_create(&workers[i].pthread, NULL, worker_main, &workers[i]);
+		assert(!ret);
+	}
+	// wait for every worker to set up its timer.
+	while (__atomic_load_n(&nr_started, __ATOMIC_SEQ_CST) < nworkers - 1)
+	{
+		sched_yield();
+	}
+	return 0;
+}
+
+int
+thread_set_max_threads(int max)
+{
+	bool enabled = interrupts_off();
+	if (max < tid_max || max > THREAD_TABLE_MAX)
+	{
+		interrupts_set(enabled);
+		return THREAD_INVALID;
+	}
+	tid_max = max;
+	if (max > THREAD_MAX_THREADS) tid_tagged = true;
+	interrupts_set(enabled);
+	return 0;
+}
+
+const char*
+thread_sched_name(void)
+{
+	return sched->name;
+}
+
+unsigned long
+thread_wakeups(void)
+{
+	return __atomic_load_n(&nr_wakeups, __ATOMIC_RELAXED);
+}
+
+unsigned long
+thread_idle_usecs(void)
+{
+	bool enabled = interrupts_off();
+	unsigned long nsecs = 0;
+	for (int i = 0; i < nr_workers; i ++) nsecs += workers[i].idle_nsecs;
+	interrupts_set(enabled);
+	return nsecs / 1000;
+}
+
+int
+thread_stats(Tid tid, struct thread_stats *stats)
+{
+#ifdef THREAD_STATS
+	bool enabled = interrupts_off();
+	if (tid == THREAD_SELF) tid = thread_id();
+	if (tid_thread(tid) == NULL || tid_thread(tid)->state == DYING)
+	{
+		interrupts_set(enabled);
+		return THREAD_INVALID;
+	}
+	thread* th = tid_thread(tid);
+	// bring the time in the current state up to date.
+	stats_charge(th, now_ns());
+	struct thread_acct* a = &th->acct;
+	stats->voluntary = a->voluntary;
+	stats->involuntary = a->involuntary;
+	stats->run_usecs = a->run_ns / 1000;
+	stats->ready_usecs = a->ready_ns / 1000;
+	stats->blocked_usecs = a->blocked_ns / 1000;
+	stats->max_ready_usecs = a->max_ready_ns / 1000;
+	interrupts_set(enabled);
+	return 0;
+#else
+	return THREAD_INVALID;
+#endif
+}
+
+int
+thread_sched_stats(struct thread_sched_stats *stats)
+{
+#ifdef THREAD_STATS
+	bool enabled = interrupts_off();
+	*stats = sched_stats;
+	stats->nr_threads = 0;
+	stats->nr_blocked = 0;
+	stats->nr_threads = nr_tids;
+	for (int slot = 0; slot < tid_max; slot ++)
+	{
+		struct tid_entry* e = tid_slot(slot);
+		if (e == NULL) slot += TID_SEG_SIZE - 1;
+		else if (e->th != NULL && e->th->state == SLEEP) stats->nr_blocked ++;
+	}
+	stats->nr_ready = nr_ready;
+	interrupts_set(enabled);
+	return 0;
+#else
+	return THREAD_INVALID;
+#endif
+}
+
+void
+thread_stats_dump(void)
+{
+#ifdef THREAD_STATS
+	struct thread_sched_stats ss;
+	struct thread_stats ts;
+	thread_sched_stats(&ss);
+	unintr_printf("sched %s: %d threads, %d ready, %d blocked, max ready %d\n",
+		      sched->name, ss.nr_threads, ss.nr_ready, ss.nr_blocked, ss.max_ready);
+	unintr_printf("  %lu ticks, %lu switches, average ready %.2f, idle %lu us\n",
+		      ss.ticks, ss.switches, ss.ticks ? (double) ss.ready_len_sum / ss.ticks : 0.0,
+		      thread_idle_usecs());
+	unintr_printf("%6s %-15s %10s %10s %12s %12s %12s %12s %9s\n", "tid", "name", "vol", "invol",
+		      "run us", "ready us", "blocked us", "max wait us", "stack KB");
+	// threads can come and go while the others are printed.
+	for (int slot = 0; slot < tid_max; slot ++)
+	{
+		bool enabled = interrupts_off();
+		struct tid_entry* e = tid_slot(slot);
+		Tid tid = e != NULL && e->th != NULL ? e->tid : THREAD_INVALID;
+		interrupts_set(enabled);
+		// skip segments that were never allocated.
+		if (e == NULL) slot += TID_SEG_SIZE - 1;
+		char name[THREAD_NAME_LEN];
+		if (e == NULL || thread_stats(tid, &ts) < 0 || thread_getname(tid, name, sizeof(name)) < 0) continue;
+		// the high-water mark, or 0 for the initial thread.
+		long stack = thread_stack_usage(tid);
+		unintr_printf("%6d %-15s %10lu %10lu %12lu %12lu %12lu %12lu %9ld\n", tid, name,
+			      ts.voluntary, ts.involuntary, ts.run_usecs,
+			      ts.ready_usecs, ts.blocked_usecs, ts.max_ready_usecs,
+			      stack > 0 ? stack / 1024 : 0);
+	}
+#else
+	unintr_printf("thread stats are not compiled in (build with -DTHREAD_STATS)\n");
+#endif
+}
+
+int
+thread_set_tickets(Tid tid, int tickets)
+{
+	bool enabled = interrupts_off();
+	if (tid == THREAD_SELF) tid = thread_id();
+	if (tid_thread(tid) == NULL || tid_thread(tid)->state == DYING || tickets <= 0)
+	{
+		interrupts_set(enabled);
+		return THREAD_INVALID;
+	}
+	tid_thread(tid)->tickets = tickets;
+	interrupts_set(enabled);
+	return 0;
+}
+
+int
+thread_setprio(Tid tid, int prio)
+{
+	bool enabled = interrupts_off();
+	if (tid == THREAD_SELF) tid = thread_id();
+	if (tid_thread(tid) == NULL || tid_thread(tid)->state == DYING || prio < THREAD_PRIO_MIN || prio > THREAD_PRIO_MAX)
+	{
+		interrupts_set(enabled);
+		return THREAD_INVALID;
+	}
+	tid_thread(tid)->prio = prio;
+	prio_update(tid_thread(tid));
+	interrupts_set(enabled);
+	return 0;
+}
+
+int
+thread_getprio(Tid tid)
+{
+	bool enabled = interrupts_off();
+	if (tid == THREAD_SELF) tid = thread_id();
+	if (tid_thread(tid) == NULL || tid_thread(tid)->state == DYING)
+	{
+		interrupts_set(enabled);
+		return THREAD_INVALID;
+	}
+	int prio = tid_thread(tid)->eff_prio;
+	interrupts_set(enabled);
+	return prio;
+}
+
+int
+thread_getname(Tid tid, char *name, size_t len)
+{
+	bool enabled = interrupts_off();
+	if (tid == THREAD_SELF) tid = thread_id();
+	if (tid_thread(tid) == NULL || tid_thread(tid)->state == DYING || len == 0)
+	{
+		interrupts_set(enabled);
+		return THREAD_INVALID;
+	}
+	snprintf(name, len, "%s", tid_thread(tid)->name);
+	interrupts_set(enabled);
+	return 0;
+}
+
+long
+thread_stack_usage(Tid tid)
+{
+	bool enabled = interrupts_off();
+	if (tid == THREAD_SELF) tid = thread_id();
+	if (tid_thread(tid) == NULL || tid_thread(tid)->state == DYING || tid_thread(tid)->stack_bottom == NULL)
+	{
+		interrupts_set(enabled);
+		return THREAD_INVALID;
+	}
+	thread* th = tid_thread(tid);
+	long used = stack_touched(th->stack_bottom, th->stack_size);
+	interrupts_set(enabled);
+	return used;
+}
+
+void exit_current(int exit_code, void* value, bool exited);
+Tid yield(Tid want_tid, bool preempted);
+
+/* called by the interrupt handler on every timer tick. */
+void
+thread_tick(void)
+{
+	bool enabled = interrupts_off();
+	Tid cur = this_worker()->cur_tid;
+	stats_tick();
+	run_timers();
+	if (io_pending())
+	{
+		struct timespec zero = { 0, 0 };
+		io_poll(&zero);
+	}
+	// nothing to preempt on an idle worker, or to switch to when no
+	// thread is ready or waiting for a timeout or I/O. stop the ticks
+	// until enqueue starts them again.
+	if (cur == THREAD_NONE || (nr_ready == 0 && wheel_empty() && !io_pending()))
+	{
+		interrupts_stop_ticks(true);
+	}
+	if (cur == THREAD_NONE)
+	{
+		interrupts_set(enabled);
+		return;
+	}
+	if (tid_thread(cur)->killed) exit_current(-SIGKILL, NULL, false);
+	bool preempt = sched->on_tick(tid_thread(cur));
+	interrupts_set(enabled);
+	if (preempt) yield(THREAD_ANY, true);
 }
 
 Tid
 thread_id()
 {
-	return cur_tid;
+	return this_worker()->cur_tid;
 }
 
 
@@ -213,159 +1011,396 @@ thread_id()
 void
 thread_stub(void (*thread_main)(void *), void *arg)
 {
+		// a thread that exited just before the switch to this one is off
+		// its stack now.
+		if (reapHead != NULL) reap_zombies();
 		interrupts_on();
 		thread_main(arg); // call thread_main() function with arg
         thread_exit(0);
 }
 
+// what thread_create and thread_attr_init use.
+static const struct thread_attr default_attr = {
+	.stack_size = THREAD_MIN_STACK,
+	.prio = THREAD_PRIO_DEFAULT,
+	.name = NULL,
+	.detached = false,
+};
+
 Tid
 thread_create(void (*fn) (void *), void *parg)
 {
+	return thread_create_attr(fn, parg, &default_attr);
+}
+
+Tid
+thread_create_prio(void (*fn) (void *), void *parg, int prio)
+{
+	struct thread_attr attr = default_attr;
+	attr.prio = prio;
+	return thread_create_attr(fn, parg, &attr);
+}
+
+void
+thread_attr_init(struct thread_attr *attr)
+{
+	*attr = default_attr;
+}
+
+Tid
+thread_create_attr(void (*fn) (void *), void *parg, const struct thread_attr *attr)
+{
+	int prio = attr->prio;
+	if (prio < THREAD_PRIO_MIN || prio > THREAD_PRIO_MAX) return THREAD_INVALID;
+	// the cap also keeps the rounding below, and the guard page added by
+	// stack_alloc, from wrapping around.
+	if (attr->stack_size < THREAD_ATTR_MIN_STACK || attr->stack_size > THREAD_ATTR_MAX_STACK) return THREAD_INVALID;
+	// whole pages, so that the top of the stack is page aligned.
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t stack_size = (attr->stack_size + page - 1) & ~(page - 1);
 	bool sig_enable = interrupts_off();
 	// before finding avaliable spot, clean out zombies.
-    // clean_zombies();
+	if (reapHead != NULL) reap_zombies();
     // find an available spot.
-    Tid t = find_spot();
-    if (t == -1) 
+    int slot = find_spot();
+    if (slot < 0) 
 	{
 		interrupts_set(sig_enable);
-		return THREAD_NOMORE;
+		return slot;
 	}
-	// malloc necessary space.
-    void* s_ptr = malloc369(THREAD_MIN_STACK);
+	// get a stack, from the pool if one is cached.
+    void* s_ptr = stack_alloc(stack_size);
     if (!s_ptr) 
 	{
+		release_spot(slot);
 		interrupts_set(sig_enable);
 		return THREAD_NOMEMORY;
 	}
 
-	thread * th = (thread *)malloc369(sizeof(thread));
-	thread_pool[t] = th;
+	thread * th = slab_alloc(&thread_cache);
+	Tid t = new_tid(slot);
+	tid_slot(slot)->th = th;
 
-	th->tid = t;
-	th->state = READY;
-	th->stack_bottom = s_ptr;
-	th->wq = NULL;
+	tcb_init(th, t, READY, s_ptr, stack_size);
+	th->prio = prio;
+	th->eff_prio = prio;
+	th->detached = attr->detached;
+	if (attr->name != NULL)
+	{
+		strncpy(th->name, attr->name, THREAD_NAME_LEN - 1);
+		th->name[THREAD_NAME_LEN - 1] = '\0';
+	}
 	// th->exit_code = -50;
-	getcontext(&th->mycontext);
-	// getting current context and modifiy registers.
-	th->mycontext.uc_mcontext.gregs[REG_RIP] = (greg_t) &thread_stub;
-	th->mycontext.uc_mcontext.gregs[REG_RDI] = (greg_t) fn;
-	th->mycontext.uc_mcontext.gregs[REG_RSI] = (greg_t) parg;
-	th->mycontext.uc_mcontext.gregs[REG_RSP] = (greg_t) (th->stack_bottom + THREAD_MIN_STACK - 8);
-	enqueue(t);
+	if (use_ucontext)
+	{
+		getcontext(&th->mycontext);
+		// getting current context and modifiy registers.
+		th->mycontext.uc_mcontext.gregs[REG_RIP] = (greg_t) &thread_stub;
+		th->mycontext.uc_mcontext.gregs[REG_RDI] = (greg_t) fn;
+		th->mycontext.uc_mcontext.gregs[REG_RSI] = (greg_t) parg;
+		th->mycontext.uc_mcontext.gregs[REG_RSP] = (greg_t) (th->stack_bottom + th->stack_size - 8);
+	}
+	else
+	{
+		// build the frame thread_switch pops, returning into thread_start.
+		// the stack top is page aligned, so thread_start calls
+		// thread_stub with a 16-byte aligned stack.
+		unsigned long* sp = (unsigned long*) (th->stack_bottom + th->stack_size);
+		*--sp = (unsigned long) &thread_start;
+		*--sp = 0; // rbp
+		*--sp = 0; // rbx
+		*--sp = (unsigned long) fn; // r12
+		*--sp = (unsigned long) parg; // r13
+		*--sp = 0; // r14
+		*--sp = 0; // r15
+		*--sp = INITIAL_FPU_STATE;
+		th->sp = sp;
+	}
+	enqueue(th);
+	trace(TRACE_CREATE, thread_id(), t);
 	interrupts_set(sig_enable);
 	return t;
 }
 
-Tid
-thread_yield(Tid want_tid)
+/* save the running thread's registers in prev and resume next. every switch
+ * happens with interrupts disabled, so the signal mask is the same on both
+ * sides and thread_switch need not save or restore it. the ucontext path
+ * does, at the cost of a sigprocmask call in getcontext and in setcontext. */
+void switch_to(thread* prev, thread* next)
+{
+	if (use_ucontext)
+	{
+		swapcontext(&prev->mycontext, &next->mycontext);
+	}
+	else
+	{
+		thread_switch(&prev->sp, next->sp);
+	}
+}
+
+void
+thread_use_ucontext(bool enable)
 {
 	bool enabled = interrupts_off();
-	if (want_tid < -2 || want_tid >= THREAD_MAX_THREADS || (want_tid > 0 && (thread_pool[want_tid] == NULL || thread_pool[want_tid]->state == DYING)))
+	// contexts saved by one path cannot be resumed by the other, so the
+	// caller must be the only thread.
+	assert(nr_tids == 1);
+	// the other workers idle on their kernel threads' stacks, and cannot
+	// start over.
+	assert(nr_workers == 1);
+	use_ucontext = enable;
+	// the idle loop of this worker last switched away on the old path,
+	// so it starts over.
+	if (this_worker()->idle_sp != NULL) idle_init(this_worker());
+	interrupts_set(enabled);
+}
+
+/* thread_yield, where preempted tells whether the caller is being preempted
+ * by a tick, for thread_stats. */
+Tid yield(Tid want_tid, bool preempted)
+{
+	bool enabled = interrupts_off();
+	struct worker* w = this_worker();
+	thread* prev = tid_thread(w->cur_tid);
+	if (prev->killed && prev->state == RUNNING) exit_current(-SIGKILL, NULL, false);
+	// look the thread up once, the rest of the switch goes by its TCB.
+	thread* next = want_tid >= 0 ? tid_thread(want_tid) : NULL;
+	if (want_tid < -2 || (want_tid >= 0 && (next == NULL || next->state == DYING)))
 	{
 		interrupts_set(enabled);
 		return THREAD_INVALID;
 	}
 
-	if (want_tid == THREAD_SELF || want_tid == cur_tid)
+	if (want_tid == THREAD_SELF || want_tid == w->cur_tid)
 	{
 		interrupts_set(enabled);
-		return cur_tid;
+		return w->cur_tid;
+	}
+
+	// already running on another worker.
+	if (next != NULL && next->state == RUNNING)
+	{
+		interrupts_set(enabled);
+		return want_tid;
 	}
 
 	if (want_tid == THREAD_ANY)
 	{
-		want_tid = dequeue();
-		if (want_tid == THREAD_NONE) 
+		next = dequeue();
+		while (next != NULL && next->state == DYING)
 		{
-			interrupts_set(enabled);
-			return THREAD_NONE;
+			next = dequeue();
 		}
-
-		while (thread_pool[want_tid] == NULL || thread_pool[want_tid]->state == DYING)
+		want_tid = next != NULL ? next->tid : THREAD_NONE;
+		if (want_tid == THREAD_NONE && prev->state == RUNNING)
 		{
-			want_tid = dequeue();
-			if (want_tid == THREAD_NONE) 
-			{
-				interrupts_set(enabled);
-				return THREAD_NONE;
-			}
+			interrupts_set(enabled);
+			return THREAD_NONE;
 		}
 	}
-	int setcontext_called = 0;
 	// put cur to sleep and alter TCB.
-	if (thread_pool[cur_tid]->state == RUNNING)
+	unsigned long now = stats_switch(prev, preempted);
+	trace(preempted ? TRACE_PREEMPT : prev->state == RUNNING ? TRACE_YIELD : prev->state == SLEEP ? TRACE_SLEEP : TRACE_EXIT, prev->tid, want_tid);
+	if (prev->state == RUNNING)
 	{
-		thread_pool[cur_tid]->state = READY;
-		enqueue(cur_tid);
+		set_state_at(prev, READY, now);
+		enqueue(prev);
 	}
-	// save current context for future resume.
-	getcontext(&thread_pool[cur_tid]->mycontext);
-	// kill zombie thread if yield is called from exit.
-	clean_zombies();
-	if (setcontext_called) 
+	// save current context and restore the wanted one. returns once
+	// something switches back to prev.
+	if (want_tid == THREAD_NONE)
 	{
-		// if (thread_pool[cur_tid]->state == ZOMBIE) {
-		// 	thread_exit(thread_pool[cur_tid]->exit_code);
-		// }
-		interrupts_set(enabled);
-		return want_tid;
+		// prev is going to sleep or exiting and this worker has nothing
+		// else to run, but a thread on another worker or a timeout can
+		// still wake prev. run the worker's idle loop until then.
+		if (w->idle_sp == NULL) idle_init(w);
+		nr_idle ++;
+		w->cur_tid = THREAD_NONE;
+		if (use_ucontext) swapcontext(&prev->mycontext, &w->idle_context);
+		else thread_switch(&prev->sp, w->idle_sp);
+		want_tid = prev->tid;
+	}
+	else
+	{
+		remove_from_queue(next);
+		w->cur_tid = want_tid;
+		set_state_at(next, RUNNING, now);
+		switch_to(prev, next);
 	}
-	
-	setcontext_called = 1;
-	remove_from_queue(want_tid);
-	cur_tid = want_tid;
-	thread_pool[cur_tid]->state = RUNNING;
-	//restore the wanted context.
-	setcontext(&thread_pool[cur_tid]->mycontext);
 
-	return THREAD_FAILED;
+	// the switch is done, so threads that exited before it are off
+	// their stacks and can be freed.
+	if (reapHead != NULL) reap_zombies();
+	interrupts_set(enabled);
+	return want_tid;
 }
 
-void
-thread_exit(int exit_code)
+Tid
+thread_yield(Tid want_tid)
+{
+	return yield(want_tid, false);
+}
+
+struct thread_future {
+	void* (*fn)(void*);
+	void* arg;
+	// THREAD_NONE while the task runs, then 0, or THREAD_FAILED if it
+	// was killed.
+	Tid ret;
+	void* value;
+};
+
+/* make every thread waiting for th to end runnable again. thread_wait
+ * parks on the TCB of th, thread_join on its slot in the thread table, and
+ * thread_future_get on its future. each thread in thread_join is handed
+ * ret and value as it is woken, since the slot may be given to a new
+ * thread before it runs. */
+void wake_joiners(thread* th, Tid ret, void* value)
+{
+	park_wake(th, INT_MAX);
+	struct tid_entry* e = tid_slot(th->tid & TID_SLOT_MASK);
+	struct wait_queue* wq = park_queue(e, false);
+	if (wq != NULL)
+	{
+		for (wait_node* node = wq->waitHead; node != NULL; node = node -> next)
+		{
+			thread* joiner = tid_thread(node -> tid);
+			joiner->join_ret = ret;
+			joiner->join_value = value;
+		}
+		park_wake(e, INT_MAX);
+	}
+	if (th->future != NULL)
+	{
+		th->future->ret = ret == th->tid ? 0 : ret;
+		th->future->value = value;
+		park_wake(th->future, INT_MAX);
+	}
+}
+
+/* record how th ended in its slot, for thread_wait and thread_join, and
+ * wake its joiners. a thread that was killed first runs its cleanup
+ * handlers, while its stack is still there. */
+void end_thread(thread* th, int exit_code, void* value, bool exited)
 {
-	bool sig_enable = interrupts_off();
-	// also messed up cleaning process.
-	thread_pool[cur_tid]->state = DYING;
-	remove_from_queue(cur_tid);
-	exit_arr[cur_tid] = exit_code;
-	if (thread_pool[cur_tid]->wq != NULL)
+	if (!exited)
 	{
-		while (thread_pool[cur_tid]->wq->waitHead != NULL)
-		{
-			Tid tid = dequeue_wait(thread_pool[cur_tid]->wq);
-			enqueue(tid);
-		}
+		for (struct thread_cleanup* c = th->cleanup; c != NULL; c = c->next) c->fn(c->arg);
+		locks_release(th);
 	}
-	if (readyHead == NULL) {
+	th->cleanup = NULL;
+	struct tid_entry* e = tid_slot(th->tid & TID_SLOT_MASK);
+	e->exit_code = exit_code;
+	// nobody may collect the exit code of a detached thread.
+	e->exited = exited && !th->detached;
+	e->done = !th->detached;
+	e->killed = !exited;
+	e->value = value;
+	wake_joiners(th, exited ? th->tid : THREAD_FAILED, value);
+}
+
+/* end the running thread, which exited with exit_code, or was killed. the
+ * caller has interrupts disabled, and they stay disabled until the switch
+ * away from the dead thread's stack is done, so no other worker can reap
+ * it while it is still running. */
+void exit_current(int exit_code, void* value, bool exited)
+{
+	thread* th = tid_thread(thread_id());
+	th->killed = false;
+	remove_from_queue(th);
+	end_thread(th, exit_code, value, exited);
+	make_zombie(th);
+	if (!others_runnable()) {
 		exit(exit_code);
 	}
-	interrupts_set(sig_enable);
 	thread_yield(THREAD_ANY);
+	assert(0);
+}
+
+void
+thread_exit(int exit_code)
+{
+	interrupts_off();
+	exit_current(exit_code, NULL, true);
+}
+
+void
+thread_exit_value(void *value)
+{
+	interrupts_off();
+	exit_current(0, value, true);
 }
 
 Tid
 thread_kill(Tid tid)
 {
 	bool sig_enable = interrupts_off();
-	if (tid < -2 || tid >= THREAD_MAX_THREADS || (tid > 0 && (thread_pool[tid] == NULL || thread_pool[tid]->state == DYING)))
+	if (tid < 0 || tid_thread(tid) == NULL || tid_thread(tid)->state == DYING)
 	{
 		interrupts_set(sig_enable);
 		return THREAD_INVALID;
 	}
-	if (cur_tid == tid) 
+	if (thread_id() == tid) 
 	{
 		interrupts_set(sig_enable);
 		return THREAD_INVALID;
 	}
-	// messup my clean function dont know how to fix.
-	thread_pool[tid]->state = DYING;
+	thread* th = tid_thread(tid);
+	if (th->state == RUNNING)
+	{
+		// it is running on another worker, and will kill itself at
+		// its next tick or yield.
+		th->killed = true;
+		interrupts_set(sig_enable);
+		return tid;
+	}
+	remove_from_queue(th);
+	if (th->sleep_wq != NULL)
+	{
+		remove_wait(th->wait_node, th->sleep_wq);
+		th->sleep_wq = NULL;
+		th->wait_node = NULL;
+	}
+	if (th->park_addr != NULL)
+	{
+		park_put(th->park_addr);
+		th->park_addr = NULL;
+	}
+	if (wheel_pending(&th->timeout)) wheel_del(&th->timeout);
+	if (th->blocked_on != NULL) lock_unblock(th);
+	trace(TRACE_KILL, thread_id(), tid);
+	end_thread(th, -SIGKILL, NULL, false);
+	// it is not running, so unlike a thread that exits, it can be freed
+	// right away rather than after the next switch.
+	set_state(th, DYING);
+	release_spot(th->tid);
+	reap_thread(th);
 	interrupts_set(sig_enable);
 	return tid;
 }
 
+void
+thread_cleanup_push(struct thread_cleanup *c, void (*fn)(void *), void *arg)
+{
+	bool enabled = interrupts_off();
+	thread* th = tid_thread(thread_id());
+	c->fn = fn;
+	c->arg = arg;
+	c->next = th->cleanup;
+	th->cleanup = c;
+	interrupts_set(enabled);
+}
+
+void
+thread_cleanup_pop(struct thread_cleanup *c)
+{
+	bool enabled = interrupts_off();
+	thread* th = tid_thread(thread_id());
+	assert(th->cleanup == c);
+	th->cleanup = c->next;
+	interrupts_set(enabled);
+}
+
 /**************************************************************************
  * Important: The rest of the code should be implemented in Assignment 2. *
  **************************************************************************/
@@ -376,43 +1411,88 @@ wait_queue_create()
 {
 	bool enabled = interrupts_off();
 	struct wait_queue *wq;
-	wq = malloc369(sizeof(struct wait_queue));
-	assert(wq);
-	wq->waitHead = NULL;
-	wq->waitTail = NULL;
+	// it comes out of the cache empty, see wait_queue_ctor.
+	wq = slab_alloc(&wait_queue_cache);
 	interrupts_set(enabled);
 	return wq;
 }
 
+int
+wait_queue_length(struct wait_queue *wq)
+{
+	bool enabled = interrupts_off();
+	int length = wq->length;
+	interrupts_set(enabled);
+	return length;
+}
+
 void
 wait_queue_destroy(struct wait_queue *wq)
 {
 	bool sig_enable = interrupts_off();
 	if (wq != NULL) {
-		free369(wq);
+		assert(wq->waitHead == NULL);
+		slab_free(&wait_queue_cache, wq);
 	}
 	interrupts_set(sig_enable);
 }
 
+/* put the caller to sleep on queue, which may be NULL, until it is woken
+ * up, or until usecs have passed if usecs is not negative. returns
+ * THREAD_TIMEDOUT if the time ran out, and otherwise what thread_sleep
+ * returns. */
+Tid sleep_timeout(struct wait_queue* queue, long usecs)
+{
+	bool enabled = interrupts_off();
+	thread* th = tid_thread(thread_id());
+	// with a timeout, the caller can always be woken.
+	if (usecs < 0 && !others_runnable())
+	{
+		interrupts_set(enabled);
+		return THREAD_NONE;
+	}
+	sched->on_block(th);
+	set_state(th, SLEEP);
+	th->sleep_wq = queue;
+	th->timed_out = false;
+	if (queue != NULL) th->wait_node = enqueue_wait(th->tid, queue);
+	if (usecs >= 0) wheel_add(&th->timeout, wheel_time(usecs, true));
+
+	// interrupts stay off until the switch, or another worker could
+	// wake this thread and run it before it is off its stack.
+	Tid ret = thread_yield(THREAD_ANY);
+	// thread_yield(tid) can run a sleeping thread without waking it.
+	if (th->sleep_wq != NULL)
+	{
+		remove_wait(th->wait_node, th->sleep_wq);
+		th->sleep_wq = NULL;
+		th->wait_node = NULL;
+	}
+	if (wheel_pending(&th->timeout)) wheel_del(&th->timeout);
+	if (th->timed_out) ret = THREAD_TIMEDOUT;
+	interrupts_set(enabled);
+	return ret;
+}
+
 Tid
 thread_sleep(struct wait_queue *queue)
 {
-	bool enabled = interrupts_off();
 	if (queue == NULL)
 	{
-		interrupts_set(enabled);
 		return THREAD_INVALID;
 	}
-	if (readyHead == NULL && readyTail == NULL)
+	return sleep_timeout(queue, -1);
+}
+
+int
+thread_sleep_for(long usecs)
+{
+	if (usecs < 0)
 	{
-		interrupts_set(enabled);
-		return THREAD_NONE;
+		return THREAD_INVALID;
 	}
-	thread_pool[thread_id()]->state = SLEEP;
-	enqueue_wait(thread_id(), queue);
-
-	interrupts_set(enabled);
-	return thread_yield(THREAD_ANY);
+	sleep_timeout(NULL, usecs);
+	return 0;
 }
 
 /* when the 'all' parameter is 1, wakeup all threads waiting in the queue.
@@ -433,68 +1513,341 @@ thread_wakeup(struct wait_queue *queue, int all)
 		while (queue->waitHead != NULL)
 		{
 			Tid tid = dequeue_wait(queue);
-			thread_pool[tid]->state = READY;
-			enqueue(tid);
+			wake_thread(tid_thread(tid));
 			num_woken ++;
 		}
 	}
 	else
 	{
 		Tid tid = dequeue_wait(queue);
-		thread_pool[tid]->state = READY;
-		enqueue(tid);
+		wake_thread(tid_thread(tid));
 		num_woken ++;
 	}
 	interrupts_set(enabled);
 	return num_woken;
 }
 
+/* The parking lot: threads park on an address rather than a wait queue of
+ * their own. The queues are kept in a hash table keyed by address, and
+ * there is only a queue for an address while a thread is parked on it, so
+ * a waitable object can be a single word. */
+KHASH_MAP_INIT_INT64(parklot, struct wait_queue*)
+static khash_t(parklot)* parklot = NULL;
+
+/* return the queue of the threads parked on addr. if there is none, it is
+ * created if create is set, and NULL is returned otherwise. */
+struct wait_queue* park_queue(const void* addr, bool create)
+{
+	if (parklot == NULL) parklot = kh_init(parklot);
+	khiter_t k = kh_get(parklot, parklot, (size_t)addr);
+	if (k != kh_end(parklot)) return kh_value(parklot, k);
+	if (!create) return NULL;
+
+	int ret;
+	k = kh_put(parklot, parklot, (size_t)addr, &ret);
+	assert(ret > 0);
+	kh_value(parklot, k) = wait_queue_create();
+	return kh_value(parklot, k);
+}
+
+/* free the queue of addr once no thread is parked on it any more. */
+void park_put(const void* addr)
+{
+	khiter_t k = kh_get(parklot, parklot, (size_t)addr);
+	if (k == kh_end(parklot) || kh_value(parklot, k)->waitHead != NULL) return;
+	wait_queue_destroy(kh_value(parklot, k));
+	kh_del(parklot, parklot, k);
+}
+
+/* park the caller on addr, like sleep_timeout. interrupts must be off. */
+Tid park_sleep(const void* addr, long usecs)
+{
+	thread* th = tid_thread(thread_id());
+	th->park_addr = addr;
+	Tid ret = sleep_timeout(park_queue(addr, true), usecs);
+	th->park_addr = NULL;
+	// a timeout or failed sleep leaves the caller to free the queue.
+	park_put(addr);
+	return ret;
+}
+
+/* wake up to n threads parked on addr, returning how many were woken. */
+int park_wake(const void* addr, int n)
+{
+	struct wait_queue* wq = park_queue(addr, false);
+	int num_woken = 0;
+	if (wq == NULL) return 0;
+	while (num_woken < n && wq->waitHead != NULL)
+	{
+		thread* th = tid_thread(dequeue_wait(wq));
+		th->park_addr = NULL;
+		wake_thread(th);
+		num_woken ++;
+	}
+	park_put(addr);
+	return num_woken;
+}
+
+/* park on addr if it holds expected, for usecs or forever if negative. */
+int park(const int* addr, int expected, long usecs)
+{
+	if (addr == NULL) return THREAD_INVALID;
+	bool enabled = interrupts_off();
+	// checked with interrupts off, so an unpark after the word changed
+	// cannot be missed.
+	int ret = 0;
+	if (__atomic_load_n(addr, __ATOMIC_SEQ_CST) == expected)
+	{
+		ret = park_sleep(addr, usecs);
+		if (ret != THREAD_TIMEDOUT && ret != THREAD_NONE) ret = 0;
+	}
+	interrupts_set(enabled);
+	return ret;
+}
+
+int
+thread_park(const int *addr, int expected)
+{
+	return park(addr, expected, -1);
+}
+
+int
+thread_park_timeout(const int *addr, int expected, long usecs)
+{
+	if (usecs < 0) return THREAD_INVALID;
+	return park(addr, expected, usecs);
+}
+
+int
+thread_unpark(const int *addr, int n)
+{
+	bool enabled = interrupts_off();
+	int ret = park_wake(addr, n);
+	interrupts_set(enabled);
+	return ret;
+}
+
 /* suspend current thread until Thread tid exits */
 Tid
 thread_wait(Tid tid, int *exit_code)
 {
 	bool enabled = interrupts_off();
-	if (tid < 0 || tid >= THREAD_MAX_THREADS || tid == cur_tid || thread_pool[tid] == NULL)
+	struct tid_entry* e = tid == thread_id() ? NULL : tid_entry(tid);
+	if (e == NULL)
 	{
 		if (exit_code) *exit_code = THREAD_INVALID;
 		interrupts_set(enabled);
 		return THREAD_INVALID;
 	}
-	int if_first;
-	if (thread_pool[tid]->wq == NULL)
+	// the thread already exited, and may have been reaped, but nobody has
+	// collected its exit code yet.
+	if (e->exited && (e->th == NULL || e->th->state == DYING))
 	{
-		thread_pool[tid]->wq = wait_queue_create();
-		if_first = tid;
+		e->exited = false;
+		if (exit_code) *exit_code = e->exit_code;
+		interrupts_set(enabled);
+		return tid;
+	}
+	// no such thread, it was killed, or it is detached.
+	if (e->th == NULL || e->th->state == DYING || e->th->detached)
+	{
+		if (exit_code) *exit_code = THREAD_INVALID;
+		interrupts_set(enabled);
+		return THREAD_INVALID;
 	}
-	else if_first = THREAD_INVALID;
-	thread_sleep(thread_pool[tid]->wq);
+	// joiners park on the TCB, so there is only a queue while one waits.
+	thread* th = e->th;
+	int if_first = park_queue(th, false) == NULL ? tid : THREAD_INVALID;
+	park_sleep(th, -1);
 
+	e->exited = false;
 	if (exit_code)
 	{
-		*exit_code = exit_arr[tid];
-		exit_arr[tid] = THREAD_INVALID;
+		*exit_code = e->exit_code;
+		e->exit_code = THREAD_INVALID;
 	}
 	interrupts_set(enabled);
 	return if_first;
 }
 
+Tid
+thread_join(Tid tid, void **value)
+{
+	bool enabled = interrupts_off();
+	struct tid_entry* e = tid == thread_id() ? NULL : tid_entry(tid);
+	Tid ret = THREAD_INVALID;
+	void* v = NULL;
+	if (e != NULL && e->done)
+	{
+		// it already ended, and its slot still holds the result.
+		ret = e->killed ? THREAD_FAILED : tid;
+		v = e->value;
+	}
+	else if (e != NULL && e->th != NULL && e->th->state != DYING && !e->th->detached)
+	{
+		thread* th = tid_thread(thread_id());
+		th->join_ret = THREAD_NONE;
+		// thread_yield(tid) can run a sleeping thread without waking it.
+		while (th->join_ret == THREAD_NONE)
+		{
+			if (park_sleep(e, -1) == THREAD_NONE) break;
+		}
+		ret = th->join_ret;
+		v = th->join_value;
+	}
+	if (value) *value = v;
+	interrupts_set(enabled);
+	return ret;
+}
+
 struct lock {
 	/* ... Fill this in ... */
 	Tid acquired;
 	struct wait_queue* wq;
+	// the next lock held by the same thread.
+	struct lock* held_next;
 };
 
+// times lock_acquire checks the owner of a lock before it sleeps, while the
+// owner is running on another worker.
+#define LOCK_SPINS 1000
+
+/* make th the holder of lock. */
+void lock_take(struct lock* lock, thread* th)
+{
+	lock->acquired = th->tid;
+	lock->held_next = th->held_locks;
+	th->held_locks = lock;
+}
+
+/* take lock off the list of locks th holds. */
+void lock_drop(struct lock* lock, thread* th)
+{
+	struct lock** link = &th->held_locks;
+	while (*link != lock)
+	{
+		assert(*link != NULL);
+		link = &(*link)->held_next;
+	}
+	*link = lock->held_next;
+	lock->held_next = NULL;
+}
+
+/* th is about to wait for lock. under the prio policy, the holder of lock
+ * runs at least at th's priority until it releases it, and so on along the
+ * chain of locks that the holders themselves wait for. */
+void prio_inherit(thread* th, struct lock* lock)
+{
+	th->blocked_on = lock;
+	if (!prio_sched) return;
+	while (lock != NULL && lock->acquired != -1)
+	{
+		thread* holder = tid_thread(lock->acquired);
+		if (holder == NULL || holder->eff_prio >= th->eff_prio) break;
+		set_eff_prio(holder, th->eff_prio);
+		lock = holder->blocked_on;
+	}
+}
+
+/* recompute the priority th runs at from its own priority and the waiters
+ * of the locks it still holds, e.g. after it released a lock. */
+void prio_update(thread* th)
+{
+	int prio = th->prio;
+	if (prio_sched)
+	{
+		for (struct lock* lock = th->held_locks; lock != NULL; lock = lock->held_next)
+		{
+			for (wait_node* node = lock->wq->waitHead; node != NULL; node = node -> next)
+			{
+				if (tid_thread(node -> tid)->eff_prio > prio) prio = tid_thread(node -> tid)->eff_prio;
+			}
+		}
+	}
+	set_eff_prio(th, prio);
+	if (th->blocked_on != NULL) prio_inherit(th, th->blocked_on);
+}
+
+/* th stopped waiting for its lock without getting it, because it timed out
+ * or was killed. the holder may not need th's priority anymore. */
+void lock_unblock(thread* th)
+{
+	struct lock* lock = th->blocked_on;
+	th->blocked_on = NULL;
+	thread* holder = lock->acquired != -1 ? tid_thread(lock->acquired) : NULL;
+	if (prio_sched && holder != NULL) prio_update(holder);
+}
+
+/* give lock to the first thread waiting for it, or, under the prio policy,
+ * to the first one of the highest priority. make it free if there is none.
+ * the waiter owns the lock as soon as it is woken, so no other thread can
+ * take it first and send the waiter back to sleep. */
+void lock_handoff(struct lock* lock)
+{
+	wait_node* node = lock->wq->waitHead;
+	if (node == NULL)
+	{
+		lock->acquired = -1;
+		return;
+	}
+	if (prio_sched)
+	{
+		for (wait_node* n = node -> next; n != NULL; n = n -> next)
+		{
+			if (tid_thread(n -> tid)->eff_prio > tid_thread(node -> tid)->eff_prio) node = n;
+		}
+	}
+	thread* th = tid_thread(node -> tid);
+	remove_wait(node, lock->wq);
+	th->blocked_on = NULL;
+	lock_take(lock, th);
+	th->handoff = lock;
+	wake_thread(th);
+}
+
+/* th was killed: pass each lock it holds on, as lock_release would, so
+ * that no lock is left held by a thread that is gone. this includes a lock
+ * handed to th while it was waiting for it. */
+void locks_release(thread* th)
+{
+	th->handoff = NULL;
+	while (th->held_locks != NULL)
+	{
+		struct lock* lock = th->held_locks;
+		lock_drop(lock, th);
+		lock_handoff(lock);
+	}
+}
+
+/* wait a little for lock to be released, if its owner is running on
+ * another worker and will likely release it before a sleep and wakeup
+ * would complete. the caller has interrupts enabled, so other workers can
+ * make progress, and checks the lock again with interrupts off. */
+void lock_spin(struct lock* lock)
+{
+	if (nr_workers == 1 || !interrupts_enabled()) return;
+	for (int i = 0; i < LOCK_SPINS; i ++)
+	{
+		Tid owner = __atomic_load_n(&lock->acquired, __ATOMIC_RELAXED);
+		if (owner == -1) return;
+		struct tid_entry* e = tid_slot(owner & TID_SLOT_MASK);
+		thread* th = __atomic_load_n(&e->th, __ATOMIC_RELAXED);
+		if (th == NULL || __atomic_load_n(&th->state, __ATOMIC_RELAXED) != RUNNING) return;
+		__builtin_ia32_pause();
+	}
+}
+
 struct lock *
 lock_create()
 {
 	int enabled = interrupts_off();
 	struct lock *lock;
 
-	lock = malloc369(sizeof(struct lock));
-	assert(lock);
+	lock = slab_alloc(&lock_cache);
 
 	lock->acquired = -1;
 	lock->wq = wait_queue_create();
+	lock->held_next = NULL;
 
 	interrupts_set(enabled);
 	return lock;
@@ -507,7 +1860,7 @@ lock_destroy(struct lock *lock)
 
 	assert(lock != NULL);
 	wait_queue_destroy(lock->wq);
-	free369(lock);
+	slab_free(&lock_cache, lock);
 
 	interrupts_set(enabled);
 }
@@ -515,16 +1868,63 @@ lock_destroy(struct lock *lock)
 void
 lock_acquire(struct lock *lock)
 {
-	int enabled = interrupts_off();
 	assert(lock != NULL);
+	lock_spin(lock);
+	int enabled = interrupts_off();
 
-	while (lock->acquired != -1)
+	thread* th = tid_thread(thread_id());
+	if (lock->acquired == -1)
+	{
+		lock_take(lock, th);
+		interrupts_set(enabled);
+		return;
+	}
+	trace(TRACE_CONTEND, th->tid, lock->acquired);
+	// lock_release hands the lock to us before waking us up.
+	prio_inherit(th, lock);
+	while (lock->acquired != thread_id())
 	{
 		thread_sleep(lock->wq);
 	}
+	th->handoff = NULL;
+	interrupts_set(enabled);
+}
+
+int
+lock_acquire_timeout(struct lock *lock, long usecs)
+{
+	if (usecs < 0) return THREAD_INVALID;
+	assert(lock != NULL);
+	lock_spin(lock);
+	int enabled = interrupts_off();
 
-	lock->acquired = cur_tid;
+	thread* th = tid_thread(thread_id());
+	if (lock->acquired == -1)
+	{
+		lock_take(lock, th);
+		interrupts_set(enabled);
+		return 0;
+	}
+	// a timeout takes the thread off the wait queue, so the lock cannot
+	// be handed to it afterwards. the sleep can still end early, e.g. by
+	// thread_yield(tid), so sleep again for whatever time is left.
+	trace(TRACE_CONTEND, th->tid, lock->acquired);
+	prio_inherit(th, lock);
+	unsigned long deadline = wheel_time(usecs, true);
+	while (lock->acquired != thread_id())
+	{
+		unsigned long now = wheel_time(0, false);
+		if (now >= deadline)
+		{
+			lock_unblock(th);
+			interrupts_set(enabled);
+			return THREAD_TIMEDOUT;
+		}
+		sleep_timeout(lock->wq, (deadline - now) * WHEEL_TICK_USECS);
+	}
+	th->handoff = NULL;
 	interrupts_set(enabled);
+	return 0;
 }
 
 void
@@ -533,10 +1933,13 @@ lock_release(struct lock *lock)
 	int enabled = interrupts_off();
 	assert(lock != NULL);
 
-	if (lock->acquired == cur_tid)
+	if (lock->acquired == thread_id())
 	{
-		lock->acquired = -1;
-		thread_wakeup(lock->wq, 1);
+		thread* th = tid_thread(thread_id());
+		lock_drop(lock, th);
+		lock_handoff(lock);
+		// give up any priority inherited through this lock.
+		if (th->eff_prio != th->prio) prio_update(th);
 	}
 	interrupts_set(enabled);
 }
@@ -546,14 +1949,41 @@ struct cv {
 	struct wait_queue* wq;
 };
 
+// TCBs, wait nodes and wait queues for this many threads are cached up
+// front, so that the first threads carve no slabs.
+#define CACHE_PREALLOC_THREADS 128
+
+/* an empty wait queue, which is also what wait_queue_destroy gives back. */
+static void wait_queue_ctor(void* obj)
+{
+	struct wait_queue* wq = obj;
+	wq->waitHead = NULL;
+	wq->waitTail = NULL;
+	wq->length = 0;
+}
+
+/* set up the object caches. only the first call does anything, since
+ * thread_init_workers calls thread_init_sched again. */
+void caches_init(void)
+{
+	static bool done = false;
+	if (done) return;
+	done = true;
+	slab_cache_init(&thread_cache, "thread", sizeof(thread), NULL, CACHE_PREALLOC_THREADS);
+	slab_cache_init(&wait_node_cache, "wait_node", sizeof(wait_node), NULL, CACHE_PREALLOC_THREADS);
+	slab_cache_init(&wait_queue_cache, "wait_queue", sizeof(struct wait_queue), wait_queue_ctor, CACHE_PREALLOC_THREADS);
+	slab_cache_init(&lock_cache, "lock", sizeof(struct lock), NULL, SLAB_OBJECTS);
+	slab_cache_init(&cv_cache, "cv", sizeof(struct cv), NULL, SLAB_OBJECTS);
+	slab_cache_init(&future_cache, "future", sizeof(struct thread_future), NULL, 0);
+}
+
 struct cv *
 cv_create()
 {
 	int enabled = interrupts_off();
 	struct cv *cv;
 
-	cv = malloc369(sizeof(struct cv));
-	assert(cv);
+	cv = slab_alloc(&cv_cache);
 
 	cv->wq = wait_queue_create();
 	interrupts_set(enabled);
@@ -567,10 +1997,39 @@ cv_destroy(struct cv *cv)
 	assert(cv != NULL);
 
 	wait_queue_destroy(cv->wq);
-	free369(cv);
+	slab_free(&cv_cache, cv);
 	interrupts_set(enabled);
 }
 
+/* move the first thread waiting on cv to the wait queue of lock, which the
+ * caller holds, rather than waking it only for it to find the lock held.
+ * the thread stays asleep until the lock is handed to it, which ends its
+ * cv_wait. returns false if no thread waits on cv. */
+bool cv_morph(struct cv* cv, struct lock* lock)
+{
+	wait_node* node = requeue_wait(cv->wq, lock->wq);
+	if (node == NULL) return false;
+	thread* th = tid_thread(node -> tid);
+	// it was signalled in time, so a cv_timedwait does not time out.
+	if (wheel_pending(&th->timeout)) wheel_del(&th->timeout);
+	th->sleep_wq = lock->wq;
+	th->wait_node = node;
+	prio_inherit(th, lock);
+	return true;
+}
+
+/* reacquire lock at the end of a cv wait, unless it was already handed to
+ * the caller after cv_morph. */
+void cv_relock(struct lock* lock)
+{
+	if (lock->acquired == thread_id())
+	{
+		tid_thread(thread_id())->handoff = NULL;
+		return;
+	}
+	lock_acquire(lock);
+}
+
 void
 cv_wait(struct cv *cv, struct lock *lock)
 {
@@ -580,8 +2039,23 @@ cv_wait(struct cv *cv, struct lock *lock)
 
 	lock_release(lock);
 	thread_sleep(cv->wq);
-	lock_acquire(lock);
+	cv_relock(lock);
+	interrupts_set(enabled);
+}
+
+int
+cv_timedwait(struct cv *cv, struct lock *lock, long usecs)
+{
+	if (usecs < 0) return THREAD_INVALID;
+	int enabled = interrupts_off();
+	assert(cv != NULL);
+	assert(lock != NULL);
+
+	lock_release(lock);
+	Tid ret = sleep_timeout(cv->wq, usecs);
+	cv_relock(lock);
 	interrupts_set(enabled);
+	return ret == THREAD_TIMEDOUT ? THREAD_TIMEDOUT : 0;
 }
 
 void
@@ -591,7 +2065,7 @@ cv_signal(struct cv *cv, struct lock *lock)
 	assert(cv != NULL);
 	assert(lock != NULL);
 
-	if (lock->acquired == cur_tid) thread_wakeup(cv->wq, 0);
+	if (lock->acquired == thread_id()) cv_morph(cv, lock);
 	interrupts_set(enabled);
 }
 
@@ -602,6 +2076,92 @@ cv_broadcast(struct cv *cv, struct lock *lock)
 	assert(cv != NULL);
 	assert(lock != NULL);
 
-	if(lock->acquired == cur_tid) thread_wakeup(cv->wq, 1);
+	if(lock->acquired == thread_id())
+	{
+		while (cv_morph(cv, lock));
+	}
+	interrupts_set(enabled);
+}
+
+/* a future's task runs in a detached thread, which hands its result to the
+ * future as it ends (see wake_joiners), so nothing needs its Tid after
+ * that, and it is reaped like any detached thread. */
+static void future_main(void* arg)
+{
+	struct thread_future* f = arg;
+	thread_exit_value(f->fn(f->arg));
+}
+
+struct thread_future *
+thread_future_create(void *(*fn)(void *), void *arg)
+{
+	bool enabled = interrupts_off();
+	struct thread_future* f = slab_alloc(&future_cache);
+	f->fn = fn;
+	f->arg = arg;
+	f->ret = THREAD_NONE;
+	f->value = NULL;
+
+	struct thread_attr attr;
+	thread_attr_init(&attr);
+	attr.name = "future";
+	attr.detached = true;
+	Tid tid = thread_create_attr(future_main, f, &attr);
+	if (tid < 0)
+	{
+		slab_free(&future_cache, f);
+		f = NULL;
+	}
+	// it cannot run, and end, until interrupts are enabled again.
+	else tid_thread(tid)->future = f;
+	interrupts_set(enabled);
+	return f;
+}
+
+/* wait for the task of f to end, and return f->ret. interrupts must be
+ * off. */
+static Tid future_wait(struct thread_future* f)
+{
+	while (f->ret == THREAD_NONE)
+	{
+		if (park_sleep(f, -1) == THREAD_NONE) return THREAD_NONE;
+	}
+	return f->ret;
+}
+
+int
+thread_future_get(struct thread_future *f, void **value)
+{
+	bool enabled = interrupts_off();
+	Tid ret = future_wait(f);
+	if (value) *value = ret == 0 ? f->value : NULL;
+	interrupts_set(enabled);
+	return ret;
+}
+
+int
+thread_future_gather(struct thread_future **futures, int n, void **values)
+{
+	bool enabled = interrupts_off();
+	int failed = 0;
+	// tasks that end while the caller waits for an earlier one are
+	// collected without sleeping again.
+	for (int i = 0; i < n; i ++)
+	{
+		Tid ret = future_wait(futures[i]);
+		if (ret != 0) failed ++;
+		if (values) values[i] = ret == 0 ? futures[i]->value : NULL;
+	}
+	interrupts_set(enabled);
+	return failed;
+}
+
+void
+thread_future_destroy(struct thread_future *f)
+{
+	bool enabled = interrupts_off();
+	Tid ret = future_wait(f);
+	assert(ret != THREAD_NONE);
+	slab_free(&future_cache, f);
 	interrupts_set(enabled);
 }
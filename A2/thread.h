@@ -1,6 +1,11 @@
 #ifndef _THREAD_H_
 #define _THREAD_H_
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
 /* Macro to flag places where implementation is needed in thread.c */
 #define TBD() do {							\
 		printf("%s:%d: %s: please implement this functionality\n", \
@@ -10,7 +15,17 @@
 
 
 #define THREAD_MAX_THREADS 1024 /* maximum number of threads */
+#define THREAD_TABLE_MAX (1 << 20) /* most threads thread_set_max_threads allows */
 #define THREAD_MIN_STACK  32768 /* minimum per-thread execution stack */
+#define THREAD_ATTR_MIN_STACK 8192 /* smallest stack thread_create_attr allows */
+#define THREAD_ATTR_MAX_STACK (1UL << 30) /* largest stack it allows */
+#define THREAD_NAME_LEN 16 /* bytes in a thread name, with the NUL */
+#define THREAD_MAX_WORKERS 64 /* maximum number of kernel threads */
+
+/* Thread priorities for the "prio" policy. Higher values run first. */
+#define THREAD_PRIO_MIN 0
+#define THREAD_PRIO_MAX 31
+#define THREAD_PRIO_DEFAULT 16
 
 typedef int Tid; /* A thread identifier */
 
@@ -19,6 +34,12 @@ typedef int Tid; /* A thread identifier */
  * first thread to run must have a thread id of 0. Note that this thread is the
  * main thread, i.e., it is created before the first call to thread_create.
  *
+ * Once thread_set_max_threads raises the limit above THREAD_MAX_THREADS, new
+ * Tids can be up to INT_MAX: the bits above the low 20 hold a generation that
+ * goes up each time a slot of the thread table is reused, so a stale Tid,
+ * whose slot now holds another thread, is rejected with THREAD_INVALID
+ * instead of referring to the new thread.
+ *
  * Negative Tid values are used for error codes or control codes.
  */
 
@@ -29,7 +50,8 @@ enum {
 	THREAD_NONE = -4,
 	THREAD_NOMORE = -5,
 	THREAD_NOMEMORY = -6,
-	THREAD_FAILED = -7
+	THREAD_FAILED = -7,
+	THREAD_TIMEDOUT = -8
 };
 
 /* Returns TRUE (1) if the ret is a non-negative value. Note that this does not
@@ -49,6 +71,139 @@ thread_ret_ok(Tid ret)
 void thread_init(void);
 
 
+/* Like thread_init, but selects the scheduling policy by name: "fifo",
+ * "rr", "mlfq", "stride" or "prio" (see sched.h). thread_init uses "rr".
+ * Returns 0 on success, or -1 if there is no policy with that name.
+ */
+int thread_init_sched(const char *policy);
+
+/* Like thread_init, but runs the threads on nworkers kernel threads
+ * (workers) instead of one, so that up to nworkers threads run in parallel.
+ * The calling kernel thread becomes worker 0, and nworkers-1 more are
+ * started with pthread_create. Each worker has its own run queue and steals
+ * from the others when it runs out ("steal" in sched.h). Disabling
+ * interrupts then also excludes the other workers from the library, so
+ * locks and condition variables keep working. Must be called instead of
+ * thread_init, before register_interrupt_handler. Returns 0 on success, or
+ * -1 if nworkers is not between 1 and THREAD_MAX_WORKERS.
+ *
+ * With more than one worker, a thread that sleeps while no other thread is
+ * ready leaves its worker idle until another worker wakes it, instead of
+ * failing with THREAD_NONE, as long as a thread is running on some other
+ * worker. thread_sleep then returns the caller's own Tid. thread_yield(tid)
+ * returns tid at once if that thread is running on another worker, and
+ * thread_kill of such a thread takes effect at its next tick or yield.
+ */
+int thread_init_workers(int nworkers);
+
+/* Allow up to max threads to exist at once, instead of THREAD_MAX_THREADS.
+ * The thread table is allocated in segments as threads are created, so a
+ * large limit costs nothing until threads use it, and memory follows the
+ * threads that are actually live (thread stacks are only committed as they
+ * are touched). Above THREAD_MAX_THREADS, new Tids are tagged with a
+ * generation (see Tid above). The limit can only be raised. Returns 0 on
+ * success, or THREAD_INVALID if max is below the current limit or above
+ * THREAD_TABLE_MAX.
+ */
+int thread_set_max_threads(int max);
+
+/* Return the name of the scheduling policy in use. */
+const char *thread_sched_name(void);
+
+/* Set the number of tickets of thread tid (or THREAD_SELF) for the stride
+ * policy. Returns 0 on success, or THREAD_INVALID if tid does not refer to
+ * a live thread or tickets is not positive.
+ */
+int thread_set_tickets(Tid tid, int tickets);
+
+/* Set the priority of thread tid (or THREAD_SELF), between THREAD_PRIO_MIN
+ * and THREAD_PRIO_MAX, for the prio policy. The prio policy always runs a
+ * thread of the highest priority that is ready, round robin among equals,
+ * and preempts a running thread at the next tick once a thread of higher
+ * priority is ready. A thread that holds a lock runs at least at the
+ * priority of the threads waiting for it (priority inheritance), and a lock
+ * is handed to its waiter of highest priority. Priorities have no effect
+ * under the other policies. Returns 0 on success, or THREAD_INVALID if tid
+ * does not refer to a live thread or prio is out of range.
+ */
+int thread_setprio(Tid tid, int prio);
+
+/* Return the priority thread tid (or THREAD_SELF) runs at, including any
+ * priority it inherits, or THREAD_INVALID if tid does not refer to a live
+ * thread.
+ */
+int thread_getprio(Tid tid);
+
+/* Called by the interrupt handler on every timer tick. Asks the scheduling
+ * policy whether the running thread should be preempted, and yields if so.
+ */
+void thread_tick(void);
+
+/* Return the number of times a sleeping thread has been woken up, by
+ * thread_wakeup, a lock or condition variable, a thread exit or a timeout.
+ */
+unsigned long thread_wakeups(void);
+
+/* Return the time, in microseconds, that the workers have spent idle, i.e.
+ * blocked in the kernel because no thread could run. A worker with nothing
+ * to run, while a thread waits for a timeout or for a thread on another
+ * worker, blocks until a thread is made runnable, a timeout expires or a
+ * signal arrives, rather than spin.
+ */
+unsigned long thread_idle_usecs(void);
+
+/* Scheduler statistics. They are only kept when the library is built with
+ * THREAD_STATS defined, which the Makefile does unless it is run with
+ * STATS=0. Otherwise the scheduler pays nothing for them, thread_stats and
+ * thread_sched_stats return THREAD_INVALID, and thread_stats_dump only says
+ * so. Times are in microseconds.
+ */
+struct thread_stats {
+	unsigned long voluntary;	/* switches away to sleep, yield or exit */
+	unsigned long involuntary;	/* switches away when preempted */
+	unsigned long run_usecs;	/* time running */
+	unsigned long ready_usecs;	/* time runnable but not running */
+	unsigned long blocked_usecs;	/* time asleep */
+	unsigned long max_ready_usecs;	/* longest wait from runnable to running */
+};
+
+struct thread_sched_stats {
+	unsigned long ticks;		/* timer ticks handled */
+	unsigned long switches;		/* threads switched away from */
+	unsigned long ready_len_sum;	/* sum of nr_ready over the ticks */
+	int nr_threads;			/* threads now */
+	int nr_ready;			/* threads on the ready queue now */
+	int nr_blocked;			/* threads asleep now */
+	int max_ready;			/* longest the ready queue has been */
+};
+
+/* Fill stats with the statistics of thread tid (or THREAD_SELF), including
+ * the time it has spent in its current state so far. Returns 0, or
+ * THREAD_INVALID if there is no such thread.
+ */
+int thread_stats(Tid tid, struct thread_stats *stats);
+
+/* Fill stats with the statistics of the whole scheduler. The average length
+ * of the ready queue at a tick is ready_len_sum / ticks. Returns 0.
+ */
+int thread_sched_stats(struct thread_sched_stats *stats);
+
+/* Print the scheduler statistics and those of every thread to stdout. */
+void thread_stats_dump(void);
+
+/* Scheduler event tracing. thread_trace_start clears the trace and starts
+ * recording, with TSC timestamps, the switches between threads and why they
+ * happened, thread creation, kills and wakeups, lock contention and timer
+ * ticks. The last 65536 events are kept. thread_trace_stop stops recording.
+ * thread_trace_save stops recording too, and writes the trace to the file
+ * path, which the trace2json tool converts to the Chrome trace format.
+ * Returns 0, or -1 with errno set if the file cannot be written.
+ */
+void thread_trace_start(void);
+void thread_trace_stop(void);
+int thread_trace_save(const char *path);
+
+
 /* Return the thread identifier of the currently running thread. */
 Tid thread_id(void);
 
@@ -62,6 +217,54 @@ Tid thread_id(void);
  */
 Tid thread_create(void (*fn) (void *), void *arg);
 
+/* Like thread_create, but the thread starts with priority prio rather than
+ * THREAD_PRIO_DEFAULT. Returns THREAD_INVALID if prio is out of range.
+ */
+Tid thread_create_prio(void (*fn) (void *), void *arg, int prio);
+
+/* Attributes of a new thread, for thread_create_attr. Set them to the
+ * defaults with thread_attr_init, then change the ones that differ.
+ */
+struct thread_attr {
+	size_t stack_size; /* bytes, rounded up to whole pages */
+	int prio;	   /* initial priority, see thread_setprio */
+	const char *name;  /* NULL, or copied, cut to THREAD_NAME_LEN - 1 chars */
+	bool detached;	   /* nobody will wait for the thread */
+};
+
+/* Set attr to what thread_create uses: a THREAD_MIN_STACK stack,
+ * THREAD_PRIO_DEFAULT, no name, and joinable.
+ */
+void thread_attr_init(struct thread_attr *attr);
+
+/* Like thread_create, but with the attributes in attr. Only stacks of
+ * THREAD_MIN_STACK bytes are kept in the stack pool; other sizes are mapped
+ * for each thread and unmapped when it is reaped. A detached thread cannot
+ * be waited for: thread_wait returns THREAD_INVALID for it, and its exit
+ * code is dropped. Returns THREAD_INVALID if the stack is smaller than
+ * THREAD_ATTR_MIN_STACK or larger than THREAD_ATTR_MAX_STACK, or the
+ * priority is out of range, and otherwise what thread_create returns.
+ */
+Tid thread_create_attr(void (*fn) (void *), void *arg,
+		       const struct thread_attr *attr);
+
+/* Copy the name of thread tid (or THREAD_SELF) into name, which has room
+ * for len bytes, cutting it short if need be. A thread created without a
+ * name has an empty one, and the initial thread is called "main". Returns 0
+ * on success, or THREAD_INVALID if tid does not refer to a live thread.
+ */
+int thread_getname(Tid tid, char *name, size_t len);
+
+/* Return the high-water mark of the stack of thread tid (or THREAD_SELF):
+ * how many bytes, from the top of its stack, it has touched so far, in whole
+ * pages. The stack is only committed as it is touched, so this is measured
+ * by asking the kernel which of its pages are resident, and costs a system
+ * call. Returns THREAD_INVALID if tid does not refer
+ * to a live thread, or is the initial thread, which runs on the process
+ * stack.
+ */
+long thread_stack_usage(Tid tid);
+
 
 /* thread_yield should suspend the calling thread and run the thread with
  * identifier tid. The calling thread is put in the ready queue. 
@@ -96,6 +299,11 @@ Tid thread_yield(Tid tid);
  */
 void thread_exit(int exit_code);
 
+/* Like thread_exit(0), but hand value to the threads that join the caller
+ * with thread_join.
+ */
+void thread_exit_value(void *value);
+
 
 /* Kill a thread whose identifier is tid. When a thread is killed, it should not
  * run any further. The calling thread continues to execute and receives the
@@ -109,6 +317,41 @@ void thread_exit(int exit_code);
  */
 Tid thread_kill(Tid tid);
 
+/* A handler pushed with thread_cleanup_push, usually kept on the stack of
+ * the thread that pushes it.
+ */
+struct thread_cleanup {
+	void (*fn)(void *arg);
+	void *arg;
+	struct thread_cleanup *next;
+};
+
+/* Have fn(arg) run if the calling thread is killed before it pops c, e.g.
+ * to take the thread off a list of waiters that some object keeps for it.
+ * Handlers run in the reverse order of their pushes, with interrupts
+ * disabled, and possibly on the stack of the thread that called
+ * thread_kill, so they must not sleep or call thread_id. The push and the
+ * pop should be made with interrupts disabled, around the wait they guard.
+ */
+void thread_cleanup_push(struct thread_cleanup *c, void (*fn)(void *),
+			 void *arg);
+
+/* Remove c, the handler the calling thread pushed last, without running
+ * it.
+ */
+void thread_cleanup_pop(struct thread_cleanup *c);
+
+
+/* Select how thread_yield switches between threads. By default the library
+ * uses a hand-written x86-64 routine that saves only the callee-saved
+ * registers and the stack pointer. Passing true switches back to
+ * getcontext/setcontext, which also save and restore the signal mask with a
+ * system call each. Either path works everywhere, including timed sleeps and
+ * waits while no other thread is ready. May only be called while the caller
+ * is the only thread, and with a single worker.
+ */
+void thread_use_ucontext(bool enable);
+
 
 /***************************************************
  * Assignment 2: Implement the following functions *
@@ -123,6 +366,12 @@ struct wait_queue *wait_queue_create(void);
  */
 void wait_queue_destroy(struct wait_queue *wq);
 
+/* Return the number of threads sleeping in the wait queue. A thread that is
+ * woken up, or killed, is no longer counted. Objects built on wait queues
+ * can use it instead of counting their waiters themselves.
+ */
+int wait_queue_length(struct wait_queue *wq);
+
 
 /* Suspend the calling thread and run some other thread. The calling thread is
  * put in the wait queue. 
@@ -139,6 +388,14 @@ void wait_queue_destroy(struct wait_queue *wq);
  */
 Tid thread_sleep(struct wait_queue *queue);
 
+/* Suspend the calling thread for at least usecs microseconds, letting other
+ * threads run meanwhile. Timeouts are kept on a timer wheel with a resolution
+ * of WHEEL_TICK_USECS (100 usecs), and are noticed at the next timer tick, or
+ * at once when no thread is runnable.
+ * Returns 0, or THREAD_INVALID if usecs is negative.
+ */
+int thread_sleep_for(long usecs);
+
 
 /* Wake up one or more threads that are suspended in the wait queue. These
  * threads are put in the ready queue. The calling thread continues to execute
@@ -150,6 +407,50 @@ Tid thread_sleep(struct wait_queue *queue);
  */
 int thread_wakeup(struct wait_queue *queue, int all);
 
+/* Park the calling thread on the address addr, like the Linux futex call:
+ * if *addr still holds expected, the caller sleeps until thread_unpark is
+ * called on addr, and otherwise it returns at once. The check and the sleep
+ * are atomic with respect to thread_unpark, so a thread that changes *addr
+ * and then calls thread_unpark cannot be missed. Threads parked on the same
+ * address are kept in a queue that only exists while one of them is
+ * parked, so the object they wait on can be a single int. Callers should
+ * check *addr again after returning.
+ * Returns 0, THREAD_INVALID if addr is NULL, or THREAD_NONE if no other
+ * thread could ever unpark the caller.
+ */
+int thread_park(const int *addr, int expected);
+
+/* Like thread_park, but stop waiting after usecs microseconds. Returns
+ * THREAD_TIMEDOUT if the time ran out, or THREAD_INVALID if usecs is
+ * negative.
+ */
+int thread_park_timeout(const int *addr, int expected, long usecs);
+
+/* Wake up to n threads parked on addr, in FIFO order. Returns the number of
+ * threads that were woken up.
+ */
+int thread_unpark(const int *addr, int n);
+
+
+/* Like read, write, accept and connect, but only the calling thread waits
+ * when the call would block, rather than the whole process. The fd is put in
+ * non-blocking mode and added to the library's epoll set on first use, and
+ * the caller parks until epoll reports that the fd is ready. The library
+ * polls for events on every timer tick while threads wait for I/O, and
+ * blocks in epoll when no thread can run. Fds that epoll does not support,
+ * such as regular files, are read and written as usual. These return what
+ * the system calls return, with errno set on failure.
+ */
+ssize_t thread_read(int fd, void *buf, size_t count);
+ssize_t thread_write(int fd, const void *buf, size_t count);
+int thread_accept(int fd, struct sockaddr *addr, socklen_t *addrlen);
+int thread_connect(int fd, const struct sockaddr *addr, socklen_t addrlen);
+
+/* Close an fd used with the calls above, removing it from the epoll set. No
+ * thread may be waiting for it.
+ */
+int thread_close(int fd);
+
 
 /* Suspend the current thread until the target thread (i.e., the thread whose 
  * identifier is tid) exits. If the target thread has already exited, then
@@ -161,13 +462,25 @@ int thread_wakeup(struct wait_queue *queue, int all);
  * Upon failure, returns THREAD_INVALID. Failure can occur for the following
  * reasons:
  *      - Identifier tid is not a feasible thread id (e.g., tid < 0 or 
- *        tid >= THREAD_MAX_THREADS) 
+ *        tid >= THREAD_MAX_THREADS, or a stale tagged Tid) 
  *      - No thread with the identifier tid could be found.
  *      - The identifier tid refers to the calling thread.
  *      - Another thread is already waiting for the thread with identifier tid.
  */
 int thread_wait(Tid tid, int *exit_code);
 
+/* Like thread_wait, but any number of threads may wait for thread tid at
+ * once, and each of them gets the value the thread passed to
+ * thread_exit_value (NULL if it ended any other way) in value, if value is
+ * not NULL. The result stays until a new thread gets the slot of tid, so a
+ * thread can also be joined after it ended, any number of times, and
+ * thread_wait still collects its exit code. Returns tid on success,
+ * THREAD_FAILED if the thread was killed, THREAD_NONE if no other thread
+ * could run while the caller waited, or THREAD_INVALID if tid does not
+ * refer to a thread, is the caller, or is detached.
+ */
+Tid thread_join(Tid tid, void **value);
+
 
 /* Create a blocking lock. Initially, the lock is available. 
  * Associate a wait queue with the lock so that threads that need to acquire 
@@ -187,6 +500,12 @@ void lock_destroy(struct lock *lock);
  */
 void lock_acquire(struct lock *lock);
 
+/* Like lock_acquire, but give up after usecs microseconds. Returns 0 once the
+ * lock is acquired, THREAD_TIMEDOUT if it could not be acquired in time, or
+ * THREAD_INVALID if usecs is negative.
+ */
+int lock_acquire_timeout(struct lock *lock, long usecs);
+
 
 /* Release the lock. Be sure to check that the lock had been acquired by the
  * calling thread, before it is released. Wakeup all threads that are waiting 
@@ -210,6 +529,13 @@ void cv_destroy(struct cv *cv);
  */
 void cv_wait(struct cv *cv, struct lock *lock);
 
+/* Like cv_wait, but stop waiting after usecs microseconds. The lock is
+ * reacquired in either case. Returns 0 if the thread was signalled,
+ * THREAD_TIMEDOUT if the time ran out first, or THREAD_INVALID if usecs is
+ * negative.
+ */
+int cv_timedwait(struct cv *cv, struct lock *lock, long usecs);
+
 
 /* Wake up one thread that is waiting on the condition variable cv. Be sure to
  * check that the calling thread had acquired lock when this call is made. 
@@ -222,4 +548,142 @@ void cv_signal(struct cv *cv, struct lock *lock);
  */
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
+
+/* Create a reader-writer lock. Any number of readers, or a single writer, can
+ * hold it at a time. If prefer_writers is true, new readers wait while a
+ * writer is waiting, so that writers cannot be starved by a stream of
+ * readers. Otherwise readers are let in whenever no writer holds the lock.
+ */
+struct rwlock *rwlock_create(bool prefer_writers);
+
+/* Destroy the reader-writer lock, which must not be held. */
+void rwlock_destroy(struct rwlock *rwlock);
+
+/* Acquire the lock for reading, sleeping while a writer holds it. */
+void rwlock_read_acquire(struct rwlock *rwlock);
+
+/* Release the lock after reading. The last reader wakes up a writer. */
+void rwlock_read_release(struct rwlock *rwlock);
+
+/* Acquire the lock for writing, sleeping while it is held by anyone. */
+void rwlock_write_acquire(struct rwlock *rwlock);
+
+/* Release the lock after writing, waking up either one writer or all the
+ * readers, depending on the preference the lock was created with.
+ */
+void rwlock_write_release(struct rwlock *rwlock);
+
+
+/* Create a counting semaphore with the given initial value. These are named
+ * sema_* rather than sem_* so as not to clash with POSIX semaphores.
+ */
+struct sema *sema_create(unsigned int value);
+
+/* Destroy the semaphore. No thread may be waiting on it. */
+void sema_destroy(struct sema *sema);
+
+/* Wait until the value of the semaphore is positive, then decrement it. */
+void sema_down(struct sema *sema);
+
+/* Decrement the value of the semaphore if it is positive. Returns 0 if it
+ * was decremented, or THREAD_NONE if the value was 0.
+ */
+int sema_try_down(struct sema *sema);
+
+/* Increment the value of the semaphore, waking up a waiting thread. */
+void sema_up(struct sema *sema);
+
+/* Add n to the value of the semaphore at once, waking up as many as n
+ * waiting threads.
+ */
+void sema_up_n(struct sema *sema, unsigned int n);
+
+
+/* Create a barrier for count threads, which must be positive. */
+struct barrier *barrier_create(unsigned int count);
+
+/* Destroy the barrier. No thread may be waiting on it. */
+void barrier_destroy(struct barrier *barrier);
+
+/* Wait until count threads have called barrier_wait, then let them all go
+ * on. The barrier can then be used again. Returns 1 in the last thread to
+ * arrive, and 0 in the others.
+ */
+int barrier_wait(struct barrier *barrier);
+
+
+/* Run fn(arg) in a new detached thread, and return a future that holds
+ * what fn returns once it does, or NULL if the thread could not be created.
+ * The thread is reaped as soon as it ends, and the result is kept in the
+ * future until it is destroyed.
+ */
+struct thread_future *thread_future_create(void *(*fn)(void *), void *arg);
+
+/* Wait until the task of f has ended, and store its result in value, if
+ * value is not NULL. Any number of threads may wait for the same future.
+ * Returns 0 on success, THREAD_FAILED if the thread of the task was killed
+ * (value is then NULL), or THREAD_NONE if no other thread could run.
+ */
+int thread_future_get(struct thread_future *f, void **value);
+
+/* Wait until the tasks of the n futures have all ended, and store their
+ * results in values[0] to values[n-1], if values is not NULL. Returns the
+ * number of tasks that did not end normally, i.e. 0 if all of them did.
+ */
+int thread_future_gather(struct thread_future **futures, int n,
+			 void **values);
+
+/* Wait until the task of f has ended, if it has not already, and free f.
+ * No thread may be waiting for it.
+ */
+void thread_future_destroy(struct thread_future *f);
+
+
+/* Create a channel that holds up to capacity elements of elem_size bytes
+ * each, in FIFO order. With a capacity of 0, every send waits for a
+ * receiver. Elements are copied in and out of the channel, and straight
+ * from sender to receiver when the other side is already waiting. On an
+ * unbuffered channel, the sender then switches to the receiver at once. A
+ * thread that is killed while it waits on a channel is taken off it, and
+ * keeps whatever it sent or received so far.
+ */
+struct chan *chan_create(unsigned int capacity, size_t elem_size);
+
+/* Destroy the channel. No thread may be waiting on it. */
+void chan_destroy(struct chan *chan);
+
+/* Send the element elem, sleeping while the channel is full. Returns 0, or
+ * THREAD_INVALID if the channel is closed.
+ */
+int chan_send(struct chan *chan, const void *elem);
+
+/* Like chan_send, but return THREAD_NONE rather than sleep. */
+int chan_try_send(struct chan *chan, const void *elem);
+
+/* Send the n elements of the array elems, sleeping as needed. Returns the
+ * number of elements sent, which is less than n only if the channel was
+ * closed, or THREAD_INVALID if n is negative.
+ */
+int chan_send_n(struct chan *chan, const void *elems, int n);
+
+/* Receive an element into elem, sleeping while the channel is empty.
+ * Returns 0, or THREAD_INVALID if the channel is closed and empty.
+ */
+int chan_recv(struct chan *chan, void *elem);
+
+/* Like chan_recv, but return THREAD_NONE rather than sleep. */
+int chan_try_recv(struct chan *chan, void *elem);
+
+/* Receive up to n elements into the array elems, sleeping only while the
+ * channel is empty. Returns the number of elements received, 0 once the
+ * channel is closed and empty, or THREAD_INVALID if n is negative.
+ */
+int chan_recv_n(struct chan *chan, void *elems, int n);
+
+/* Close the channel. Sleeping senders return with what they sent so far,
+ * and further sends fail. Receivers get the elements still in the channel,
+ * and then fail rather than sleep.
+ */
+void chan_close(struct chan *chan);
+
 #endif /* _THREAD_H_ */
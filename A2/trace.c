@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <time.h>
+#include "thread.h"
+#include "sched.h"
+#include "trace.h"
+
+bool trace_enabled = false;
+
+static struct trace_event ring[TRACE_SIZE];
+/* events recorded since tracing started; the next goes to ring[pos %
+ * TRACE_SIZE] */
+static uint64_t pos;
+/* the TSC and the monotonic clock when tracing started and stopped, to find
+ * the rate of the TSC */
+static uint64_t start_tsc, stop_tsc;
+static struct timespec start_time, stop_time;
+
+void
+trace_record(int type, int tid, int arg)
+{
+	uint64_t i = __atomic_fetch_add(&pos, 1, __ATOMIC_RELAXED);
+	struct trace_event *e = &ring[i & (TRACE_SIZE - 1)];
+
+	e->tsc = __builtin_ia32_rdtsc();
+	e->tid = tid;
+	e->arg = arg;
+	e->type = type;
+	e->worker = this_worker_id();
+}
+
+void
+thread_trace_start(void)
+{
+	pos = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+	start_tsc = __builtin_ia32_rdtsc();
+	__atomic_store_n(&trace_enabled, true, __ATOMIC_SEQ_CST);
+}
+
+void
+thread_trace_stop(void)
+{
+	if (!trace_enabled) {
+		return;
+	}
+	__atomic_store_n(&trace_enabled, false, __ATOMIC_SEQ_CST);
+	clock_gettime(CLOCK_MONOTONIC, &stop_time);
+	stop_tsc = __builtin_ia32_rdtsc();
+}
+
+int
+thread_trace_save(const char *path)
+{
+	struct trace_header h;
+	uint64_t first, n;
+	double usecs;
+	FILE *f;
+	int ok;
+
+	thread_trace_stop();
+	usecs = (stop_time.tv_sec - start_time.tv_sec) * 1e6 +
+		(stop_time.tv_nsec - start_time.tv_nsec) / 1e3;
+	n = pos < TRACE_SIZE ? pos : TRACE_SIZE;
+	first = (pos - n) & (TRACE_SIZE - 1);
+
+	h.magic = TRACE_MAGIC;
+	h.nr_events = n;
+	h.lost = pos - n;
+	h.start_tsc = start_tsc;
+	h.tsc_per_usec = usecs > 0 ? (stop_tsc - start_tsc) / usecs : 1;
+
+	f = fopen(path, "w");
+	if (f == NULL) {
+		return -1;
+	}
+	/* the oldest event is at first, and the ring may wrap after it */
+	ok = fwrite(&h, sizeof(h), 1, f) == 1;
+	if (first + n <= TRACE_SIZE) {
+		ok = ok && fwrite(ring + first, sizeof(ring[0]), n, f) == n;
+	} else {
+		ok = ok && fwrite(ring + first, sizeof(ring[0]),
+				  TRACE_SIZE - first, f) == TRACE_SIZE - first;
+		ok = ok && fwrite(ring, sizeof(ring[0]), first + n - TRACE_SIZE,
+				  f) == first + n - TRACE_SIZE;
+	}
+	if (fclose(f) != 0 || !ok) {
+		return -1;
+	}
+	return 0;
+}
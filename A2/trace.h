@@ -0,0 +1,68 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Scheduler event tracing (see thread_trace_start in thread.h). Events are
+ * recorded in a ring of TRACE_SIZE entries shared by the workers, which
+ * overwrites the oldest events once it is full. With tracing off, recording
+ * an event costs a test of trace_enabled. With it on, it costs a TSC read,
+ * an atomic increment and a few stores, and never allocates, so events are
+ * recorded from the scheduler and the interrupt handler.
+ *
+ * thread_trace_save writes a trace_header and then the events, oldest
+ * first. trace2json converts such a file to the JSON that chrome://tracing
+ * and Perfetto read.
+ */
+
+#define TRACE_SIZE (1 << 16) /* a power of two */
+#define TRACE_MAGIC 0x45435254
+
+/* For the switches (TRACE_YIELD to TRACE_EXIT), tid is the thread switched
+ * away from, and arg the thread switched to, or THREAD_NONE if the worker
+ * goes idle. */
+enum trace_type {
+	TRACE_YIELD,	/* tid yielded */
+	TRACE_SLEEP,	/* tid went to sleep */
+	TRACE_PREEMPT,	/* tid was preempted by a tick */
+	TRACE_EXIT,	/* tid exited */
+	TRACE_RUN,	/* the idle worker started running arg */
+	TRACE_CREATE,	/* tid created thread arg */
+	TRACE_KILL,	/* tid killed thread arg */
+	TRACE_WAKEUP,	/* tid (THREAD_NONE for a timeout) woke up thread arg */
+	TRACE_CONTEND,	/* tid found a lock held by thread arg */
+	TRACE_TICK,	/* a tick interrupted tid; arg is 1 if it was deferred */
+	TRACE_NR_TYPES
+};
+
+struct trace_event {
+	uint64_t tsc;
+	int32_t tid;
+	int32_t arg;
+	uint16_t type;
+	uint16_t worker;
+};
+
+struct trace_header {
+	uint32_t magic;
+	uint32_t nr_events;
+	uint64_t lost;		/* events overwritten before the save */
+	uint64_t start_tsc;	/* when tracing started */
+	double tsc_per_usec;
+};
+
+extern bool trace_enabled;
+
+void trace_record(int type, int tid, int arg);
+
+/* Record an event, if tracing is on. */
+static inline void
+trace(int type, int tid, int arg)
+{
+	if (__builtin_expect(trace_enabled, 0)) {
+		trace_record(type, tid, arg);
+	}
+}
+
+#endif /* _TRACE_H_ */
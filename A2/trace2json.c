@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "thread.h"
+#include "trace.h"
+
+/******************************************************************************
+ * trace2json converts a trace saved by thread_trace_save to the Chrome trace
+ * event format, which chrome://tracing and https://ui.perfetto.dev open.
+ * Each worker is a track, showing which thread ran on it when, with the
+ * reason each run ended. Creations, kills, wakeups, lock contention and
+ * ticks are instant events on the track of the worker they happened on.
+ *
+ * Usage: trace2json trace.bin > trace.json
+ *****************************************************************************/
+
+static const char *names[TRACE_NR_TYPES] = {
+	[TRACE_YIELD] = "yield",
+	[TRACE_SLEEP] = "sleep",
+	[TRACE_PREEMPT] = "preempt",
+	[TRACE_EXIT] = "exit",
+	[TRACE_RUN] = "run",
+	[TRACE_CREATE] = "create",
+	[TRACE_KILL] = "kill",
+	[TRACE_WAKEUP] = "wakeup",
+	[TRACE_CONTEND] = "contend",
+	[TRACE_TICK] = "tick",
+};
+
+/* the thread each worker runs, and since when, or -1 while it is idle or
+ * nothing is known yet */
+static int running[THREAD_MAX_WORKERS];
+static double since[THREAD_MAX_WORKERS];
+static bool seen[THREAD_MAX_WORKERS];
+static bool first_event = true;
+
+static void
+emit(const char *fmt_event)
+{
+	printf("%s\n  %s", first_event ? "" : ",", fmt_event);
+	first_event = false;
+}
+
+static void
+slice(int worker, int tid, double start, double end, const char *why)
+{
+	char buf[256];
+
+	snprintf(buf, sizeof(buf), "{\"name\": \"tid %d\", \"cat\": \"run\", "
+		 "\"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, "
+		 "\"dur\": %.3f, \"args\": {\"end\": \"%s\"}}", tid, worker,
+		 start, end - start, why);
+	emit(buf);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct trace_header h;
+	struct trace_event e;
+	double ts, begin = 0, last = 0;
+	char buf[256];
+	FILE *f;
+	int w;
+	uint32_t i;
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s trace.bin > trace.json\n", argv[0]);
+		return 1;
+	}
+	f = fopen(argv[1], "r");
+	if (f == NULL) {
+		perror(argv[1]);
+		return 1;
+	}
+	if (fread(&h, sizeof(h), 1, f) != 1 || h.magic != TRACE_MAGIC) {
+		fprintf(stderr, "%s: not a thread trace\n", argv[1]);
+		return 1;
+	}
+	if (h.lost > 0) {
+		fprintf(stderr, "%s: the %lu oldest events were overwritten\n",
+			argv[1], (unsigned long)h.lost);
+	}
+	for (w = 0; w < THREAD_MAX_WORKERS; w++) {
+		running[w] = -1;
+	}
+
+	printf("{\"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+	for (i = 0; i < h.nr_events; i++) {
+		if (fread(&e, sizeof(e), 1, f) != 1 ||
+		    e.worker >= THREAD_MAX_WORKERS || e.type >= TRACE_NR_TYPES) {
+			fprintf(stderr, "%s: bad event %u\n", argv[1], i);
+			return 1;
+		}
+		ts = (double)(int64_t)(e.tsc - h.start_tsc) / h.tsc_per_usec;
+		if (i == 0) {
+			begin = ts;
+		}
+		last = ts;
+		w = e.worker;
+		if (!seen[w]) {
+			seen[w] = true;
+			snprintf(buf, sizeof(buf), "{\"name\": \"thread_name\", "
+				 "\"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+				 "\"args\": {\"name\": \"worker %d\"}}", w, w);
+			emit(buf);
+		}
+
+		switch (e.type) {
+		case TRACE_YIELD:
+		case TRACE_SLEEP:
+		case TRACE_PREEMPT:
+		case TRACE_EXIT:
+			/* a thread that was running when the trace starts (or
+			 * whose start was overwritten) ran since the
+			 * beginning */
+			slice(w, e.tid, running[w] == e.tid ? since[w] : begin,
+			      ts, names[e.type]);
+			/* fall through */
+		case TRACE_RUN:
+			running[w] = e.arg;
+			since[w] = ts;
+			break;
+		default:
+			snprintf(buf, sizeof(buf), "{\"name\": \"%s\", "
+				 "\"ph\": \"i\", \"s\": \"t\", \"pid\": 1, "
+				 "\"tid\": %d, \"ts\": %.3f, \"args\": "
+				 "{\"tid\": %d, \"arg\": %d}}", names[e.type], w,
+				 ts, e.tid, e.arg);
+			emit(buf);
+			break;
+		}
+	}
+	/* close the runs still going at the end of the trace */
+	for (w = 0; w < THREAD_MAX_WORKERS; w++) {
+		if (running[w] >= 0) {
+			slice(w, running[w], since[w], last, "end of trace");
+		}
+	}
+	printf("\n]}\n");
+	fclose(f);
+	return 0;
+}
@@ -0,0 +1,183 @@
+#include <assert.h>
+#include <stddef.h>
+#include <time.h>
+#include "wheel.h"
+
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+/* the farthest a timer can be placed from now; later timers are put in the
+ * last slot of the top level and placed again when it is cascaded */
+#define WHEEL_RANGE (1UL << (WHEEL_BITS * WHEEL_LEVELS))
+
+static struct wheel_timer *slots[WHEEL_LEVELS][WHEEL_SIZE];
+/* the last tick that was processed by wheel_advance */
+static unsigned long wheel_now = 0;
+static long nr_pending = 0;
+static bool started = false;
+
+static unsigned long
+now_usecs(void)
+{
+	struct timespec ts;
+	int ret = clock_gettime(CLOCK_MONOTONIC, &ts);
+	assert(!ret);
+	return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+unsigned long
+wheel_time(long usecs_from_now, bool round_up)
+{
+	unsigned long usecs = now_usecs() + usecs_from_now;
+	if (round_up) {
+		usecs += WHEEL_TICK_USECS - 1;
+	}
+	return usecs / WHEEL_TICK_USECS;
+}
+
+void
+wheel_timer_init(struct wheel_timer *t)
+{
+	t->next = NULL;
+	t->prev = NULL;
+	t->slot = NULL;
+	t->expires = 0;
+}
+
+bool
+wheel_pending(struct wheel_timer *t)
+{
+	return t->slot != NULL;
+}
+
+static void
+slot_insert(struct wheel_timer **slot, struct wheel_timer *t)
+{
+	t->slot = slot;
+	t->prev = NULL;
+	t->next = *slot;
+	if (*slot != NULL) {
+		(*slot)->prev = t;
+	}
+	*slot = t;
+}
+
+/* put t in the slot for its expiry, relative to wheel_now */
+static void
+place(struct wheel_timer *t)
+{
+	unsigned long expires = t->expires;
+	unsigned long delta;
+	int level;
+
+	if (expires <= wheel_now) {
+		expires = wheel_now + 1;
+	}
+	delta = expires - wheel_now;
+	if (delta >= WHEEL_RANGE) {
+		expires = wheel_now + WHEEL_RANGE - 1;
+		delta = WHEEL_RANGE - 1;
+	}
+	for (level = 0; level < WHEEL_LEVELS - 1; level++) {
+		if (delta < 1UL << (WHEEL_BITS * (level + 1))) {
+			break;
+		}
+	}
+	slot_insert(&slots[level][(expires >> (WHEEL_BITS * level)) & WHEEL_MASK], t);
+}
+
+void
+wheel_add(struct wheel_timer *t, unsigned long expires)
+{
+	assert(!wheel_pending(t));
+	/* the wheel starts at the time of the first timer */
+	if (!started) {
+		started = true;
+		wheel_now = wheel_time(0, false);
+	}
+	t->expires = expires;
+	place(t);
+	nr_pending++;
+}
+
+void
+wheel_del(struct wheel_timer *t)
+{
+	assert(wheel_pending(t));
+	if (t->prev == NULL) {
+		*t->slot = t->next;
+	} else {
+		t->prev->next = t->next;
+	}
+	if (t->next != NULL) {
+		t->next->prev = t->prev;
+	}
+	t->next = NULL;
+	t->prev = NULL;
+	t->slot = NULL;
+	nr_pending--;
+}
+
+bool
+wheel_empty(void)
+{
+	return nr_pending == 0;
+}
+
+/* move the timers of the current slot of level down the wheel. returns the
+ * index of that slot; when it is 0, the next level is due as well. */
+static int
+cascade(int level)
+{
+	int idx = (wheel_now >> (WHEEL_BITS * level)) & WHEEL_MASK;
+	struct wheel_timer *t = slots[level][idx];
+
+	slots[level][idx] = NULL;
+	while (t != NULL) {
+		struct wheel_timer *next = t->next;
+		place(t);
+		t = next;
+	}
+	return idx;
+}
+
+void
+wheel_advance(unsigned long now, void (*fire)(struct wheel_timer *))
+{
+	while (wheel_now < now) {
+		if (nr_pending == 0) {
+			wheel_now = now;
+			break;
+		}
+		wheel_now++;
+		int idx = wheel_now & WHEEL_MASK;
+		if (idx == 0) {
+			for (int level = 1; level < WHEEL_LEVELS; level++) {
+				if (cascade(level) != 0) {
+					break;
+				}
+			}
+		}
+		while (slots[0][idx] != NULL) {
+			struct wheel_timer *t = slots[0][idx];
+			wheel_del(t);
+			fire(t);
+		}
+	}
+}
+
+unsigned long
+wheel_next(void)
+{
+	unsigned long tick;
+
+	if (nr_pending == 0) {
+		return 0;
+	}
+	/* look through level 0 up to the next cascade, which may bring
+	 * timers down from the higher levels */
+	for (tick = wheel_now + 1; (tick & WHEEL_MASK) != 0; tick++) {
+		if (slots[0][tick & WHEEL_MASK] != NULL) {
+			return tick;
+		}
+	}
+	return tick;
+}
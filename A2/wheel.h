@@ -0,0 +1,59 @@
+#ifndef _WHEEL_H_
+#define _WHEEL_H_
+
+#include <stdbool.h>
+
+/* A hierarchical timer wheel, used for the timeouts of the threads library.
+ * Time is counted in ticks of WHEEL_TICK_USECS. There are WHEEL_LEVELS
+ * levels of WHEEL_SIZE slots. Level 0 has one slot per tick; each slot of
+ * level L covers WHEEL_SIZE^L ticks. A timer is put on the lowest level
+ * whose range covers it, and is moved down a level (cascaded) when the wheel
+ * reaches its slot. Adding and removing a timer is O(1), and advancing the
+ * wheel by one tick is O(1) plus the work of firing and cascading timers.
+ *
+ * The wheel is not locked. The threads library only uses it with
+ * interrupts disabled.
+ */
+
+#define WHEEL_TICK_USECS 100
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4
+
+struct wheel_timer {
+	struct wheel_timer *next;
+	struct wheel_timer *prev;
+	struct wheel_timer **slot; /* the list the timer is on, or NULL */
+	unsigned long expires;	   /* the tick at which the timer fires */
+};
+
+/* Return the time usecs_from_now microseconds from now, in wheel ticks,
+ * rounded up if round_up is true. */
+unsigned long wheel_time(long usecs_from_now, bool round_up);
+
+/* Set up a timer that is not pending. */
+void wheel_timer_init(struct wheel_timer *t);
+
+/* Whether the timer is waiting to fire. */
+bool wheel_pending(struct wheel_timer *t);
+
+/* Make the timer fire at tick expires. It must not be pending. A time that
+ * has already passed fires at the next wheel_advance. */
+void wheel_add(struct wheel_timer *t, unsigned long expires);
+
+/* Cancel a pending timer. */
+void wheel_del(struct wheel_timer *t);
+
+/* Whether no timer is pending. */
+bool wheel_empty(void);
+
+/* Advance the wheel to tick now and call fire on every timer that has
+ * expired, in order of the tick they expire at. The timer is no longer
+ * pending when fire is called, so fire may add it again. */
+void wheel_advance(unsigned long now, void (*fire)(struct wheel_timer *));
+
+/* Return a tick no later than the expiry of the next timer to fire, or 0 if
+ * no timer is pending. */
+unsigned long wheel_next(void);
+
+#endif /* _WHEEL_H_ */
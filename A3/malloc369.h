@@ -13,5 +13,7 @@ extern bool is_leak_free();
 extern void *malloc369(size_t size);
 extern void free369(void *ptr);
 extern void init_csc369_malloc(bool verbose);
+extern long get_num_tracked(long *map_buckets);
+extern void print_tracked(int max);
 
 #endif /* _MALLOC369_H__ */
@@ -230,10 +230,10 @@ void free_pagetable(void)
 			{
 				if (first_pd[i].next_level[j].real_pt)
 				{
-					free(first_pd[i].next_level[j].real_pt);
+					free369(first_pd[i].next_level[j].real_pt);
 				}
 			}
-			free(first_pd[i].next_level);
+			free369(first_pd[i].next_level);
 		}
 	}
 }
@@ -274,6 +274,7 @@ main(int argc, char *argv[])
 		long unfreed_mallocs = get_current_num_mallocs() - start_mallocs;
 		printf("Detected %lu bytes leaked from %lu un-freed mallocs.\n",
 		       bytes_leaked, unfreed_mallocs);
+		print_tracked(10);
 	}
 	
 	return 0;